@@ -0,0 +1,168 @@
+﻿/**
+ * @file ByteBuffer.cpp
+ * @brief IBuffer views and copies, and pooled byte buffers for the cover-art pipeline.
+ */
+
+#include "pch.h"
+#include "ByteBuffer.h"
+
+#include <robuffer.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace winrt;
+using namespace winrt::Windows::Foundation;
+using namespace winrt::Windows::Storage::Streams;
+
+namespace
+{
+    /**
+     * @struct BufferView
+     * @brief An IBuffer over memory it does not own.
+     */
+    struct BufferView : implements<BufferView, IBuffer, ::Windows::Storage::Streams::IBufferByteAccess>
+    {
+        BufferView(uint8_t* data, uint32_t capacity, uint32_t length)
+            : m_data(data), m_capacity(capacity), m_length(length)
+        {
+        }
+
+        uint32_t Capacity() const { return m_capacity; }
+        uint32_t Length() const { return m_length; }
+
+        void Length(uint32_t value)
+        {
+            if (value > m_capacity) {
+                throw hresult_invalid_argument();
+            }
+            m_length = value;
+        }
+
+        HRESULT __stdcall Buffer(uint8_t** value) final
+        {
+            *value = m_data;
+            return S_OK;
+        }
+
+    private:
+        uint8_t* m_data;
+        uint32_t m_capacity;
+        uint32_t m_length;
+    };
+}
+
+IBuffer MakeBufferView(uint8_t* data, uint32_t capacity, uint32_t length)
+{
+    return make<BufferView>(data, capacity, length);
+}
+
+IBuffer MakeBufferView(array_view<uint8_t const> data)
+{
+    // Consumers of a full-length view only read from it, so handing out a mutable pointer is safe.
+    return make<BufferView>(const_cast<uint8_t*>(data.data()), data.size(), data.size());
+}
+
+IBuffer CopyToBuffer(array_view<uint8_t const> data)
+{
+    Buffer buffer(data.size());
+    if (data.size() > 0) {
+        std::memcpy(buffer.data(), data.data(), data.size());
+    }
+    buffer.Length(data.size());
+    return buffer;
+}
+
+IAsyncOperation<uint32_t> ReadStreamIntoAsync(IInputStream stream, uint8_t* data, uint32_t size)
+{
+    uint32_t total = 0;
+    while (total < size) {
+        IBuffer target = MakeBufferView(data + total, size - total, 0);
+        IBuffer result = co_await stream.ReadAsync(target, size - total, InputStreamOptions::None);
+
+        uint32_t read = (std::min)(result.Length(), size - total);
+        if (read == 0) {
+            break;
+        }
+        if (result.data() != data + total) {
+            // The stream is allowed to return its own buffer instead of filling ours.
+            std::memcpy(data + total, result.data(), read);
+        }
+        total += read;
+    }
+    co_return total;
+}
+
+BufferPool::Lease::Lease(BufferPool* pool, std::unique_ptr<Storage> storage)
+    : m_pool(pool), m_storage(std::move(storage))
+{
+}
+
+BufferPool::Lease::Lease(Lease&& other) noexcept
+    : m_pool(other.m_pool), m_storage(std::move(other.m_storage))
+{
+    other.m_pool = nullptr;
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        if (m_pool && m_storage) {
+            m_pool->Release(std::move(m_storage));
+        }
+        m_pool = other.m_pool;
+        m_storage = std::move(other.m_storage);
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+BufferPool::Lease::~Lease()
+{
+    if (m_pool && m_storage) {
+        m_pool->Release(std::move(m_storage));
+    }
+}
+
+BufferPool::BufferPool(size_t maxIdle)
+    : m_maxIdle(maxIdle)
+{
+}
+
+BufferPool::Lease BufferPool::Acquire(uint32_t minCapacity)
+{
+    std::unique_ptr<Storage> storage;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_idle.empty()) {
+            // Prefer the largest idle buffer so it rarely has to grow.
+            auto largest = std::max_element(m_idle.begin(), m_idle.end(),
+                [](auto const& a, auto const& b) { return a->capacity < b->capacity; });
+            storage = std::move(*largest);
+            m_idle.erase(largest);
+        }
+    }
+
+    if (!storage) {
+        storage = std::make_unique<Storage>();
+    }
+    if (storage->capacity < minCapacity) {
+        // Uninitialized on purpose: the stream read overwrites every byte that is used.
+        storage->data.reset(new uint8_t[minCapacity]);
+        storage->capacity = minCapacity;
+    }
+    return Lease(this, std::move(storage));
+}
+
+void BufferPool::Trim()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_idle.clear();
+}
+
+void BufferPool::Release(std::unique_ptr<Storage> storage)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_idle.size() < m_maxIdle) {
+        m_idle.push_back(std::move(storage));
+    }
+}
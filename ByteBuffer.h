@@ -0,0 +1,108 @@
+﻿#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Wraps caller-owned memory in a WinRT IBuffer without copying it.
+ *
+ * The returned buffer exposes the memory through IBufferByteAccess, so WinRT APIs such as
+ * IInputStream::ReadAsync and HttpBufferContent read and write it in place. It does not own the
+ * memory; the caller must keep it alive until every operation using the buffer has completed.
+ * @param data Pointer to the first byte.
+ * @param capacity Number of bytes available at data.
+ * @param length Number of bytes that currently hold valid data.
+ * @return A non-owning IBuffer over the memory.
+ */
+winrt::Windows::Storage::Streams::IBuffer MakeBufferView(uint8_t* data, uint32_t capacity, uint32_t length);
+
+/**
+ * @brief Wraps read-only caller-owned memory in a full-length WinRT IBuffer without copying it.
+ *
+ * Intended for buffers that are only read by the consumer, e.g. an HTTP request body.
+ */
+winrt::Windows::Storage::Streams::IBuffer MakeBufferView(winrt::array_view<uint8_t const> data);
+
+/**
+ * @brief Copies bytes into a WinRT IBuffer that owns them.
+ *
+ * For bodies of requests that may outlive the caller's memory, e.g. an upload that is cancelled
+ * while WinINet is still sending it. Every holder of the buffer shares the one copy.
+ */
+winrt::Windows::Storage::Streams::IBuffer CopyToBuffer(winrt::array_view<uint8_t const> data);
+
+/**
+ * @brief Reads a stream into caller-owned memory with as few copies as the stream allows.
+ *
+ * The stream reads straight into the memory through a buffer view. Only if a stream hands back
+ * its own buffer instead are its bytes copied over.
+ * @param stream The stream to read from, positioned at its start.
+ * @param data Destination memory; it must stay alive until the operation completes.
+ * @param size Number of bytes to read.
+ * @return The number of bytes actually read, which is less than size only at end of stream.
+ */
+winrt::Windows::Foundation::IAsyncOperation<uint32_t> ReadStreamIntoAsync(winrt::Windows::Storage::Streams::IInputStream stream, uint8_t* data, uint32_t size);
+
+/**
+ * @class BufferPool
+ * @brief A small pool of reusable byte buffers for per-track data such as cover-art bytes.
+ *
+ * Buffers only ever grow, so after the first few tracks a track change allocates nothing.
+ */
+class BufferPool {
+    struct Storage {
+        std::unique_ptr<uint8_t[]> data;
+        uint32_t                   capacity = 0;
+    };
+
+public:
+    /**
+     * @class Lease
+     * @brief Exclusive use of one pooled buffer; it returns to the pool when the lease is destroyed.
+     */
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+
+        uint8_t* data() const { return m_storage ? m_storage->data.get() : nullptr; }
+        uint32_t capacity() const { return m_storage ? m_storage->capacity : 0; }
+
+    private:
+        friend class BufferPool;
+        Lease(BufferPool* pool, std::unique_ptr<Storage> storage);
+
+        BufferPool*              m_pool = nullptr;
+        std::unique_ptr<Storage> m_storage;
+    };
+
+    /**
+     * @param maxIdle The maximum number of idle buffers kept for reuse.
+     */
+    explicit BufferPool(size_t maxIdle);
+
+    /**
+     * @brief Hands out a buffer of at least the given size, reusing an idle one when possible.
+     */
+    Lease Acquire(uint32_t minCapacity);
+
+    /**
+     * @brief Frees all idle buffers. Leased buffers are unaffected and return to the pool as usual.
+     */
+    void Trim();
+
+private:
+    void Release(std::unique_ptr<Storage> storage);
+
+    size_t                                m_maxIdle;
+    std::mutex                            m_lock;
+    std::vector<std::unique_ptr<Storage>> m_idle;
+};
@@ -0,0 +1,283 @@
+﻿/**
+ * @file CoverCache.cpp
+ * @brief In-memory LRU cache of uploaded cover-art URLs, keyed by a hash of the image bytes and by how the image looks.
+ */
+
+#include "pch.h"
+#include "CoverCache.h"
+#include "CoverStore.h"
+#include "Hash.h"
+#include "PerceptualHash.h"
+
+#include <algorithm>
+#include <cwctype>
+
+std::wstring NormalizeMetadataField(std::wstring_view field)
+{
+    std::wstring normalized;
+    normalized.reserve(field.size());
+    bool pendingSpace = false;
+    for (wchar_t ch : field) {
+        if (std::iswspace(ch)) {
+            pendingSpace = !normalized.empty();
+            continue;
+        }
+        if (pendingSpace) {
+            normalized.push_back(L' ');
+            pendingSpace = false;
+        }
+        normalized.push_back(ch);
+    }
+
+    if (!normalized.empty()) {
+        LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_LOWERCASE, normalized.data(), (int)normalized.size(),
+            normalized.data(), (int)normalized.size(), nullptr, nullptr, 0);
+    }
+    return normalized;
+}
+
+uint64_t MakeAlbumKey(std::wstring_view artist, std::wstring_view album)
+{
+    std::wstring normalizedArtist = NormalizeMetadataField(artist);
+    std::wstring normalizedAlbum = NormalizeMetadataField(album);
+    if (normalizedArtist.empty() || normalizedAlbum.empty()) {
+        return 0;
+    }
+
+    uint64_t key = HashBytes(normalizedArtist.data(), normalizedArtist.size() * sizeof(wchar_t));
+    key = HashBytes(normalizedAlbum.data(), normalizedAlbum.size() * sizeof(wchar_t), key);
+    return key != 0 ? key : 1;
+}
+
+namespace
+{
+    /**
+     * @brief Key of one band of a perceptual hash in the perceptual index: the band number and its bits.
+     */
+    uint32_t PerceptualBandKey(uint64_t perceptualHash, uint32_t band)
+    {
+        constexpr uint32_t BAND_BITS = 64 / CoverCache::PERCEPTUAL_BANDS;
+        uint32_t bits = static_cast<uint32_t>((perceptualHash >> (band * BAND_BITS)) & ((1ull << BAND_BITS) - 1));
+        return (band << BAND_BITS) | bits;
+    }
+}
+
+CoverCache::CoverCache(size_t capacity, CoverStore* store)
+    : m_capacity(capacity > 0 ? capacity : 1)
+    , m_store(store)
+{
+}
+
+std::optional<CoverCache::Hit> CoverCache::Lookup(uint64_t contentHash, Clock::duration minRemaining)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (auto hit = LookupLocked(contentHash, minRemaining)) {
+        return hit;
+    }
+    return LookupStore(contentHash, minRemaining);
+}
+
+std::optional<CoverCache::Hit> CoverCache::LookupAlbum(uint64_t albumKey, Clock::duration minRemaining)
+{
+    if (albumKey == 0) {
+        return std::nullopt;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto it = m_albumIndex.find(albumKey);
+    if (it != m_albumIndex.end()) {
+        if (auto hit = LookupLocked(it->second, minRemaining)) {
+            return hit;
+        }
+    }
+
+    // Not linked in this session; an earlier run may have uploaded the album's cover.
+    if (!m_store) {
+        return std::nullopt;
+    }
+    std::optional<uint64_t> contentHash = m_store->LookupAlbumLink(albumKey);
+    if (!contentHash) {
+        return std::nullopt;
+    }
+    auto hit = LookupLocked(*contentHash, minRemaining);
+    if (!hit) {
+        hit = LookupStore(*contentHash, minRemaining);
+    }
+    if (hit) {
+        LinkAlbumLocked(albumKey, *contentHash);
+    }
+    return hit;
+}
+
+void CoverCache::Insert(uint64_t contentHash, std::wstring url, Clock::time_point expires, uint64_t perceptualHash)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_store) {
+        m_store->PutUpload(contentHash, url, expires);
+    }
+    InsertLocked(contentHash, std::move(url), expires, perceptualHash);
+}
+
+std::optional<CoverCache::Hit> CoverCache::LookupSimilar(uint64_t perceptualHash, uint32_t maxDistance, Clock::duration minRemaining)
+{
+    if (perceptualHash == 0) {
+        return std::nullopt;
+    }
+    maxDistance = (std::min)(maxDistance, PERCEPTUAL_BANDS - 1);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // Gather first: LookupLocked may evict an expiring candidate, which would invalidate the iterators.
+    std::vector<std::pair<uint32_t, uint64_t>> candidates; // Distance, content hash
+    for (uint32_t band = 0; band < PERCEPTUAL_BANDS; ++band) {
+        auto [first, last] = m_perceptualIndex.equal_range(PerceptualBandKey(perceptualHash, band));
+        for (auto it = first; it != last; ++it) {
+            auto entry = m_index.find(it->second);
+            if (entry == m_index.end()) {
+                continue;
+            }
+            uint32_t distance = HammingDistance(perceptualHash, entry->second->perceptualHash);
+            if (distance <= maxDistance) {
+                candidates.emplace_back(distance, it->second);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (auto const& [distance, contentHash] : candidates) {
+        if (auto hit = LookupLocked(contentHash, minRemaining)) {
+            return hit;
+        }
+    }
+    return std::nullopt;
+}
+
+void CoverCache::LinkAlbum(uint64_t albumKey, uint64_t contentHash)
+{
+    if (albumKey == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_store) {
+        m_store->PutAlbumLink(albumKey, contentHash);
+    }
+    LinkAlbumLocked(albumKey, contentHash);
+}
+
+/**
+ * @brief Promotes a stored upload that is still usable into the LRU.
+ */
+std::optional<CoverCache::Hit> CoverCache::LookupStore(uint64_t contentHash, Clock::duration minRemaining)
+{
+    if (!m_store) {
+        return std::nullopt;
+    }
+    std::optional<CoverStore::Upload> upload = m_store->LookupUpload(contentHash);
+    if (!upload || upload->expires - Clock::now() < minRemaining) {
+        return std::nullopt;
+    }
+    InsertLocked(contentHash, upload->url, upload->expires);
+    return Hit{ std::move(upload->url), upload->expires };
+}
+
+void CoverCache::InsertLocked(uint64_t contentHash, std::wstring url, Clock::time_point expires, uint64_t perceptualHash)
+{
+    auto it = m_index.find(contentHash);
+    if (it != m_index.end()) {
+        it->second->url = std::move(url);
+        it->second->expires = expires;
+        if (perceptualHash != 0 && perceptualHash != it->second->perceptualHash) {
+            IndexPerceptualLocked(contentHash, it->second->perceptualHash, false);
+            it->second->perceptualHash = perceptualHash;
+            IndexPerceptualLocked(contentHash, perceptualHash, true);
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+
+    m_entries.push_front(Entry{ contentHash, std::move(url), expires, {}, perceptualHash });
+    m_index.emplace(contentHash, m_entries.begin());
+    IndexPerceptualLocked(contentHash, perceptualHash, true);
+
+    while (m_entries.size() > m_capacity) {
+        EraseLocked(std::prev(m_entries.end()));
+    }
+}
+
+void CoverCache::LinkAlbumLocked(uint64_t albumKey, uint64_t contentHash)
+{
+    auto entry = m_index.find(contentHash);
+    if (entry == m_index.end()) {
+        return;
+    }
+
+    auto previous = m_albumIndex.find(albumKey);
+    if (previous != m_albumIndex.end()) {
+        if (previous->second == contentHash) {
+            return;
+        }
+        // The album's art changed; detach the key from the old cover before relinking it.
+        auto oldEntry = m_index.find(previous->second);
+        if (oldEntry != m_index.end()) {
+            auto& keys = oldEntry->second->albumKeys;
+            keys.erase(std::remove(keys.begin(), keys.end(), albumKey), keys.end());
+        }
+    }
+
+    m_albumIndex[albumKey] = contentHash;
+    entry->second->albumKeys.push_back(albumKey);
+}
+
+std::optional<CoverCache::Hit> CoverCache::LookupLocked(uint64_t contentHash, Clock::duration minRemaining)
+{
+    auto it = m_index.find(contentHash);
+    if (it == m_index.end()) {
+        return std::nullopt;
+    }
+
+    auto entry = it->second;
+    if (entry->expires - Clock::now() < minRemaining) {
+        // Too close to expiry to hand out; the caller re-uploads and refreshes the entry.
+        EraseLocked(entry);
+        return std::nullopt;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, entry);
+    return Hit{ entry->url, entry->expires };
+}
+
+/**
+ * @brief Adds an entry to, or removes it from, every band of the perceptual index. A hash of 0 is never indexed.
+ */
+void CoverCache::IndexPerceptualLocked(uint64_t contentHash, uint64_t perceptualHash, bool add)
+{
+    if (perceptualHash == 0) {
+        return;
+    }
+    for (uint32_t band = 0; band < PERCEPTUAL_BANDS; ++band) {
+        uint32_t key = PerceptualBandKey(perceptualHash, band);
+        if (add) {
+            m_perceptualIndex.emplace(key, contentHash);
+            continue;
+        }
+        auto [first, last] = m_perceptualIndex.equal_range(key);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == contentHash) {
+                m_perceptualIndex.erase(it);
+                break;
+            }
+        }
+    }
+}
+
+void CoverCache::EraseLocked(EntryList::iterator entry)
+{
+    for (uint64_t albumKey : entry->albumKeys) {
+        m_albumIndex.erase(albumKey);
+    }
+    IndexPerceptualLocked(entry->contentHash, entry->perceptualHash, false);
+    m_index.erase(entry->contentHash);
+    m_entries.erase(entry);
+}
@@ -0,0 +1,139 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class CoverStore;
+
+/**
+ * @brief Trims, collapses internal whitespace and lowercases a metadata field.
+ */
+std::wstring NormalizeMetadataField(std::wstring_view field);
+
+/**
+ * @brief Builds the metadata key used to find an album's cover without reading the thumbnail.
+ *
+ * Artist and album are trimmed, whitespace-collapsed and lowercased before hashing, so
+ * cosmetic differences between SMTC events still map to the same key.
+ * @param artist The track artist as reported by SMTC.
+ * @param album The album title as reported by SMTC.
+ * @return The album key, or 0 if there is not enough metadata to identify the album.
+ */
+uint64_t MakeAlbumKey(std::wstring_view artist, std::wstring_view album);
+
+/**
+ * @class CoverCache
+ * @brief A thread-safe LRU cache mapping a content hash of cover-art bytes to its uploaded URL.
+ *
+ * Every entry remembers the expiry that was requested from the upload host, so a lookup only
+ * returns URLs that will stay valid for at least the requested amount of time.
+ *
+ * A second, metadata-keyed index maps album keys (see MakeAlbumKey) onto content hashes. It is
+ * consulted first, so a track from an album whose cover is already uploaded needs no thumbnail I/O.
+ *
+ * With a CoverStore attached, both indexes write through to it and fall back to it on a miss, so
+ * uploads and album links from earlier runs are found again after a restart.
+ *
+ * Entries may also carry a perceptual hash of the image (see ComputeCoverPerceptualHash), indexed so
+ * that the same art in another encoding is found by Hamming distance. The hash is cut into
+ * PERCEPTUAL_BANDS bands and each band value is indexed on its own: two hashes that differ in fewer
+ * bits than there are bands agree exactly in at least one band, so a lookup only has to check the
+ * entries sharing a band value instead of every entry. This index lives in memory only.
+ */
+class CoverCache {
+public:
+    using Clock = std::chrono::system_clock;
+
+    static constexpr uint32_t PERCEPTUAL_BANDS = 4;
+
+    /**
+     * @struct Hit
+     * @brief A live URL and the expiry that was requested for it.
+     */
+    struct Hit {
+        std::wstring        url;
+        Clock::time_point   expires;
+    };
+
+    /**
+     * @param capacity The maximum number of URLs to keep before the least recently used one is evicted.
+     * @param store Optional persistent backing store; it must outlive the cache.
+     */
+    explicit CoverCache(size_t capacity, CoverStore* store = nullptr);
+
+    /**
+     * @brief Looks up a live URL for the given cover-art content hash.
+     * @param contentHash The hash of the original thumbnail bytes.
+     * @param minRemaining The minimum lifetime the URL must have left to count as a hit.
+     * @return The cached URL and its expiry, or std::nullopt on a miss or if the entry is about to expire.
+     */
+    std::optional<Hit> Lookup(uint64_t contentHash, Clock::duration minRemaining);
+
+    /**
+     * @brief Stores (or refreshes) the URL for the given cover-art content hash.
+     * @param contentHash The hash of the original thumbnail bytes.
+     * @param url The public URL returned by the upload host.
+     * @param expires The expiry that was requested from the upload host.
+     * @param perceptualHash The image's perceptual hash, or 0 if it has none.
+     */
+    void Insert(uint64_t contentHash, std::wstring url, Clock::time_point expires, uint64_t perceptualHash = 0);
+
+    /**
+     * @brief Looks up a live URL for an image that looks the same as the one with the given perceptual hash.
+     * @param perceptualHash The perceptual hash of the image; 0 always misses.
+     * @param maxDistance The most bits the hashes may differ in; capped at PERCEPTUAL_BANDS - 1.
+     * @param minRemaining The minimum lifetime the URL must have left to count as a hit.
+     * @return The closest match's URL and expiry, or std::nullopt if nothing is close enough.
+     */
+    std::optional<Hit> LookupSimilar(uint64_t perceptualHash, uint32_t maxDistance, Clock::duration minRemaining);
+
+    /**
+     * @brief Looks up a live URL through the album index.
+     * @param albumKey The key returned by MakeAlbumKey. A key of 0 always misses.
+     * @param minRemaining The minimum lifetime the URL must have left to count as a hit.
+     * @return The cached URL and its expiry, or std::nullopt if the album is unknown or its URL is about to expire.
+     */
+    std::optional<Hit> LookupAlbum(uint64_t albumKey, Clock::duration minRemaining);
+
+    /**
+     * @brief Records that an album's cover is the cached entry with the given content hash.
+     *
+     * Does nothing if the key is 0 or no entry with that hash is cached.
+     * @param albumKey The key returned by MakeAlbumKey.
+     * @param contentHash The hash of the album's thumbnail bytes.
+     */
+    void LinkAlbum(uint64_t albumKey, uint64_t contentHash);
+
+private:
+    struct Entry {
+        uint64_t              contentHash;
+        std::wstring          url;
+        Clock::time_point     expires;
+        std::vector<uint64_t> albumKeys;            // Album index entries pointing at this cover
+        uint64_t              perceptualHash = 0;   // 0 if unknown
+    };
+
+    using EntryList = std::list<Entry>;
+
+    std::optional<Hit> LookupLocked(uint64_t contentHash, Clock::duration minRemaining);
+    std::optional<Hit> LookupStore(uint64_t contentHash, Clock::duration minRemaining);
+    void InsertLocked(uint64_t contentHash, std::wstring url, Clock::time_point expires, uint64_t perceptualHash = 0);
+    void IndexPerceptualLocked(uint64_t contentHash, uint64_t perceptualHash, bool add);
+    void LinkAlbumLocked(uint64_t albumKey, uint64_t contentHash);
+    void EraseLocked(EntryList::iterator entry);
+
+    size_t                                                     m_capacity;
+    CoverStore*                                                m_store;
+    std::mutex                                                 m_lock;
+    EntryList                                                  m_entries; // Most recently used first
+    std::unordered_map<uint64_t, EntryList::iterator>          m_index;
+    std::unordered_map<uint64_t, uint64_t>                     m_albumIndex; // Album key -> content hash
+    std::unordered_multimap<uint32_t, uint64_t>                m_perceptualIndex; // Band and its bits -> content hash
+};
@@ -0,0 +1,186 @@
+﻿/**
+ * @file CoverImage.cpp
+ * @brief WIC-based downscale/recompress stage that runs between the thumbnail read and the upload.
+ */
+
+#include "pch.h"
+#include "CoverImage.h"
+#include "Log.h"
+#include "PerceptualHash.h"
+#include "StringUtils.h"
+
+#include <ole2.h>
+#include <wincodec.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+using namespace winrt;
+
+namespace
+{
+    /**
+     * @brief Returns the process-wide WIC factory. The factory is free-threaded, so it is shared.
+     */
+    com_ptr<IWICImagingFactory> GetImagingFactory()
+    {
+        static com_ptr<IWICImagingFactory> factory = [] {
+            com_ptr<IWICImagingFactory> created;
+            check_hresult(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
+                __uuidof(IWICImagingFactory), created.put_void()));
+            return created;
+        }();
+        return factory;
+    }
+
+    /**
+     * @brief Decodes the first frame of an encoded image.
+     */
+    com_ptr<IWICBitmapFrameDecode> DecodeFirstFrame(IWICImagingFactory* factory, array_view<uint8_t const> source, GUID* containerFormat)
+    {
+        com_ptr<IWICStream> input;
+        check_hresult(factory->CreateStream(input.put()));
+        check_hresult(input->InitializeFromMemory(const_cast<BYTE*>(source.data()), source.size()));
+
+        com_ptr<IWICBitmapDecoder> decoder;
+        check_hresult(factory->CreateDecoderFromStream(input.get(), nullptr, WICDecodeMetadataCacheOnDemand, decoder.put()));
+        if (containerFormat) {
+            check_hresult(decoder->GetContainerFormat(containerFormat));
+        }
+
+        // The frame keeps the decoder and the stream alive.
+        com_ptr<IWICBitmapFrameDecode> frame;
+        check_hresult(decoder->GetFrame(0, frame.put()));
+        return frame;
+    }
+}
+
+bool RecompressCover(array_view<uint8_t const> source, uint32_t maxPixels, uint32_t jpegQuality,
+    BufferPool& pool, BufferPool::Lease& output, uint32_t& outputSize)
+{
+    if (maxPixels == 0 || source.empty()) {
+        return false;
+    }
+
+    try {
+        com_ptr<IWICImagingFactory> factory = GetImagingFactory();
+
+        GUID containerFormat{};
+        com_ptr<IWICBitmapFrameDecode> frame = DecodeFirstFrame(factory.get(), source, &containerFormat);
+
+        UINT width = 0, height = 0;
+        check_hresult(frame->GetSize(&width, &height));
+        if (width == 0 || height == 0) {
+            return false;
+        }
+
+        UINT longestEdge = (std::max)(width, height);
+        if (longestEdge <= maxPixels && containerFormat == GUID_ContainerFormatJpeg) {
+            // Already a small JPEG; re-encoding would only cost quality.
+            return false;
+        }
+
+        UINT targetWidth = width;
+        UINT targetHeight = height;
+        com_ptr<IWICBitmapSource> pixels = frame.as<IWICBitmapSource>();
+        if (longestEdge > maxPixels) {
+            targetWidth = (std::max)(1u, static_cast<UINT>(static_cast<uint64_t>(width) * maxPixels / longestEdge));
+            targetHeight = (std::max)(1u, static_cast<UINT>(static_cast<uint64_t>(height) * maxPixels / longestEdge));
+
+            com_ptr<IWICBitmapScaler> scaler;
+            check_hresult(factory->CreateBitmapScaler(scaler.put()));
+            check_hresult(scaler->Initialize(pixels.get(), targetWidth, targetHeight, WICBitmapInterpolationModeHighQualityCubic));
+            pixels = scaler.as<IWICBitmapSource>();
+        }
+
+        com_ptr<IWICFormatConverter> converter;
+        check_hresult(factory->CreateFormatConverter(converter.put()));
+        check_hresult(converter->Initialize(pixels.get(), GUID_WICPixelFormat24bppBGR, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom));
+
+        com_ptr<IStream> encoded;
+        check_hresult(CreateStreamOnHGlobal(nullptr, TRUE, encoded.put()));
+
+        com_ptr<IWICBitmapEncoder> encoder;
+        check_hresult(factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, encoder.put()));
+        check_hresult(encoder->Initialize(encoded.get(), WICBitmapEncoderNoCache));
+
+        com_ptr<IWICBitmapFrameEncode> frameEncode;
+        com_ptr<IPropertyBag2> encoderOptions;
+        check_hresult(encoder->CreateNewFrame(frameEncode.put(), encoderOptions.put()));
+
+        PROPBAG2 qualityOption{};
+        qualityOption.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+        VARIANT qualityValue;
+        VariantInit(&qualityValue);
+        qualityValue.vt = VT_R4;
+        qualityValue.fltVal = (std::clamp)(jpegQuality, 1u, 100u) / 100.0f;
+        check_hresult(encoderOptions->Write(1, &qualityOption, &qualityValue));
+
+        check_hresult(frameEncode->Initialize(encoderOptions.get()));
+        check_hresult(frameEncode->SetSize(targetWidth, targetHeight));
+        WICPixelFormatGUID pixelFormat = GUID_WICPixelFormat24bppBGR;
+        check_hresult(frameEncode->SetPixelFormat(&pixelFormat));
+        check_hresult(frameEncode->WriteSource(converter.get(), nullptr));
+        check_hresult(frameEncode->Commit());
+        check_hresult(encoder->Commit());
+
+        STATSTG stat{};
+        check_hresult(encoded->Stat(&stat, STATFLAG_NONAME));
+        uint32_t encodedSize = stat.cbSize.LowPart;
+        if (stat.cbSize.HighPart != 0 || encodedSize == 0 || encodedSize >= source.size()) {
+            // Not worth it; keep the original bytes.
+            return false;
+        }
+
+        HGLOBAL memory = nullptr;
+        check_hresult(GetHGlobalFromStream(encoded.get(), &memory));
+        const void* bytes = GlobalLock(memory);
+        if (!bytes) {
+            return false;
+        }
+        output = pool.Acquire(encodedSize);
+        std::memcpy(output.data(), bytes, encodedSize);
+        GlobalUnlock(memory);
+
+        outputSize = encodedSize;
+        return true;
+    }
+    catch (hresult_error const& ex) {
+        LOG_WARNING("Could not recompress cover art, uploading the original: " << ws2s(ex.message()));
+        return false;
+    }
+}
+
+bool ComputeCoverPerceptualHash(array_view<uint8_t const> source, uint64_t& hash)
+{
+    if (source.empty()) {
+        return false;
+    }
+
+    try {
+        com_ptr<IWICImagingFactory> factory = GetImagingFactory();
+        com_ptr<IWICBitmapFrameDecode> frame = DecodeFirstFrame(factory.get(), source, nullptr);
+
+        // Fant averages every source pixel into the grid, which is what keeps the hash stable across sizes.
+        com_ptr<IWICBitmapScaler> scaler;
+        check_hresult(factory->CreateBitmapScaler(scaler.put()));
+        check_hresult(scaler->Initialize(frame.get(), DHASH_GRID_WIDTH, DHASH_GRID_HEIGHT, WICBitmapInterpolationModeFant));
+
+        com_ptr<IWICFormatConverter> gray;
+        check_hresult(factory->CreateFormatConverter(gray.put()));
+        check_hresult(gray->Initialize(scaler.get(), GUID_WICPixelFormat8bppGray, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom));
+
+        std::array<uint8_t, DHASH_GRID_BYTES> grid{};
+        check_hresult(gray->CopyPixels(nullptr, DHASH_GRID_STRIDE, static_cast<UINT>(grid.size()), grid.data()));
+
+        hash = ComputeDHash(grid.data());
+        // A flat image sets no bits (a smooth gradient all of them), and every other such image would match it.
+        return hash != 0 && hash != ~0ull;
+    }
+    catch (hresult_error const& ex) {
+        LOG_DEBUG("Could not compute the perceptual hash of the cover art: " << ws2s(ex.message()));
+        return false;
+    }
+}
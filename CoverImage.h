@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include "ByteBuffer.h"
+
+#include <winrt/Windows.Foundation.h>
+#include <cstdint>
+
+/**
+ * @brief Downscales and re-encodes cover art as JPEG with WIC before it is uploaded.
+ *
+ * Discord only ever renders the large image at a small size, so a full-size thumbnail mostly
+ * costs upload time. The result is written into a buffer leased from the given pool.
+ * @param source The original image bytes (any format WIC can decode).
+ * @param maxPixels The longest edge of the output image. Smaller images are not upscaled.
+ * @param jpegQuality The JPEG quality, 1-100.
+ * @param pool The pool the output buffer is leased from.
+ * @param output Receives the lease holding the encoded JPEG.
+ * @param outputSize Receives the number of valid bytes in the output buffer.
+ * @return true if a smaller image was produced; false if the original should be uploaded as-is,
+ *         either because re-encoding would not help or because the image could not be processed.
+ */
+bool RecompressCover(winrt::array_view<uint8_t const> source, uint32_t maxPixels, uint32_t jpegQuality,
+    BufferPool& pool, BufferPool::Lease& output, uint32_t& outputSize);
+
+/**
+ * @brief Computes the perceptual hash (see ComputeDHash) of encoded cover art.
+ *
+ * The image is decoded with WIC and downsampled to the small grayscale dHash grid, so the same art
+ * at another size or in another format hashes to nearly the same value.
+ * @param source The original image bytes (any format WIC can decode).
+ * @param hash Receives the hash.
+ * @return false if the image could not be decoded, or is so flat that its hash says nothing.
+ */
+bool ComputeCoverPerceptualHash(winrt::array_view<uint8_t const> source, uint64_t& hash);
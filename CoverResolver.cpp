@@ -0,0 +1,235 @@
+﻿/**
+ * @file CoverResolver.cpp
+ * @brief Resolves album covers to resources.tidal.com URLs through TIDAL's catalog search.
+ */
+
+#include "pch.h"
+#include "CoverResolver.h"
+#include "CoverCache.h"
+#include "CoverStore.h"
+#include "HttpSession.h"
+#include "Log.h"
+#include "StringUtils.h"
+
+#include <cstdlib>
+#include <fstream>
+
+#include <winrt/Windows.Data.Json.h>
+#include <winrt/Windows.Web.Http.h>
+#include <winrt/Windows.Web.Http.Headers.h>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::Data::Json;
+using namespace Windows::Web::Http;
+
+namespace
+{
+    constexpr wchar_t SEARCH_URL[] = L"https://api.tidal.com/v1/search/tracks";
+    constexpr wchar_t IMAGE_URL[] = L"https://resources.tidal.com/images/";
+    constexpr wchar_t IMAGE_SIZE[] = L"/640x640.jpg";
+    constexpr uint32_t SEARCH_LIMIT = 10;
+
+    /**
+     * @brief Turns a cover id (a UUID) into its CDN URL; the dashes become path separators.
+     */
+    std::wstring MakeImageUrl(std::wstring coverId)
+    {
+        for (wchar_t& ch : coverId) {
+            if (ch == L'-') {
+                ch = L'/';
+            }
+        }
+        return IMAGE_URL + coverId + IMAGE_SIZE;
+    }
+
+    /**
+     * @brief Returns whether a catalog artist is one of the artists SMTC reports (e.g. "A, B" contains "A").
+     */
+    bool ArtistMatches(const std::wstring& normalizedSmtcArtist, std::wstring_view catalogArtist)
+    {
+        std::wstring normalized = NormalizeMetadataField(catalogArtist);
+        return !normalized.empty() && normalizedSmtcArtist.find(normalized) != std::wstring::npos;
+    }
+
+    /**
+     * @brief Picks the cover id of the first search result whose album and artist match the track.
+     * @return The cover id, or an empty string if no result matches closely enough.
+     */
+    std::wstring FindCoverId(const JsonObject& response, const std::wstring& artist, const std::wstring& album)
+    {
+        std::wstring normalizedArtist = NormalizeMetadataField(artist);
+        std::wstring normalizedAlbum = NormalizeMetadataField(album);
+
+        for (auto const& value : response.GetNamedArray(L"items", JsonArray())) {
+            if (value.ValueType() != JsonValueType::Object) {
+                continue;
+            }
+            JsonObject item = value.GetObject();
+            JsonObject itemAlbum = item.GetNamedObject(L"album", JsonObject());
+            if (NormalizeMetadataField(itemAlbum.GetNamedString(L"title", L"")) != normalizedAlbum) {
+                continue;
+            }
+
+            bool artistMatches = ArtistMatches(normalizedArtist, item.GetNamedObject(L"artist", JsonObject()).GetNamedString(L"name", L""));
+            for (auto const& itemArtist : item.GetNamedArray(L"artists", JsonArray())) {
+                if (!artistMatches && itemArtist.ValueType() == JsonValueType::Object) {
+                    artistMatches = ArtistMatches(normalizedArtist, itemArtist.GetObject().GetNamedString(L"name", L""));
+                }
+            }
+            if (!artistMatches) {
+                continue;
+            }
+
+            std::wstring cover(itemAlbum.GetNamedString(L"cover", L""));
+            if (!cover.empty()) {
+                return cover;
+            }
+        }
+        return std::wstring();
+    }
+}
+
+void CoverResolver::Configure(std::wstring token, std::wstring countryCode)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_token = std::move(token);
+    m_countryCode = countryCode.empty() ? std::wstring(L"US") : std::move(countryCode);
+}
+
+void CoverResolver::Load(CoverStore& store, const std::wstring& legacyPath)
+{
+    bool persistent = store.IsOpen();
+    size_t imported = 0;
+    {
+        std::ifstream file(legacyPath);
+        std::string line;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_store = &store;
+        while (std::getline(file, line)) {
+            // One "<album key in hex>\t<url>" pair per line; later lines win.
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos || tab == 0 || tab + 1 >= line.size()) {
+                continue;
+            }
+            uint64_t key = std::strtoull(line.substr(0, tab).c_str(), nullptr, 16);
+            if (key == 0) {
+                continue;
+            }
+            std::wstring url = s2ws(std::string_view(line).substr(tab + 1));
+            if (persistent) {
+                store.PutResolved(key, url);
+            }
+            else {
+                m_urls[key] = std::move(url);
+            }
+            ++imported;
+        }
+    }
+
+    if (imported > 0 && persistent) {
+        // Everything is in the store now; delete the file so it is imported only once.
+        DeleteFileW(legacyPath.c_str());
+        LOG_INFO("Imported " << imported << " resolved cover URL(s) into the cover store.");
+    }
+    else if (imported > 0) {
+        LOG_INFO("Loaded " << imported << " resolved cover URL(s).");
+    }
+}
+
+std::optional<std::wstring> CoverResolver::Lookup(uint64_t albumKey) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return LookupLocked(albumKey);
+}
+
+std::optional<std::wstring> CoverResolver::LookupLocked(uint64_t albumKey) const
+{
+    if (auto it = m_urls.find(albumKey); it != m_urls.end()) {
+        return it->second;
+    }
+    return m_store ? m_store->LookupResolved(albumKey) : std::nullopt;
+}
+
+std::wstring CoverResolver::WarmUpUrl() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_token.empty() ? std::wstring() : std::wstring(SEARCH_URL);
+}
+
+IAsyncOperation<hstring> CoverResolver::ResolveAsync(std::wstring title, std::wstring artist, std::wstring album)
+{
+    auto cancellation = co_await get_cancellation_token();
+    cancellation.enable_propagation();
+
+    uint64_t albumKey = MakeAlbumKey(artist, album);
+    if (albumKey == 0 || title.empty()) {
+        co_return hstring();
+    }
+
+    std::wstring token;
+    std::wstring countryCode;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (auto url = LookupLocked(albumKey)) {
+            co_return hstring(*url);
+        }
+        if (m_token.empty() || m_misses.count(albumKey) != 0) {
+            co_return hstring();
+        }
+        token = m_token;
+        countryCode = m_countryCode;
+    }
+
+    std::wstring query = artist + L" " + title;
+    Uri uri(std::wstring(SEARCH_URL) + L"?query=" + std::wstring(Uri::EscapeComponent(query))
+        + L"&limit=" + std::to_wstring(SEARCH_LIMIT) + L"&countryCode=" + std::wstring(Uri::EscapeComponent(countryCode)));
+
+    HttpRequestMessage request(HttpMethod::Get(), uri);
+    request.Headers().Insert(L"x-tidal-token", token);
+
+    std::wstring coverId;
+    try {
+        HttpResponseMessage response = co_await GetSharedHttpClient().SendRequestAsync(request);
+        hstring body = co_await response.Content().ReadAsStringAsync();
+        if (!response.IsSuccessStatusCode()) {
+            LOG_WARNING("Cover lookup failed: HTTP " << static_cast<int>(response.StatusCode()));
+            co_return hstring();
+        }
+
+        JsonObject json{ nullptr };
+        if (JsonObject::TryParse(body, json)) {
+            coverId = FindCoverId(json, artist, album);
+        }
+    }
+    catch (hresult_canceled const&) {
+        throw;
+    }
+    catch (hresult_error const& ex) {
+        // Network trouble is not a verdict on the album; try again on the next track.
+        LOG_WARNING("Cover lookup failed: " << ws2s(ex.message()));
+        co_return hstring();
+    }
+
+    if (coverId.empty()) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_misses.insert(albumKey);
+        co_return hstring();
+    }
+
+    std::wstring url = MakeImageUrl(std::move(coverId));
+    Remember(albumKey, url);
+    co_return hstring(url);
+}
+
+void CoverResolver::Remember(uint64_t albumKey, const std::wstring& url)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_store && m_store->IsOpen()) {
+        m_store->PutResolved(albumKey, url);
+    }
+    else {
+        m_urls[albumKey] = url;
+    }
+}
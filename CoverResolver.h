@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class CoverStore;
+
+/**
+ * @class CoverResolver
+ * @brief Finds an album's cover on TIDAL's public image CDN, so the thumbnail never has to be uploaded.
+ *
+ * TIDAL's catalog knows the cover of every album it streams, and resources.tidal.com serves those
+ * covers at permanent URLs. The resolver searches the catalog for the playing track, takes the cover
+ * of the result whose album matches, and remembers the album -> URL mapping in the CoverStore, so
+ * after the first play of an album no network request is needed at all, not even after a restart.
+ *
+ * Thread-safe.
+ */
+class CoverResolver {
+public:
+    /**
+     * @brief Sets the API token and catalog country. An empty token disables remote lookups.
+     */
+    void Configure(std::wstring token, std::wstring countryCode);
+
+    /**
+     * @brief Keeps resolved URLs in the given store from now on.
+     *
+     * Mappings from the tab-separated file that older versions wrote are imported into the store
+     * once and the file is deleted. If the store is disabled, they are only loaded for this session.
+     * @param store The persistent store; it must outlive the resolver.
+     * @param legacyPath The old mapping file, which may not exist.
+     */
+    void Load(CoverStore& store, const std::wstring& legacyPath);
+
+    /**
+     * @brief Returns the persisted CDN URL for an album, without touching the network.
+     * @param albumKey The key from MakeAlbumKey.
+     */
+    std::optional<std::wstring> Lookup(uint64_t albumKey) const;
+
+    /**
+     * @brief Returns the catalog URL remote lookups go to, or an empty string if they are disabled.
+     */
+    std::wstring WarmUpUrl() const;
+
+    /**
+     * @brief Looks up the album's CDN cover URL, from the mapping file or from TIDAL's catalog.
+     *
+     * Albums that could not be resolved are remembered for the rest of the session and not looked up again.
+     * @return An awaitable operation that resolves to the CDN URL, or an empty string if the cover
+     *         could not be resolved and the thumbnail has to be uploaded instead.
+     */
+    winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> ResolveAsync(std::wstring title, std::wstring artist, std::wstring album);
+
+private:
+    std::optional<std::wstring> LookupLocked(uint64_t albumKey) const;
+    void Remember(uint64_t albumKey, const std::wstring& url);
+
+    mutable std::mutex                          m_lock;
+    std::wstring                                m_token;
+    std::wstring                                m_countryCode;
+    CoverStore*                                 m_store = nullptr;
+    std::unordered_map<uint64_t, std::wstring>  m_urls;     // Album key -> CDN URL, resolved this session
+    std::unordered_set<uint64_t>                m_misses;   // Albums the catalog could not match this session
+};
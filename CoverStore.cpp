@@ -0,0 +1,437 @@
+﻿/**
+ * @file CoverStore.cpp
+ * @brief Memory-mapped, open-addressed cover URL table with checksummed slots and atomic compaction.
+ *
+ * File layout: a 64-byte Header, then slotCount 48-byte Slots, then heapCapacity bytes of UTF-16
+ * URL text. New URL text is appended at heapUsed; a slot points at its text by offset and length.
+ */
+
+#include "pch.h"
+#include "CoverStore.h"
+#include "Hash.h"
+#include "Log.h"
+#include "StringUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+enum class CoverStore::Kind : uint32_t {
+    Resolved = 1,   // Album key -> CDN URL, never expires
+    Upload = 2,     // Content hash -> uploaded URL with expiry
+    AlbumLink = 3,  // Album key -> content hash, no URL
+};
+
+namespace
+{
+    constexpr uint32_t STORE_MAGIC = 0x53435254;         // "TRCS"
+    constexpr uint32_t STORE_VERSION = 1;
+    constexpr uint32_t INITIAL_SLOT_COUNT = 1024;        // Must be a power of two
+    constexpr uint64_t INITIAL_HEAP_BYTES = 128 * 1024;
+    constexpr uint64_t MAX_HEAP_BYTES = 64 * 1024 * 1024;
+    constexpr uint32_t MAX_LOAD_PERCENT = 70;            // Compact once this share of the slots is used
+    constexpr size_t   MAX_URL_CHARS = 4096;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slotCount;     // Power of two
+        uint32_t heapCapacity;  // Bytes
+        uint32_t heapUsed;      // Bytes appended so far
+        uint32_t usedSlots;
+        uint8_t  reserved[40];
+    };
+    static_assert(sizeof(Header) == 64, "The header is part of the file format");
+
+    struct Slot {
+        uint64_t key;           // 0 while the slot is free; written last
+        uint32_t kind;
+        uint32_t urlChars;
+        uint32_t urlOffset;     // Byte offset into the heap
+        uint32_t reserved;
+        int64_t  expiresMs;     // Unix time in ms; 0 = never
+        uint64_t link;          // Content hash, for album links
+        uint64_t checksum;      // Over key, the fields above and the URL bytes
+    };
+    static_assert(sizeof(Slot) == 48, "The slot is part of the file format");
+
+    uint64_t LayoutSize(uint32_t slotCount, uint64_t heapCapacity)
+    {
+        return sizeof(Header) + static_cast<uint64_t>(slotCount) * sizeof(Slot) + heapCapacity;
+    }
+
+    int64_t ToUnixMs(CoverStore::Clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    uint64_t SlotChecksum(const Slot& slot, const uint8_t* urlBytes)
+    {
+        uint64_t hash = HashBytes(&slot.kind, offsetof(Slot, checksum) - offsetof(Slot, kind), slot.key);
+        return HashBytes(urlBytes, static_cast<size_t>(slot.urlChars) * sizeof(wchar_t), hash);
+    }
+}
+
+/**
+ * @brief One mapped store file.
+ */
+struct CoverStore::File {
+    HANDLE      handle = INVALID_HANDLE_VALUE;
+    HANDLE      section = nullptr;
+    uint8_t*    view = nullptr;
+    uint64_t    size = 0;
+
+    ~File()
+    {
+        if (view) {
+            UnmapViewOfFile(view);
+        }
+        if (section) {
+            CloseHandle(section);
+        }
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+        }
+    }
+
+    Header& header() { return *reinterpret_cast<Header*>(view); }
+    Slot* slots() { return reinterpret_cast<Slot*>(view + sizeof(Header)); }
+    uint8_t* heap() { return view + sizeof(Header) + static_cast<size_t>(header().slotCount) * sizeof(Slot); }
+
+    /**
+     * @brief Maps the file at path. An empty (new) file is laid out with the given geometry first.
+     * @param truncate Start over with an empty file even if one exists.
+     * @return nullptr if the file cannot be opened or its header does not describe it.
+     */
+    static std::unique_ptr<File> Map(const std::wstring& path, bool truncate, uint32_t slotCount, uint64_t heapCapacity)
+    {
+        auto file = std::make_unique<File>();
+        // No FILE_SHARE_WRITE: a second instance gets no store rather than a second writer.
+        file->handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+            truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file->handle == INVALID_HANDLE_VALUE) {
+            return nullptr;
+        }
+
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(file->handle, &fileSize)) {
+            return nullptr;
+        }
+        bool fresh = fileSize.QuadPart == 0;
+        if (fresh) {
+            // Extending the file zero-fills it, which leaves every slot free.
+            fileSize.QuadPart = static_cast<LONGLONG>(LayoutSize(slotCount, heapCapacity));
+            if (!SetFilePointerEx(file->handle, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(file->handle)) {
+                return nullptr;
+            }
+        }
+        if (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+            return nullptr;
+        }
+        file->size = static_cast<uint64_t>(fileSize.QuadPart);
+
+        file->section = CreateFileMappingW(file->handle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+        if (!file->section) {
+            return nullptr;
+        }
+        file->view = static_cast<uint8_t*>(MapViewOfFile(file->section, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+        if (!file->view) {
+            return nullptr;
+        }
+
+        Header& header = file->header();
+        if (fresh) {
+            header.slotCount = slotCount;
+            header.heapCapacity = static_cast<uint32_t>(heapCapacity);
+            header.version = STORE_VERSION;
+            header.magic = STORE_MAGIC;
+        }
+        bool valid = header.magic == STORE_MAGIC && header.version == STORE_VERSION
+            && header.slotCount != 0 && (header.slotCount & (header.slotCount - 1)) == 0
+            && LayoutSize(header.slotCount, header.heapCapacity) == file->size
+            && header.heapUsed <= header.heapCapacity && header.usedSlots <= header.slotCount;
+        return valid ? std::move(file) : nullptr;
+    }
+
+    /**
+     * @brief Returns whether a slot's fields and URL bytes are intact.
+     */
+    bool IsIntact(const Slot& slot)
+    {
+        uint64_t urlBytes = static_cast<uint64_t>(slot.urlChars) * sizeof(wchar_t);
+        return slot.key != 0 && slot.urlOffset + urlBytes <= header().heapCapacity
+            && SlotChecksum(slot, heap() + slot.urlOffset) == slot.checksum;
+    }
+
+    std::wstring_view Url(const Slot& slot)
+    {
+        return std::wstring_view(reinterpret_cast<const wchar_t*>(heap() + slot.urlOffset), slot.urlChars);
+    }
+
+    /**
+     * @brief Finds the slot for an entry by linear probing.
+     * @param forWrite Return the entry's slot even if it is torn, or the free slot that ends the probe.
+     * @return nullptr if the entry is not there (or, for writes, the table has no free slot left).
+     */
+    Slot* Find(Kind kind, uint64_t key, bool forWrite)
+    {
+        uint32_t mask = header().slotCount - 1;
+        uint64_t start = HashBytes(&key, sizeof(key), static_cast<uint64_t>(kind));
+        for (uint32_t probe = 0; probe <= mask; ++probe) {
+            Slot& slot = slots()[(start + probe) & mask];
+            if (slot.key == 0) {
+                return forWrite ? &slot : nullptr;
+            }
+            if (slot.key == key && slot.kind == static_cast<uint32_t>(kind)) {
+                return forWrite || IsIntact(slot) ? &slot : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Adds or replaces an entry.
+     * @return false if the heap or the table is too full; the caller compacts and tries again.
+     */
+    bool Write(Kind kind, uint64_t key, std::wstring_view url, int64_t expiresMs, uint64_t link)
+    {
+        Header& h = header();
+        Slot* slot = Find(kind, key, true);
+        if (!slot) {
+            return false;
+        }
+        bool isNew = slot->key == 0;
+        if (!isNew && IsIntact(*slot) && slot->expiresMs == expiresMs && slot->link == link && Url(*slot) == url) {
+            return true; // Nothing changed; don't spend heap on it
+        }
+
+        uint32_t urlBytes = static_cast<uint32_t>(url.size() * sizeof(wchar_t));
+        if (urlBytes > h.heapCapacity - h.heapUsed) {
+            return false;
+        }
+        if (isNew && (static_cast<uint64_t>(h.usedSlots) + 1) * 100 > static_cast<uint64_t>(h.slotCount) * MAX_LOAD_PERCENT) {
+            return false;
+        }
+
+        uint32_t offset = h.heapUsed;
+        if (urlBytes > 0) {
+            std::memcpy(heap() + offset, url.data(), urlBytes);
+            h.heapUsed = offset + urlBytes;
+        }
+
+        Slot staged{};
+        staged.key = key;
+        staged.kind = static_cast<uint32_t>(kind);
+        staged.urlChars = static_cast<uint32_t>(url.size());
+        staged.urlOffset = offset;
+        staged.expiresMs = expiresMs;
+        staged.link = link;
+        staged.checksum = SlotChecksum(staged, heap() + offset);
+
+        // Fields first and the key last, so a crash never leaves a free slot looking used. An entry
+        // overwritten in place that tears simply fails its checksum and reads as a miss.
+        std::memcpy(&slot->kind, &staged.kind, sizeof(Slot) - offsetof(Slot, kind));
+        std::atomic_thread_fence(std::memory_order_release);
+        if (isNew) {
+            slot->key = key;
+            ++h.usedSlots;
+        }
+        return true;
+    }
+};
+
+CoverStore::CoverStore() = default;
+CoverStore::~CoverStore()
+{
+    // Shutdown is the one moment a synchronous flush costs nobody a track change.
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_file) {
+        FlushViewOfFile(m_file->view, 0);
+    }
+}
+
+bool CoverStore::Open(std::wstring path)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_path = std::move(path);
+    m_file = File::Map(m_path, false, INITIAL_SLOT_COUNT, INITIAL_HEAP_BYTES);
+    if (!m_file) {
+        DWORD error = GetLastError();
+        if (error == ERROR_SHARING_VIOLATION) {
+            LOG_WARNING("Cover store is in use by another instance; cover URLs won't persist.");
+            return false;
+        }
+        // Unreadable or from another version: it is only a cache, so start over.
+        m_file = File::Map(m_path, true, INITIAL_SLOT_COUNT, INITIAL_HEAP_BYTES);
+        if (!m_file) {
+            LOG_WARNING("Could not open the cover store; cover URLs won't persist.");
+            return false;
+        }
+        LOG_WARNING("Cover store was unreadable and has been reset.");
+    }
+    LOG_DEBUG("Cover store opened with " << m_file->header().usedSlots << " entries.");
+    return true;
+}
+
+bool CoverStore::IsOpen()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_file != nullptr;
+}
+
+std::optional<std::wstring> CoverStore::LookupResolved(uint64_t albumKey)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_file || albumKey == 0) {
+        return std::nullopt;
+    }
+    Slot* slot = m_file->Find(Kind::Resolved, albumKey, false);
+    if (!slot) {
+        return std::nullopt;
+    }
+    return std::wstring(m_file->Url(*slot));
+}
+
+void CoverStore::PutResolved(uint64_t albumKey, std::wstring_view url)
+{
+    Put(Kind::Resolved, albumKey, url, 0, 0);
+}
+
+std::optional<CoverStore::Upload> CoverStore::LookupUpload(uint64_t contentHash)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_file || contentHash == 0) {
+        return std::nullopt;
+    }
+    Slot* slot = m_file->Find(Kind::Upload, contentHash, false);
+    if (!slot) {
+        return std::nullopt;
+    }
+    return Upload{ std::wstring(m_file->Url(*slot)), Clock::time_point(std::chrono::milliseconds(slot->expiresMs)) };
+}
+
+void CoverStore::PutUpload(uint64_t contentHash, std::wstring_view url, Clock::time_point expires)
+{
+    Put(Kind::Upload, contentHash, url, ToUnixMs(expires), 0);
+}
+
+std::optional<uint64_t> CoverStore::LookupAlbumLink(uint64_t albumKey)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_file || albumKey == 0) {
+        return std::nullopt;
+    }
+    Slot* slot = m_file->Find(Kind::AlbumLink, albumKey, false);
+    if (!slot) {
+        return std::nullopt;
+    }
+    return slot->link;
+}
+
+void CoverStore::PutAlbumLink(uint64_t albumKey, uint64_t contentHash)
+{
+    Put(Kind::AlbumLink, albumKey, std::wstring_view(), 0, contentHash);
+}
+
+uint64_t CoverStore::EntryCount()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_file ? m_file->header().usedSlots : 0;
+}
+
+void CoverStore::Put(Kind kind, uint64_t key, std::wstring_view url, int64_t expiresMs, uint64_t link)
+{
+    if (key == 0 || url.size() > MAX_URL_CHARS) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_file) {
+        return;
+    }
+    if (!m_file->Write(kind, key, url, expiresMs, link)) {
+        CompactLocked(url.size() * sizeof(wchar_t));
+        if (!m_file || !m_file->Write(kind, key, url, expiresMs, link)) {
+            return;
+        }
+    }
+    // No flush: the pages belong to the system cache once written, so they outlive a crash of this
+    // process. Only an OS crash can lose the writes since the last compaction or shutdown.
+}
+
+/**
+ * @brief Rewrites the live entries into a fresh file that atomically replaces the current one.
+ * @param extraHeapBytes Heap space the caller needs on top of the live entries.
+ */
+void CoverStore::CompactLocked(uint64_t extraHeapBytes)
+{
+    struct LiveEntry {
+        Kind            kind;
+        uint64_t        key;
+        std::wstring    url;
+        int64_t         expiresMs;
+        uint64_t        link;
+    };
+
+    std::vector<LiveEntry> live;
+    std::unordered_set<uint64_t> liveUploads;
+    uint64_t heapBytes = extraHeapBytes;
+    int64_t now = ToUnixMs(Clock::now());
+
+    Slot* slots = m_file->slots();
+    for (uint32_t i = 0; i < m_file->header().slotCount; ++i) {
+        const Slot& slot = slots[i];
+        if (!m_file->IsIntact(slot)) {
+            continue;
+        }
+        Kind kind = static_cast<Kind>(slot.kind);
+        if (kind == Kind::Upload) {
+            if (slot.expiresMs <= now) {
+                continue;
+            }
+            liveUploads.insert(slot.key);
+        }
+        live.push_back({ kind, slot.key, std::wstring(m_file->Url(slot)), slot.expiresMs, slot.link });
+        heapBytes += static_cast<uint64_t>(slot.urlChars) * sizeof(wchar_t);
+    }
+    // Links only make sense while the upload they point at is still there.
+    live.erase(std::remove_if(live.begin(), live.end(), [&](const LiveEntry& entry) {
+        return entry.kind == Kind::AlbumLink && liveUploads.count(entry.link) == 0;
+        }), live.end());
+
+    uint32_t slotCount = INITIAL_SLOT_COUNT;
+    while ((live.size() + 1) * 100 > static_cast<uint64_t>(slotCount) * MAX_LOAD_PERCENT / 2) {
+        slotCount *= 2;
+    }
+    uint64_t heapCapacity = (std::max)(INITIAL_HEAP_BYTES, heapBytes * 2);
+    if (heapCapacity > MAX_HEAP_BYTES) {
+        LOG_WARNING("Cover store is full; new cover URLs won't persist.");
+        return;
+    }
+
+    std::wstring tempPath = m_path + L".tmp";
+    auto replacement = File::Map(tempPath, true, slotCount, heapCapacity);
+    if (!replacement) {
+        LOG_WARNING("Could not compact the cover store.");
+        return;
+    }
+    for (const LiveEntry& entry : live) {
+        replacement->Write(entry.kind, entry.key, entry.url, entry.expiresMs, entry.link);
+    }
+    // The new file must be on disk before it takes the old one's place.
+    bool flushed = FlushViewOfFile(replacement->view, 0) && FlushFileBuffers(replacement->handle);
+    replacement.reset();
+
+    m_file.reset();
+    if (!flushed || !MoveFileExW(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        LOG_WARNING("Could not replace the cover store; keeping the old file.");
+        DeleteFileW(tempPath.c_str());
+    }
+    else {
+        LOG_INFO("Compacted the cover store to " << live.size() << " entries.");
+    }
+    m_file = File::Map(m_path, false, INITIAL_SLOT_COUNT, INITIAL_HEAP_BYTES);
+}
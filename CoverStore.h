@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @class CoverStore
+ * @brief Persistent, memory-mapped table of everything known about cover art, kept across restarts.
+ *
+ * The file is a fixed-layout, open-addressed hash table followed by an append-only heap of URL text.
+ * Opening it maps the file and validates the header, nothing more, so lookups right after startup
+ * cost a page fault instead of a parse. It holds three kinds of entries:
+ *  - resolved CDN URLs by album key (from CoverResolver); these never expire
+ *  - uploaded URLs by content hash, with the expiry that was requested from the host
+ *  - album links: album key -> content hash of the album's uploaded cover
+ *
+ * Every slot carries a checksum over its fields and its URL bytes and is published by writing its
+ * key last, so a write torn by a crash reads back as an unusable slot and is simply skipped. When
+ * the table or the heap fills up, the live entries are rewritten into a new file that atomically
+ * replaces the old one; expired uploads and links to them are dropped on the way.
+ *
+ * Writes are not flushed on their own: they survive a crash of the process, and the file is flushed
+ * to disk on compaction and when the store is destroyed, so an OS crash loses at most the entries
+ * written since then, which only costs a re-upload or a lookup.
+ *
+ * Thread-safe. If the file cannot be opened (e.g. another instance holds it), every lookup misses
+ * and writes are ignored.
+ */
+class CoverStore {
+public:
+    using Clock = std::chrono::system_clock;
+
+    /**
+     * @struct Upload
+     * @brief An uploaded URL and the expiry requested for it.
+     */
+    struct Upload {
+        std::wstring        url;
+        Clock::time_point   expires;
+    };
+
+    CoverStore();
+    ~CoverStore();
+    CoverStore(const CoverStore&) = delete;
+    CoverStore& operator=(const CoverStore&) = delete;
+
+    /**
+     * @brief Opens or creates the store file. A file that fails validation is replaced by an empty one.
+     * @return false if the store stays disabled.
+     */
+    bool Open(std::wstring path);
+
+    /**
+     * @brief Returns whether the store is backed by its file.
+     */
+    bool IsOpen();
+
+    std::optional<std::wstring> LookupResolved(uint64_t albumKey);
+    void PutResolved(uint64_t albumKey, std::wstring_view url);
+
+    std::optional<Upload> LookupUpload(uint64_t contentHash);
+    void PutUpload(uint64_t contentHash, std::wstring_view url, Clock::time_point expires);
+
+    std::optional<uint64_t> LookupAlbumLink(uint64_t albumKey);
+    void PutAlbumLink(uint64_t albumKey, uint64_t contentHash);
+
+    /**
+     * @brief Number of occupied slots, including ones a later compaction will drop.
+     */
+    uint64_t EntryCount();
+
+private:
+    enum class Kind : uint32_t;
+    struct File;
+
+    void Put(Kind kind, uint64_t key, std::wstring_view url, int64_t expiresMs, uint64_t link);
+    void CompactLocked(uint64_t extraHeapBytes);
+
+    std::mutex              m_lock;
+    std::wstring            m_path;
+    std::unique_ptr<File>   m_file;     // Null while the store is disabled
+};
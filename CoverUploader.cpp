@@ -0,0 +1,400 @@
+﻿/**
+ * @file CoverUploader.cpp
+ * @brief Spreads cover art uploads over several temporary hosts, hedging slow ones and skipping broken ones.
+ *
+ * One slow host used to hold up every track. Each host now keeps a window of recent upload
+ * latencies; once a request has taken longer than its host's p95, a second request is fired at the
+ * next host and whichever succeeds first is used. Hosts that fail repeatedly trip a circuit breaker
+ * and are skipped until a jittered, exponentially growing cooldown has passed.
+ */
+
+#include "pch.h"
+#include "CoverUploader.h"
+#include "ByteBuffer.h"
+#include "UploadHost.h"
+#include "Log.h"
+#include "StringUtils.h"
+#include "Tracing.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <random>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::Storage::Streams;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t                    LATENCY_WINDOW = 32;                // Successful uploads kept per host for the p95
+    constexpr size_t                    MIN_LATENCY_SAMPLES = 5;            // Below this the p95 is not trusted yet
+    constexpr std::chrono::milliseconds DEFAULT_HEDGE_DELAY{ 3000 };
+    constexpr std::chrono::milliseconds MIN_HEDGE_DELAY{ 500 };
+    constexpr std::chrono::milliseconds MAX_HEDGE_DELAY{ 10000 };
+    constexpr size_t                    MAX_IN_FLIGHT = 2;                  // Primary plus one hedge
+    constexpr std::chrono::seconds      ROUND_TIMEOUT{ 30 };                // Give up on hosts that never answer
+
+    constexpr uint32_t                  BREAKER_THRESHOLD = 3;              // Consecutive failures that open the circuit
+    constexpr std::chrono::seconds      BREAKER_BASE_COOLDOWN{ 10 };
+    constexpr std::chrono::minutes      BREAKER_MAX_COOLDOWN{ 5 };
+
+    constexpr uint32_t                  MAX_ROUNDS = 3;                     // Rounds over all hosts before reporting an error
+    constexpr std::chrono::milliseconds RETRY_BASE_DELAY{ 500 };
+    constexpr std::chrono::milliseconds RETRY_MAX_DELAY{ 4000 };
+
+    /**
+     * @struct HostState
+     * @brief A host together with its latency window and circuit breaker.
+     */
+    struct HostState {
+        std::unique_ptr<IUploadHost>            host;
+        std::vector<std::chrono::milliseconds>  latencies;          // Ring of recent successful uploads
+        size_t                                  nextLatency = 0;
+        uint64_t                                successes = 0;
+        uint64_t                                failures = 0;
+        uint32_t                                consecutiveFailures = 0;
+        Clock::time_point                       openUntil{};        // Circuit is open until then
+    };
+
+    std::mutex              g_hostsLock;
+    std::vector<HostState>  g_hosts;
+    std::mt19937            g_random{ std::random_device{}() };
+
+    /**
+     * @brief Returns the host table, creating it on first use. Caller holds g_hostsLock.
+     */
+    std::vector<HostState>& HostsLocked()
+    {
+        if (g_hosts.empty()) {
+            for (auto* make : { MakeZeroXZeroHost, MakeLitterboxHost, MakeCurlHost }) {
+                HostState state;
+                state.host = make();
+                g_hosts.push_back(std::move(state));
+            }
+        }
+        return g_hosts;
+    }
+
+    /**
+     * @brief Returns a uniformly distributed duration in [low, high]. Caller holds g_hostsLock.
+     */
+    Clock::duration RandomBetweenLocked(Clock::duration low, Clock::duration high)
+    {
+        std::uniform_int_distribution<Clock::rep> distribution(low.count(), (std::max)(low, high).count());
+        return Clock::duration(distribution(g_random));
+    }
+
+    std::chrono::milliseconds P95Locked(const HostState& state)
+    {
+        if (state.latencies.empty()) {
+            return std::chrono::milliseconds(0);
+        }
+        std::vector<std::chrono::milliseconds> sorted = state.latencies;
+        size_t index = (sorted.size() * 95 + 99) / 100 - 1;
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    /**
+     * @brief How long to wait for a host before hedging to the next one.
+     */
+    std::chrono::milliseconds HedgeDelay(size_t hostIndex)
+    {
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        const HostState& state = HostsLocked()[hostIndex];
+        if (state.latencies.size() < MIN_LATENCY_SAMPLES) {
+            return DEFAULT_HEDGE_DELAY;
+        }
+        return (std::clamp)(P95Locked(state), MIN_HEDGE_DELAY, MAX_HEDGE_DELAY);
+    }
+
+    void RecordSuccess(size_t hostIndex, Clock::duration latency)
+    {
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        HostState& state = HostsLocked()[hostIndex];
+        auto sample = std::chrono::duration_cast<std::chrono::milliseconds>(latency);
+        if (state.latencies.size() < LATENCY_WINDOW) {
+            state.latencies.push_back(sample);
+        }
+        else {
+            state.latencies[state.nextLatency] = sample;
+        }
+        state.nextLatency = (state.nextLatency + 1) % LATENCY_WINDOW;
+        ++state.successes;
+        state.consecutiveFailures = 0;
+        state.openUntil = {};
+    }
+
+    void RecordFailure(size_t hostIndex)
+    {
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        HostState& state = HostsLocked()[hostIndex];
+        ++state.failures;
+        if (++state.consecutiveFailures < BREAKER_THRESHOLD) {
+            return;
+        }
+
+        // Double the cooldown for every failure past the threshold, including failed probes after a cooldown.
+        uint32_t doublings = (std::min)(state.consecutiveFailures - BREAKER_THRESHOLD, 10u);
+        Clock::duration cooldown = (std::min)(Clock::duration(BREAKER_BASE_COOLDOWN * (1u << doublings)), Clock::duration(BREAKER_MAX_COOLDOWN));
+        cooldown = RandomBetweenLocked(cooldown / 2, cooldown);
+        state.openUntil = Clock::now() + cooldown;
+
+        LOG_WARNING("Upload host " << ws2s(state.host->Name()) << " failed " << state.consecutiveFailures
+            << " times in a row; skipping it for " << std::chrono::duration_cast<std::chrono::seconds>(cooldown).count() << " s.");
+    }
+
+    /**
+     * @brief Returns the hosts whose circuit is closed (or whose cooldown is over), in priority order.
+     *
+     * If every circuit is open, the host that recovers first is returned anyway, so a cover is never
+     * skipped just because all hosts had a bad minute.
+     */
+    std::vector<size_t> AvailableHosts()
+    {
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        std::vector<HostState>& hosts = HostsLocked();
+        Clock::time_point now = Clock::now();
+
+        std::vector<size_t> available;
+        size_t soonest = 0;
+        for (size_t i = 0; i < hosts.size(); ++i) {
+            if (hosts[i].openUntil <= now) {
+                available.push_back(i);
+            }
+            if (hosts[i].openUntil < hosts[soonest].openUntil) {
+                soonest = i;
+            }
+        }
+        if (available.empty() && !hosts.empty()) {
+            available.push_back(soonest);
+        }
+        return available;
+    }
+
+    /**
+     * @brief Full-jitter exponential backoff before the given retry round.
+     */
+    Clock::duration RetryDelay(uint32_t round)
+    {
+        Clock::duration ceiling = (std::min)(Clock::duration(RETRY_BASE_DELAY * (1u << (std::min)(round, 10u))), Clock::duration(RETRY_MAX_DELAY));
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        return RandomBetweenLocked(Clock::duration::zero(), ceiling);
+    }
+
+    std::wstring HostName(size_t hostIndex)
+    {
+        std::lock_guard<std::mutex> lock(g_hostsLock);
+        return HostsLocked()[hostIndex].host->Name();
+    }
+
+    /**
+     * @struct Attempt
+     * @brief One request to one host.
+     */
+    struct Attempt {
+        size_t                      host;
+        IAsyncOperation<hstring>    operation;
+        Clock::time_point           started;
+        uint32_t                    number;     // Within the upload, for its trace events
+    };
+
+    void TraceAttemptStop(uint64_t generation, const Attempt& attempt, const char* outcome)
+    {
+        TraceUploadAttemptStop(generation, attempt.number, HostName(attempt.host).c_str(), outcome);
+    }
+
+    /**
+     * @brief Cancels every attempt and forgets it.
+     *
+     * Nothing waits for them to stop: each request body holds its own reference to the upload's
+     * bytes, so a cancelled request that is still sending can be abandoned.
+     * @param generation, outcome What to write in the attempts' trace Stop events.
+     */
+    void CancelAll(std::vector<Attempt>& attempts, uint64_t generation, const char* outcome)
+    {
+        for (auto& attempt : attempts) {
+            attempt.operation.Cancel();
+            TraceAttemptStop(generation, attempt, outcome);
+        }
+        attempts.clear();
+    }
+
+    /**
+     * @struct CancelOnExit
+     * @brief Cancels whatever attempts are still in the list when the upload leaves it, including
+     *        through a cancelled co_await, which throws before the loop can react.
+     */
+    struct CancelOnExit {
+        std::vector<Attempt>&   attempts;
+        uint64_t                generation;
+        ~CancelOnExit()
+        {
+            CancelAll(attempts, generation, "cancelled");
+        }
+    };
+}
+
+IAsyncOperation<hstring> UploadCoverArtAsync(array_view<uint8_t const> binaryData, std::chrono::system_clock::time_point expires, uint64_t generation)
+{
+    // One copy, made before anything suspends, that every request shares: a hedge that loses, or a
+    // request left running by a cancel, keeps reading its own reference and never the caller's memory.
+    IBuffer bytes = CopyToBuffer(binaryData);
+
+    // Cancelling the upload (e.g. because the track was skipped) cancels every request in flight.
+    auto cancellation = co_await get_cancellation_token();
+
+    // Attempts are started directly rather than awaited, so completions and cancellation both signal this event.
+    // It is shared with their Completed handlers, which may still run after this coroutine has returned.
+    auto wake = std::make_shared<handle>(check_pointer(CreateEventW(nullptr, FALSE, FALSE, nullptr)));
+    cancellation.callback([wake] { SetEvent(wake->get()); });
+
+    std::wstring lastError = L"no upload host available";
+    uint32_t attempts = 0;
+    for (uint32_t round = 0; round < MAX_ROUNDS; ++round)
+    {
+        if (round > 0) {
+            Clock::duration delay = RetryDelay(round);
+            LOG_WARNING("Every upload host failed; retrying in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() << " ms...");
+            // Waited on the wake event rather than a timer so that a skip ends the backoff right away.
+            // Late completions from the last round can signal it too, hence the loop.
+            Clock::time_point retryAt = Clock::now() + delay;
+            for (Clock::time_point now = Clock::now(); now < retryAt && !cancellation(); now = Clock::now()) {
+                co_await resume_on_signal(wake->get(), std::chrono::duration_cast<TimeSpan>(retryAt - now));
+            }
+        }
+
+        std::vector<size_t> candidates = AvailableHosts();
+        std::vector<Attempt> inFlight;
+        CancelOnExit cancelOnExit{ inFlight, generation };
+        size_t next = 0;
+        Clock::time_point roundDeadline = Clock::now() + ROUND_TIMEOUT;
+
+        // Starts the next candidate, skipping hosts that fail before a request is even made.
+        // Never starts one once the upload is cancelled.
+        auto launchNext = [&] {
+            if (cancellation()) {
+                throw hresult_canceled();
+            }
+            while (next < candidates.size()) {
+                size_t host = candidates[next++];
+                try {
+                    IAsyncOperation<hstring> operation{ nullptr };
+                    {
+                        std::lock_guard<std::mutex> lock(g_hostsLock);
+                        operation = HostsLocked()[host].host->UploadAsync(bytes, expires);
+                    }
+                    operation.Completed([wake](auto&&, auto&&) { SetEvent(wake->get()); });
+                    inFlight.push_back({ host, operation, Clock::now(), attempts });
+                    TraceUploadAttemptStart(generation, attempts++, HostName(host).c_str());
+                    return;
+                }
+                catch (hresult_error const& ex) {
+                    lastError = HostName(host) + L": " + std::wstring(ex.message());
+                    RecordFailure(host);
+                }
+            }
+        };
+        launchNext();
+
+        while (!inFlight.empty())
+        {
+            bool canHedge = inFlight.size() < MAX_IN_FLIGHT && next < candidates.size();
+            Clock::time_point hedgeAt = canHedge ? inFlight.back().started + HedgeDelay(inFlight.back().host) : Clock::time_point::max();
+            Clock::time_point wakeAt = (std::min)(roundDeadline, hedgeAt);
+            TimeSpan timeout = std::chrono::duration_cast<TimeSpan>((std::max)(wakeAt - Clock::now(), Clock::duration::zero()));
+
+            co_await resume_on_signal(wake->get(), timeout);
+
+            if (cancellation()) {
+                LOG_DEBUG("Upload cancelled with " << inFlight.size() << " request(s) in flight.");
+                throw hresult_canceled();   // cancelOnExit cancels them
+            }
+
+            for (auto it = inFlight.begin(); it != inFlight.end();)
+            {
+                AsyncStatus status = it->operation.Status();
+                if (status == AsyncStatus::Started) {
+                    ++it;
+                    continue;
+                }
+                if (status == AsyncStatus::Completed) {
+                    hstring url = it->operation.GetResults();
+                    RecordSuccess(it->host, Clock::now() - it->started);
+                    TraceAttemptStop(generation, *it, "won");
+                    if (it != inFlight.begin()) {
+                        LOG_INFO("Hedged upload to " << ws2s(HostName(it->host)) << " won.");
+                    }
+                    inFlight.erase(it);
+                    CancelAll(inFlight, generation, "cancelled");
+                    co_return url;
+                }
+
+                try {
+                    it->operation.GetResults();
+                }
+                catch (hresult_error const& ex) {
+                    lastError = HostName(it->host) + L": " + std::wstring(ex.message());
+                }
+                LOG_WARNING("Upload failed: " << ws2s(lastError));
+                RecordFailure(it->host);
+                TraceAttemptStop(generation, *it, "failed");
+                it = inFlight.erase(it);
+            }
+
+            Clock::time_point now = Clock::now();
+            if (now >= roundDeadline) {
+                for (auto const& attempt : inFlight) {
+                    RecordFailure(attempt.host);
+                }
+                CancelAll(inFlight, generation, "timed out");
+                lastError = L"timed out after " + std::to_wstring(ROUND_TIMEOUT.count()) + L" s";
+                break;
+            }
+            if (inFlight.empty()) {
+                // Fail over right away instead of waiting for a hedge deadline.
+                launchNext();
+            }
+            else if (canHedge && now >= hedgeAt) {
+                LOG_INFO("Upload to " << ws2s(HostName(inFlight.back().host)) << " is slower than usual; hedging to the next host.");
+                launchNext();
+            }
+        }
+    }
+
+    co_return hstring(L"Error: " + lastError);
+}
+
+std::vector<std::wstring> GetUploadHostUrls()
+{
+    std::lock_guard<std::mutex> lock(g_hostsLock);
+    std::vector<std::wstring> urls;
+    for (const HostState& state : HostsLocked()) {
+        if (const wchar_t* url = state.host->WarmUpUrl()) {
+            urls.push_back(url);
+        }
+    }
+    return urls;
+}
+
+std::vector<UploadHostStats> GetUploadHostStats()
+{
+    std::lock_guard<std::mutex> lock(g_hostsLock);
+    Clock::time_point now = Clock::now();
+
+    std::vector<UploadHostStats> stats;
+    for (const HostState& state : HostsLocked()) {
+        UploadHostStats entry;
+        entry.name = state.host->Name();
+        entry.successes = state.successes;
+        entry.failures = state.failures;
+        entry.p95Latency = P95Locked(state);
+        entry.circuitOpen = state.openUntil > now;
+        stats.push_back(std::move(entry));
+    }
+    return stats;
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Uploads a raw binary image buffer to the fastest healthy temporary file host.
+ *
+ * Hosts are tried in priority order (0x0.st, litterbox, curl.exe to 0x0.st). If the current host has not
+ * answered within its p95 latency, the request is hedged to the next host and the first success wins;
+ * the loser is cancelled. A host that keeps failing is skipped for a cooldown by a circuit breaker, and
+ * when every host fails the whole round is retried after a bounded, jittered exponential backoff.
+ * Cancelling the operation aborts every request in flight (terminating curl.exe if it is running)
+ * without waiting for them; they only hold the upload's own copy of binaryData.
+ * @param binaryData The raw image data. It is copied before the call returns, so the caller may reuse it right away.
+ * @param expires When the host should delete the file again. Callers keep this alongside the URL.
+ * @param generation Correlates the upload's trace events with the parse it belongs to; 0 if none.
+ * @return An awaitable operation that resolves to the public URL of the uploaded image, or an error string
+ *         starting with "Error:" or "Exception:".
+ */
+winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> UploadCoverArtAsync(winrt::array_view<uint8_t const> binaryData, std::chrono::system_clock::time_point expires, uint64_t generation = 0);
+
+/**
+ * @struct UploadHostStats
+ * @brief Health of one upload host, as tracked by the uploader.
+ */
+struct UploadHostStats {
+    std::wstring                name;
+    uint64_t                    successes = 0;
+    uint64_t                    failures = 0;
+    std::chrono::milliseconds   p95Latency{ 0 };   // Over recent successful uploads; 0 without samples
+    bool                        circuitOpen = false;
+};
+
+/**
+ * @brief Returns the URLs of the in-process upload hosts, for connection pre-warming.
+ */
+std::vector<std::wstring> GetUploadHostUrls();
+
+/**
+ * @brief Returns a snapshot of every host's health, in priority order.
+ */
+std::vector<UploadHostStats> GetUploadHostStats();
@@ -0,0 +1,126 @@
+﻿/**
+ * @file HttpSession.cpp
+ * @brief The one keep-alive Windows.Web.Http client shared by every network stage.
+ */
+
+#include "pch.h"
+#include "HttpSession.h"
+
+#include <chrono>
+#include <mutex>
+
+#include <winrt/Windows.System.Threading.h>
+#include <winrt/Windows.Web.Http.Headers.h>
+#include <winrt/Windows.Web.Http.Filters.h>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::System::Threading;
+using namespace Windows::Web::Http;
+using namespace Windows::Web::Http::Filters;
+
+namespace
+{
+    constexpr wchar_t USER_AGENT[] = L"tidal-rpc/0.2 (+https://github.com/Emiferpro/tidal-rpc)";
+
+    constexpr std::chrono::seconds KEEP_ALIVE_INTERVAL{ 30 }; // Well inside typical 60-75 s server idle timeouts
+
+    std::mutex g_httpClientLock;
+    HttpClient g_httpClient{ nullptr };
+
+    std::mutex                  g_warmUpLock;
+    std::vector<std::wstring>   g_warmUpUrls;
+    ThreadPoolTimer             g_keepAliveTimer{ nullptr };
+
+    /**
+     * @brief Sends a HEAD request so that the pool holds an open connection to the URL's host.
+     */
+    fire_and_forget PingAsync(std::wstring url)
+    {
+        try {
+            HttpRequestMessage request(HttpMethod::Head(), Uri(url));
+            HttpResponseMessage response = co_await GetSharedHttpClient().SendRequestAsync(request, HttpCompletionOption::ResponseHeadersRead);
+            response.Close();
+        }
+        catch (hresult_error const&) {
+            // A failed ping only means the first real request pays for the connection.
+        }
+    }
+}
+
+HttpClient GetSharedHttpClient()
+{
+    std::lock_guard<std::mutex> lock(g_httpClientLock);
+    if (!g_httpClient) {
+        HttpBaseProtocolFilter filter;
+        filter.AllowUI(false);
+        filter.CacheControl().ReadBehavior(HttpCacheReadBehavior::NoCache);
+        filter.CacheControl().WriteBehavior(HttpCacheWriteBehavior::NoCache);
+
+        g_httpClient = HttpClient(filter);
+        g_httpClient.DefaultRequestHeaders().UserAgent().TryParseAdd(USER_AGENT);
+    }
+    return g_httpClient;
+}
+
+void CloseSharedHttpClient()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_warmUpLock);
+        if (g_keepAliveTimer) {
+            g_keepAliveTimer.Cancel();
+            g_keepAliveTimer = nullptr;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_httpClientLock);
+    if (g_httpClient) {
+        g_httpClient.Close();
+        g_httpClient = nullptr;
+    }
+}
+
+void SetWarmUpUrls(std::vector<std::wstring> urls)
+{
+    std::lock_guard<std::mutex> lock(g_warmUpLock);
+    g_warmUpUrls = std::move(urls);
+}
+
+void WarmUpConnections()
+{
+    std::vector<std::wstring> urls;
+    {
+        std::lock_guard<std::mutex> lock(g_warmUpLock);
+        urls = g_warmUpUrls;
+    }
+    for (auto& url : urls) {
+        PingAsync(std::move(url));
+    }
+}
+
+void SetConnectionsActive(bool active)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_warmUpLock);
+        if (active) {
+            if (g_keepAliveTimer) {
+                return;
+            }
+            g_keepAliveTimer = ThreadPoolTimer::CreatePeriodicTimer([](auto&&) { WarmUpConnections(); }, KEEP_ALIVE_INTERVAL);
+        }
+        else if (g_keepAliveTimer) {
+            g_keepAliveTimer.Cancel();
+            g_keepAliveTimer = nullptr;
+        }
+    }
+
+    if (active) {
+        WarmUpConnections();
+    }
+    else {
+        // Not Close(): that would abort an upload that is still running. Dropping our reference lets
+        // the connections go once the last request holding the client has finished.
+        std::lock_guard<std::mutex> lock(g_httpClientLock);
+        g_httpClient = nullptr;
+    }
+}
@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <winrt/Windows.Web.Http.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Returns the session-wide HttpClient, creating it on first use.
+ *
+ * Every in-process request (uploads, cover lookups) goes through this client so that the base
+ * protocol filter's per-host connection pool keeps the TCP/TLS connections alive between tracks.
+ */
+winrt::Windows::Web::Http::HttpClient GetSharedHttpClient();
+
+/**
+ * @brief Closes the shared HTTP client and releases its pooled connections.
+ */
+void CloseSharedHttpClient();
+
+/**
+ * @brief Sets the URLs whose connections WarmUpConnections and the keep-alive timer keep open.
+ */
+void SetWarmUpUrls(std::vector<std::wstring> urls);
+
+/**
+ * @brief Resolves and connects to every warm-up URL in the background with a HEAD request.
+ *
+ * Moves DNS, TCP and TLS setup off the critical path of the first upload or lookup.
+ */
+void WarmUpConnections();
+
+/**
+ * @brief Keeps the pooled connections warm while playback is active, and lets them go when it is not.
+ *
+ * While active, a low-rate periodic HEAD request stops the hosts from closing idle connections.
+ * Deactivating stops the timer and drops the shared client, even if it was never activated (e.g. a
+ * client only created for a lookup); requests still in flight keep their own reference and finish
+ * normally, after which the connections are released, so idle cost is zero.
+ * @param active Whether TIDAL is currently playing.
+ */
+void SetConnectionsActive(bool active);
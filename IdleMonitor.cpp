@@ -0,0 +1,89 @@
+﻿/**
+ * @file IdleMonitor.cpp
+ * @brief Pause-timeout state machine for the app's idle mode, and the process efficiency mode.
+ */
+
+#include "pch.h"
+#include "IdleMonitor.h"
+#include "Log.h"
+#include "MainLoop.h"
+
+IdleMonitor::IdleMonitor(Callbacks callbacks)
+    : m_callbacks(std::move(callbacks))
+{
+}
+
+void IdleMonitor::SetTimeout(std::chrono::seconds timeout)
+{
+    m_timeout = timeout;
+}
+
+void IdleMonitor::Start()
+{
+    if (m_state == State::Playing) {
+        BeginPause();
+    }
+}
+
+void IdleMonitor::OnPlaybackChanged(bool playing)
+{
+    if (playing) {
+        State previous = m_state;
+        m_state = State::Playing;
+        if (previous == State::Idle) {
+            LOG_INFO("Playback resumed. Leaving idle mode.");
+            if (m_callbacks.leaveIdle) {
+                m_callbacks.leaveIdle();
+            }
+        }
+        return;
+    }
+
+    if (m_state == State::Playing) {
+        BeginPause();
+    }
+}
+
+void IdleMonitor::BeginPause()
+{
+    m_state = State::Paused;
+    uint64_t pause = ++m_pause;
+    if (m_timeout.count() == 0) {
+        return;
+    }
+
+    PostToMainLoopAt(std::chrono::steady_clock::now() + m_timeout, [this, pause] {
+        if (m_state != State::Paused || m_pause != pause) {
+            return; // Playback resumed in the meantime
+        }
+        m_state = State::Idle;
+        ++m_idleCount;
+        LOG_INFO("Nothing played for " << m_timeout.count() << " s. Entering idle mode.");
+        if (m_callbacks.enterIdle) {
+            m_callbacks.enterIdle();
+        }
+        });
+}
+
+void SetEfficiencyMode(bool enabled)
+{
+    // EcoQoS runs the threads on efficient cores at low clocks; ignoring timer resolution requests
+    // keeps the high-resolution callback timer from holding the system timer up while idle. Leaving
+    // clears both masks, which hands QoS back to the system rather than opting out of throttling.
+    PROCESS_POWER_THROTTLING_STATE throttling{};
+    throttling.Version = PROCESS_POWER_THROTTLING_CURRENT_VERSION;
+    throttling.ControlMask = enabled ? PROCESS_POWER_THROTTLING_EXECUTION_SPEED | PROCESS_POWER_THROTTLING_IGNORE_TIMER_RESOLUTION : 0;
+    throttling.StateMask = throttling.ControlMask;
+    BOOL applied = SetProcessInformation(GetCurrentProcess(), ProcessPowerThrottling, &throttling, sizeof(throttling));
+    if (!applied && enabled) {
+        // Windows 10 knows EcoQoS but not the timer resolution flag.
+        throttling.ControlMask = PROCESS_POWER_THROTTLING_EXECUTION_SPEED;
+        throttling.StateMask = throttling.ControlMask;
+        applied = SetProcessInformation(GetCurrentProcess(), ProcessPowerThrottling, &throttling, sizeof(throttling));
+    }
+    if (!applied) {
+        LOG_DEBUG("Power throttling is not available (error " << GetLastError() << ").");
+        return;
+    }
+    SetPriorityClass(GetCurrentProcess(), enabled ? IDLE_PRIORITY_CLASS : NORMAL_PRIORITY_CLASS);
+}
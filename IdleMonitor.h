@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+/**
+ * @class IdleMonitor
+ * @brief Decides when the app goes idle: playback has been paused or stopped for longer than a timeout.
+ *
+ * Playing -> Paused when playback stops, Paused -> Idle once the timeout passes without playback
+ * resuming, and straight back to Playing from either as soon as it does. Entering and leaving the
+ * idle state are reported through callbacks; what idling means is up to the owner.
+ *
+ * Main thread only. The timeout is a PostToMainLoopAt deadline, so a pause costs a single wakeup.
+ */
+class IdleMonitor {
+public:
+    /**
+     * @struct Callbacks
+     * @brief Called on the main thread on entering and leaving the idle state.
+     */
+    struct Callbacks {
+        std::function<void()>   enterIdle;
+        std::function<void()>   leaveIdle;
+    };
+
+    explicit IdleMonitor(Callbacks callbacks);
+
+    /**
+     * @brief Sets how long playback must stay stopped before going idle. 0 never goes idle.
+     *
+     * Takes effect with the next pause.
+     */
+    void SetTimeout(std::chrono::seconds timeout);
+
+    /**
+     * @brief Starts the countdown as if playback had just stopped; the first playing report cancels it.
+     *
+     * Call once at startup, so the app also goes idle if TIDAL is not running at all.
+     */
+    void Start();
+
+    /**
+     * @brief Reports the current playback state. Repeated reports of the same state are cheap.
+     * @param playing Whether the TIDAL session is playing; false for paused, stopped, or no session.
+     */
+    void OnPlaybackChanged(bool playing);
+
+    bool IsIdle() const { return m_state == State::Idle; }
+
+    /**
+     * @brief Number of times the idle state was entered.
+     */
+    uint64_t IdleCount() const { return m_idleCount; }
+
+private:
+    enum class State { Playing, Paused, Idle };
+
+    void BeginPause();
+
+    Callbacks               m_callbacks;
+    std::chrono::seconds    m_timeout{ 300 };
+    State                   m_state = State::Playing;
+    uint64_t                m_pause = 0;        // Bumped on every pause, so stale deadlines are ignored
+    uint64_t                m_idleCount = 0;
+};
+
+/**
+ * @brief Opts the process into or out of EcoQoS and low scheduling priority (Windows' "efficiency mode").
+ *
+ * Opting out restores the system-managed default the process starts with, not forced high QoS.
+ * Does nothing on Windows versions without power throttling.
+ */
+void SetEfficiencyMode(bool enabled);
@@ -0,0 +1,299 @@
+﻿/**
+ * @file Log.cpp
+ * @brief Leveled logger backed by a lock-free ring buffer and a low-priority drain thread.
+ *
+ * Producers (any thread) claim a slot with a single compare-and-swap and move their line into it;
+ * formatting, console output and file I/O all happen on the drain thread. The design is Dmitry
+ * Vyukov's bounded MPMC queue, used here with a single consumer: every slot carries a sequence
+ * number that tells producers and the consumer whose turn it is, so no lock is ever taken.
+ *
+ * The drain thread also keeps the last LOG_HISTORY_LINES formatted lines. A console attached
+ * later gets them written out first, so it starts with the same lines a console present from the
+ * start would show.
+ */
+
+#include "pch.h"
+#include "Log.h"
+
+#include <array>
+#include <cwctype>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<LogLevel> g_logLevel{ LogLevel::Info };
+
+namespace
+{
+    constexpr size_t   RING_CAPACITY = 1024;             // Must be a power of two
+    constexpr uint64_t MAX_LOG_FILE_BYTES = 1024 * 1024;
+    constexpr size_t   LOG_HISTORY_LINES = 1000;         // Backfilled into a console that is opened late
+
+    struct Slot {
+        std::atomic<size_t> sequence{ 0 };
+        LogLevel            level = LogLevel::Info;
+        FILETIME            time{};
+        std::string         message;
+    };
+
+    std::array<Slot, RING_CAPACITY> g_ring;
+    std::atomic<size_t>             g_enqueuePos{ 0 };
+    size_t                          g_dequeuePos = 0;      // Drain thread only
+    std::atomic<uint64_t>           g_dropped{ 0 };
+
+    HANDLE                          g_wakeEvent = nullptr;
+    std::atomic<bool>               g_wakePending{ false };
+    std::atomic<bool>               g_stopping{ false };
+    std::thread                     g_drainThread;
+
+    std::wstring                    g_logFilePath;
+
+    std::mutex                      g_consoleLock;         // Held while the drain thread writes to stdout
+    bool                            g_toConsole = true;
+    bool                            g_backfillConsole = false;
+
+    std::vector<std::string>        g_history;             // Drain thread only; a ring once full
+    size_t                          g_historyNext = 0;
+
+    struct RingInit {
+        RingInit()
+        {
+            for (size_t i = 0; i < RING_CAPACITY; ++i) {
+                g_ring[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+    } g_ringInit;
+
+    /**
+     * @brief Pops the next line. Drain thread only.
+     */
+    bool TryDequeue(LogLevel& level, FILETIME& time, std::string& message)
+    {
+        Slot& slot = g_ring[g_dequeuePos & (RING_CAPACITY - 1)];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != g_dequeuePos + 1) {
+            return false;
+        }
+        level = slot.level;
+        time = slot.time;
+        message = std::move(slot.message);
+        slot.message = std::string();
+        slot.sequence.store(g_dequeuePos + RING_CAPACITY, std::memory_order_release);
+        ++g_dequeuePos;
+        return true;
+    }
+
+    std::string FormatLine(LogLevel level, FILETIME time, const std::string& message)
+    {
+        FILETIME localTime{};
+        SYSTEMTIME st{};
+        FileTimeToLocalFileTime(&time, &localTime);
+        FileTimeToSystemTime(&localTime, &st);
+
+        char prefix[48];
+        snprintf(prefix, sizeof(prefix), "%02u:%02u:%02u.%03u [%s] ",
+            st.wHour, st.wMinute, st.wSecond, st.wMilliseconds, LogLevelName(level));
+        return prefix + message;
+    }
+
+    /**
+     * @brief Moves the log file to "<path>.1" once it is too large, replacing the previous backup.
+     */
+    void RotateIfNeeded(std::ofstream& file)
+    {
+        if (!file.is_open() || static_cast<uint64_t>(file.tellp()) < MAX_LOG_FILE_BYTES) {
+            return;
+        }
+        file.close();
+        MoveFileExW(g_logFilePath.c_str(), (g_logFilePath + L".1").c_str(), MOVEFILE_REPLACE_EXISTING);
+        file.open(g_logFilePath, std::ios::app | std::ios::binary);
+    }
+
+    /**
+     * @brief Remembers a formatted line for a console that is opened later. Drain thread only.
+     */
+    void AddToHistory(std::string line)
+    {
+        if (g_history.size() < LOG_HISTORY_LINES) {
+            g_history.push_back(std::move(line));
+            return;
+        }
+        g_history[g_historyNext] = std::move(line);
+        g_historyNext = (g_historyNext + 1) % LOG_HISTORY_LINES;
+    }
+
+    /**
+     * @brief Writes the history, oldest line first, to a console that was just attached. Caller holds g_consoleLock.
+     */
+    void WriteHistoryToConsole()
+    {
+        for (size_t i = 0; i < g_history.size(); ++i) {
+            std::cout << g_history[(g_historyNext + i) % g_history.size()] << '\n';
+        }
+    }
+
+    void DrainLoop()
+    {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+        std::ofstream file;
+        if (!g_logFilePath.empty()) {
+            file.open(g_logFilePath, std::ios::app | std::ios::binary);
+        }
+
+        LogLevel level;
+        FILETIME time;
+        std::string message;
+        for (;;) {
+            WaitForSingleObject(g_wakeEvent, INFINITE);
+            // Clear before draining: a producer that finds the flag clear after this point wakes us again.
+            g_wakePending.store(false);
+
+            bool wrote = false;
+            {
+                std::lock_guard<std::mutex> consoleLock(g_consoleLock);
+                if (g_backfillConsole) {
+                    g_backfillConsole = false;
+                    WriteHistoryToConsole();
+                    std::cout.flush();
+                }
+                while (TryDequeue(level, time, message)) {
+                    std::string line = FormatLine(level, time, message);
+                    if (g_toConsole) {
+                        std::cout << line << '\n';
+                    }
+                    if (file.is_open()) {
+                        file << line << "\r\n";
+                    }
+                    AddToHistory(std::move(line));
+                    wrote = true;
+                }
+                // One flush per batch instead of one per line.
+                if (wrote && g_toConsole) {
+                    std::cout.flush();
+                }
+            }
+            if (wrote) {
+                if (file.is_open()) {
+                    file.flush();
+                    RotateIfNeeded(file);
+                }
+            }
+
+            if (g_stopping.load()) {
+                return;
+            }
+        }
+    }
+}
+
+const char* LogLevelName(LogLevel level)
+{
+    switch (level) {
+    case LogLevel::Debug:   return "DEBUG";
+    case LogLevel::Info:    return "INFO";
+    case LogLevel::Warning: return "WARN";
+    case LogLevel::Error:   return "ERROR";
+    default:                return "OFF";
+    }
+}
+
+LogLevel ParseLogLevel(const std::wstring& name, LogLevel fallback)
+{
+    std::wstring lower;
+    for (wchar_t ch : name) {
+        lower.push_back(static_cast<wchar_t>(std::towlower(ch)));
+    }
+    if (lower == L"debug")   return LogLevel::Debug;
+    if (lower == L"info")    return LogLevel::Info;
+    if (lower == L"warning" || lower == L"warn") return LogLevel::Warning;
+    if (lower == L"error")   return LogLevel::Error;
+    if (lower == L"off")     return LogLevel::Off;
+    return fallback;
+}
+
+void LogWrite(LogLevel level, std::string message)
+{
+    size_t position = g_enqueuePos.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    for (;;) {
+        slot = &g_ring[position & (RING_CAPACITY - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (g_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            // Full: the drain thread is behind. Never stall the caller for a log line.
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else {
+            position = g_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    GetSystemTimePreciseAsFileTime(&slot->time);
+    slot->message = std::move(message);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    // Only the first line of a batch pays for the wakeup.
+    if (g_wakeEvent && !g_wakePending.exchange(true)) {
+        SetEvent(g_wakeEvent);
+    }
+}
+
+void StartLogger(std::wstring logFilePath, bool toConsole)
+{
+    g_logFilePath = std::move(logFilePath);
+    {
+        std::lock_guard<std::mutex> lock(g_consoleLock);
+        g_toConsole = toConsole;
+    }
+    g_wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    g_drainThread = std::thread(DrainLoop);
+
+    // Lines logged before the thread existed are already in the ring; flush them out.
+    g_wakePending.store(true);
+    SetEvent(g_wakeEvent);
+}
+
+void StopLogger()
+{
+    if (!g_drainThread.joinable()) {
+        return;
+    }
+    g_stopping.store(true);
+    SetEvent(g_wakeEvent);
+    g_drainThread.join();
+    CloseHandle(g_wakeEvent);
+    g_wakeEvent = nullptr;
+}
+
+void SetLogConsole(bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_consoleLock);
+        if (enabled && !g_toConsole) {
+            g_backfillConsole = true;
+        }
+        g_toConsole = enabled;
+        if (!enabled) {
+            g_backfillConsole = false;
+        }
+    }
+    // Backfill right away rather than with the next line.
+    if (enabled && g_wakeEvent && !g_wakePending.exchange(true)) {
+        SetEvent(g_wakeEvent);
+    }
+}
+
+uint64_t LogDroppedCount()
+{
+    return g_dropped.load();
+}
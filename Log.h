@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Severity of a log line. Lines below the active level are discarded before they are formatted.
+ */
+enum class LogLevel : uint8_t {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off,
+};
+
+extern std::atomic<LogLevel> g_logLevel;
+
+/**
+ * @brief Returns whether a line at the given level would be kept. A single relaxed load.
+ */
+inline bool LogEnabled(LogLevel level)
+{
+    return level >= g_logLevel.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the upper-case name of a level, e.g. "INFO".
+ */
+const char* LogLevelName(LogLevel level);
+
+/**
+ * @brief Parses a level name (case-insensitive: debug, info, warning, error, off).
+ * @return The level, or fallback if the name is not recognized.
+ */
+LogLevel ParseLogLevel(const std::wstring& name, LogLevel fallback);
+
+/**
+ * @brief Queues a formatted line for the drain thread. Never blocks; drops the line if the ring is full.
+ *
+ * Prefer the LOG_* macros, which skip formatting entirely when the level is disabled.
+ */
+void LogWrite(LogLevel level, std::string message);
+
+/**
+ * @brief Starts the low-priority drain thread.
+ * @param logFilePath File that lines are appended to, or empty for console only. The file is rotated
+ *                    to "<path>.1" once it grows past 1 MB.
+ * @param toConsole Whether lines are also written to stdout (the debug console) from the start.
+ */
+void StartLogger(std::wstring logFilePath, bool toConsole);
+
+/**
+ * @brief Starts or stops writing lines to stdout, e.g. when a debug console is attached or freed.
+ *
+ * Starting writes the most recent lines first, so a console opened late shows what led up to it.
+ * Stopping returns once the drain thread no longer writes to stdout, so the console can be freed
+ * right after. Any thread.
+ */
+void SetLogConsole(bool enabled);
+
+/**
+ * @brief Writes out everything still queued and stops the drain thread.
+ */
+void StopLogger();
+
+/**
+ * @brief Number of lines dropped because the ring was full.
+ */
+uint64_t LogDroppedCount();
+
+#define LOG_AT(level, expr)                                              \
+    do {                                                                 \
+        if (LogEnabled(level)) {                                         \
+            std::ostringstream logStream_;                               \
+            logStream_ << expr;                                          \
+            LogWrite(level, logStream_.str());                           \
+        }                                                                \
+    } while (0)
+
+#define LOG_DEBUG(expr)   LOG_AT(LogLevel::Debug, expr)
+#define LOG_INFO(expr)    LOG_AT(LogLevel::Info, expr)
+#define LOG_WARNING(expr) LOG_AT(LogLevel::Warning, expr)
+#define LOG_ERROR(expr)   LOG_AT(LogLevel::Error, expr)
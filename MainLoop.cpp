@@ -0,0 +1,242 @@
+﻿/**
+ * @file MainLoop.cpp
+ * @brief Event-driven main loop that pumps window messages, posted work and Discord SDK callbacks.
+ *
+ * Instead of polling every 16 ms, the loop blocks until something actually needs the main thread.
+ * While Discord requests are outstanding the SDK callbacks are serviced at a frame-like cadence so
+ * results arrive promptly; when nothing is in flight the loop wakes only for a slow heartbeat that
+ * the OS is allowed to coalesce with other timers. In idle mode even the heartbeat stops and the
+ * loop only wakes for messages, posted work and Discord requests.
+ */
+
+#include "pch.h"
+#include "MainLoop.h"
+#include "Tracing.h"
+#include "discordpp.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    constexpr std::chrono::milliseconds FAST_CALLBACK_INTERVAL{ 16 };    // While Discord requests are in flight
+    constexpr std::chrono::milliseconds SLOW_CALLBACK_INTERVAL{ 1000 };  // Idle heartbeat
+    constexpr std::chrono::milliseconds FAST_CADENCE_GRACE{ 500 };       // Keep the fast cadence briefly after the last reply
+    constexpr ULONG                     SLOW_TIMER_TOLERANCE_MS = 250;   // Lets the OS coalesce the idle heartbeat
+    constexpr std::chrono::milliseconds TIMER_SLACK{ 2 };                // Treat deadlines this close as already due
+    constexpr std::chrono::milliseconds NO_CALLBACKS = std::chrono::milliseconds::max(); // Idle mode: no heartbeat at all
+
+    using Clock = std::chrono::steady_clock;
+
+    HANDLE g_wakeEvent = nullptr;
+    HANDLE g_callbackTimer = nullptr;
+
+    std::mutex                                               g_postedWorkLock;
+    std::deque<std::function<void()>>                        g_postedWork;
+    std::multimap<Clock::time_point, std::function<void()>>  g_delayedWork;
+    std::vector<std::function<void()>>                       g_drains;   // Main thread only
+
+    std::atomic<int>                  g_discordRequestsInFlight{ 0 };
+    std::atomic<Clock::rep>           g_lastDiscordActivity{ 0 };
+    bool                              g_idle = false;   // Main thread only
+
+    Clock::time_point                 g_nextCallbackTick = Clock::time_point::max();
+
+    /**
+     * @brief Returns the interval until the next RunCallbacks call, based on outstanding Discord work.
+     */
+    std::chrono::milliseconds CurrentCallbackInterval()
+    {
+        if (g_discordRequestsInFlight.load() > 0) {
+            return FAST_CALLBACK_INTERVAL;
+        }
+        Clock::time_point lastActivity{ Clock::duration(g_lastDiscordActivity.load()) };
+        if (Clock::now() - lastActivity < FAST_CADENCE_GRACE) {
+            return FAST_CALLBACK_INTERVAL;
+        }
+        return g_idle ? NO_CALLBACKS : SLOW_CALLBACK_INTERVAL;
+    }
+
+    /**
+     * @brief Returns when RunCallbacks is next due for the given interval; never for NO_CALLBACKS.
+     */
+    Clock::time_point NextCallbackTick(Clock::time_point now, std::chrono::milliseconds interval)
+    {
+        return interval == NO_CALLBACKS ? Clock::time_point::max() : now + interval;
+    }
+
+    /**
+     * @brief Arms the timer for the earlier of the next callback tick and the next delayed work item.
+     * @param callbackInterval The interval that produced g_nextCallbackTick, used to pick a tolerance.
+     */
+    void ArmTimer(std::chrono::milliseconds callbackInterval)
+    {
+        Clock::time_point due = g_nextCallbackTick;
+        bool dueToDelayedWork = false;
+        {
+            std::lock_guard<std::mutex> lock(g_postedWorkLock);
+            if (!g_delayedWork.empty() && g_delayedWork.begin()->first < due) {
+                due = g_delayedWork.begin()->first;
+                dueToDelayedWork = true;
+            }
+        }
+        if (due == Clock::time_point::max()) {
+            // Idle with nothing scheduled: only the wake event and window messages end the wait.
+            CancelWaitableTimer(g_callbackTimer);
+            return;
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now());
+        if (remaining.count() < 0) {
+            remaining = std::chrono::milliseconds(0);
+        }
+
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -static_cast<LONGLONG>(remaining.count()) * 10000; // Relative, in 100 ns units
+        ULONG tolerance = (!dueToDelayedWork && callbackInterval >= SLOW_CALLBACK_INTERVAL) ? SLOW_TIMER_TOLERANCE_MS : 0;
+        SetWaitableTimerEx(g_callbackTimer, &dueTime, 0, nullptr, nullptr, nullptr, tolerance);
+    }
+
+    /**
+     * @brief Runs every piece of work posted since the last wakeup, plus delayed work that is due.
+     */
+    void RunPostedWork()
+    {
+        std::deque<std::function<void()>> work;
+        {
+            std::lock_guard<std::mutex> lock(g_postedWorkLock);
+            work.swap(g_postedWork);
+
+            Clock::time_point cutoff = Clock::now() + TIMER_SLACK;
+            while (!g_delayedWork.empty() && g_delayedWork.begin()->first <= cutoff) {
+                work.push_back(std::move(g_delayedWork.begin()->second));
+                g_delayedWork.erase(g_delayedWork.begin());
+            }
+        }
+        for (auto& item : work) {
+            item();
+        }
+
+        // After posted work, so a handoff queued behind a posted item on the same wakeup sees its effects.
+        for (auto& drain : g_drains) {
+            drain();
+        }
+    }
+}
+
+void InitMainLoop()
+{
+    g_wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    // A high-resolution timer gives accurate 16 ms ticks without raising the global timer resolution.
+    g_callbackTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!g_callbackTimer) {
+        g_callbackTimer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    }
+}
+
+void PostToMainLoop(std::function<void()> work)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_postedWorkLock);
+        g_postedWork.push_back(std::move(work));
+    }
+    SetEvent(g_wakeEvent);
+}
+
+void PostToMainLoopAt(Clock::time_point when, std::function<void()> work)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_postedWorkLock);
+        g_delayedWork.emplace(when, std::move(work));
+    }
+    // Wake the loop so it can pull the timer forward if this deadline is the earliest one.
+    SetEvent(g_wakeEvent);
+}
+
+void AddMainLoopDrain(std::function<void()> drain)
+{
+    g_drains.push_back(std::move(drain));
+}
+
+void WakeMainLoop()
+{
+    SetEvent(g_wakeEvent);
+}
+
+void SetMainLoopIdle(bool idle)
+{
+    if (g_idle == idle) {
+        return;
+    }
+    g_idle = idle;
+    if (!idle) {
+        // Deliver whatever the SDK queued while idle on the next pass instead of a heartbeat later.
+        g_nextCallbackTick = Clock::now();
+    }
+}
+
+void BeginDiscordRequest()
+{
+    g_discordRequestsInFlight.fetch_add(1);
+    g_lastDiscordActivity.store(Clock::now().time_since_epoch().count());
+    SetEvent(g_wakeEvent);
+}
+
+void EndDiscordRequest()
+{
+    g_discordRequestsInFlight.fetch_sub(1);
+    g_lastDiscordActivity.store(Clock::now().time_since_epoch().count());
+}
+
+int RunMainLoop()
+{
+    HANDLE handles[] = { g_wakeEvent, g_callbackTimer };
+    constexpr DWORD handleCount = ARRAYSIZE(handles);
+
+    std::chrono::milliseconds interval = CurrentCallbackInterval();
+    g_nextCallbackTick = NextCallbackTick(Clock::now(), interval);
+    ArmTimer(interval);
+
+    MSG msg{};
+    for (;;)
+    {
+        DWORD waitResult = MsgWaitForMultipleObjectsEx(handleCount, handles, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        TraceMainLoopWake(waitResult == WAIT_OBJECT_0 ? "posted work" : waitResult == WAIT_OBJECT_0 + 1 ? "callback timer" : "messages");
+
+        if (waitResult == WAIT_OBJECT_0 + handleCount)
+        {
+            while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+            {
+                if (msg.message == WM_QUIT)
+                {
+                    return (int)msg.wParam;
+                }
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+        }
+
+        RunPostedWork();
+
+        // CRITICAL: Discord SDK callbacks only run from here, so keep servicing them on schedule.
+        interval = CurrentCallbackInterval();
+        Clock::time_point now = Clock::now();
+        if (now + TIMER_SLACK >= g_nextCallbackTick)
+        {
+            discordpp::RunCallbacks();
+            interval = CurrentCallbackInterval();
+            g_nextCallbackTick = NextCallbackTick(Clock::now(), interval);
+        }
+        else if (NextCallbackTick(now, interval) < g_nextCallbackTick)
+        {
+            // New work switched us to the fast cadence; don't wait out the idle heartbeat.
+            g_nextCallbackTick = NextCallbackTick(now, interval);
+        }
+        ArmTimer(interval);
+    }
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <chrono>
+#include <functional>
+
+/**
+ * @brief Creates the wake event and waitable timer used by RunMainLoop. Call once on the main thread.
+ */
+void InitMainLoop();
+
+/**
+ * @brief Queues work to run on the main thread and wakes the main loop immediately.
+ *
+ * Safe to call from any thread. Used for work that can come from several threads, such as SMTC
+ * timeline events; the pipeline's presence updates take the lock-free PresenceHandoff instead.
+ * @param work The function to run on the main thread.
+ */
+void PostToMainLoop(std::function<void()> work);
+
+/**
+ * @brief Queues work to run on the main thread no earlier than the given time.
+ *
+ * Safe to call from any thread. The main loop folds the deadline into its waitable timer, so
+ * delayed work costs no extra wakeups beyond the one at the deadline.
+ * @param when The earliest time the work may run.
+ * @param work The function to run on the main thread.
+ */
+void PostToMainLoopAt(std::chrono::steady_clock::time_point when, std::function<void()> work);
+
+/**
+ * @brief Adds a function that the main loop calls on the main thread after every wakeup.
+ *
+ * For lock-free handoffs (see PresenceHandoff): the producer fills its own queue and calls
+ * WakeMainLoop, and the drain empties it. Main thread only, before or between RunMainLoop calls.
+ * @param drain The function to call; it should return quickly when there is nothing to do.
+ */
+void AddMainLoopDrain(std::function<void()> drain);
+
+/**
+ * @brief Wakes the main loop so it runs its drains. Safe to call from any thread.
+ */
+void WakeMainLoop();
+
+/**
+ * @brief Switches idle mode on or off. Main thread only.
+ *
+ * While idle, RunCallbacks is no longer polled at all; it only runs while a Discord request is in
+ * flight. Leaving idle mode runs it on the next pass to deliver anything the SDK queued meanwhile.
+ */
+void SetMainLoopIdle(bool idle);
+
+/**
+ * @brief Marks a Discord request as in flight, switching RunCallbacks to the fast cadence.
+ */
+void BeginDiscordRequest();
+
+/**
+ * @brief Marks a Discord request as completed. Call from the request's callback.
+ */
+void EndDiscordRequest();
+
+/**
+ * @brief Runs the main message loop until WM_QUIT is received.
+ *
+ * The loop sleeps in MsgWaitForMultipleObjectsEx until a window message arrives, work is posted,
+ * or the callback timer fires. discordpp::RunCallbacks() runs at a high cadence only while Discord
+ * requests are in flight and drops to a slow, coalescable heartbeat otherwise, or to none in idle mode.
+ * @return The exit code carried by WM_QUIT.
+ */
+int RunMainLoop();
@@ -0,0 +1,181 @@
+﻿/**
+ * @file PerceptualHash.cpp
+ * @brief dHash of a grayscale grid with scalar, SSE2 and AVX2 kernels.
+ *
+ * Almost all of the work is summing the 8 x 8 pixel cells, which is exactly what PSADBW does: a
+ * sum of absolute differences against zero adds up eight bytes into one 64-bit lane. SSE2 sums two
+ * cells per instruction and AVX2 four. The comparisons that turn the sums into bits are the same
+ * scalar code for every kernel, so all of them agree bit for bit.
+ */
+
+#include "pch.h"
+#include "PerceptualHash.h"
+
+#include <immintrin.h>
+#include <intrin.h>
+
+namespace
+{
+    constexpr uint32_t CELLS_X = DHASH_GRID_WIDTH / DHASH_CELL_SIZE;
+    constexpr uint32_t CELLS_Y = DHASH_GRID_HEIGHT / DHASH_CELL_SIZE;
+    constexpr uint32_t PADDED_CELLS_X = DHASH_GRID_STRIDE / DHASH_CELL_SIZE;   // Including the cells in the padding
+
+    static_assert(DHASH_GRID_STRIDE % 32 == 0 && PADDED_CELLS_X >= CELLS_X, "Each row must load as whole 32-byte vectors");
+    static_assert((CELLS_X - 1) * CELLS_Y == 64, "The hash has one bit per horizontal cell pair");
+
+    using CellSums = uint32_t[CELLS_Y][PADDED_CELLS_X];
+
+    uint64_t HashFromSums(const CellSums& sums)
+    {
+        uint64_t hash = 0;
+        for (uint32_t y = 0; y < CELLS_Y; ++y) {
+            for (uint32_t x = 0; x + 1 < CELLS_X; ++x) {
+                if (sums[y][x] > sums[y][x + 1]) {
+                    hash |= 1ull << (y * (CELLS_X - 1) + x);
+                }
+            }
+        }
+        return hash;
+    }
+
+    uint64_t DHashScalar(const uint8_t* grid)
+    {
+        CellSums sums{};
+        for (uint32_t row = 0; row < DHASH_GRID_HEIGHT; ++row) {
+            const uint8_t* pixels = grid + row * DHASH_GRID_STRIDE;
+            uint32_t* cells = sums[row / DHASH_CELL_SIZE];
+            for (uint32_t x = 0; x < DHASH_GRID_WIDTH; ++x) {
+                cells[x / DHASH_CELL_SIZE] += pixels[x];
+            }
+        }
+        return HashFromSums(sums);
+    }
+
+    uint64_t DHashSse2(const uint8_t* grid)
+    {
+        constexpr uint32_t VECTORS = DHASH_GRID_STRIDE / 16;
+        const __m128i zero = _mm_setzero_si128();
+
+        CellSums sums{};
+        for (uint32_t y = 0; y < CELLS_Y; ++y) {
+            __m128i acc[VECTORS];
+            for (auto& lane : acc) {
+                lane = zero;
+            }
+            for (uint32_t row = 0; row < DHASH_CELL_SIZE; ++row) {
+                const uint8_t* pixels = grid + (y * DHASH_CELL_SIZE + row) * DHASH_GRID_STRIDE;
+                for (uint32_t v = 0; v < VECTORS; ++v) {
+                    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + v * 16));
+                    acc[v] = _mm_add_epi64(acc[v], _mm_sad_epu8(bytes, zero));
+                }
+            }
+            for (uint32_t v = 0; v < VECTORS; ++v) {
+                alignas(16) uint64_t lanes[2];
+                _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc[v]);
+                sums[y][v * 2] = static_cast<uint32_t>(lanes[0]);
+                sums[y][v * 2 + 1] = static_cast<uint32_t>(lanes[1]);
+            }
+        }
+        return HashFromSums(sums);
+    }
+
+    uint64_t DHashAvx2(const uint8_t* grid)
+    {
+        constexpr uint32_t VECTORS = DHASH_GRID_STRIDE / 32;
+        const __m256i zero = _mm256_setzero_si256();
+
+        CellSums sums{};
+        for (uint32_t y = 0; y < CELLS_Y; ++y) {
+            __m256i acc[VECTORS];
+            for (auto& lane : acc) {
+                lane = zero;
+            }
+            for (uint32_t row = 0; row < DHASH_CELL_SIZE; ++row) {
+                const uint8_t* pixels = grid + (y * DHASH_CELL_SIZE + row) * DHASH_GRID_STRIDE;
+                for (uint32_t v = 0; v < VECTORS; ++v) {
+                    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + v * 32));
+                    acc[v] = _mm256_add_epi64(acc[v], _mm256_sad_epu8(bytes, zero));
+                }
+            }
+            for (uint32_t v = 0; v < VECTORS; ++v) {
+                alignas(32) uint64_t lanes[4];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc[v]);
+                for (uint32_t lane = 0; lane < 4; ++lane) {
+                    sums[y][v * 4 + lane] = static_cast<uint32_t>(lanes[lane]);
+                }
+            }
+        }
+        // Leave the AVX state clean for whatever SSE code the caller runs next.
+        _mm256_zeroupper();
+        return HashFromSums(sums);
+    }
+
+    bool CpuHasAvx2()
+    {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        if (!osSavesYmm) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+}
+
+bool IsDHashKernelSupported(DHashKernel kernel)
+{
+    static const bool avx2 = CpuHasAvx2();
+    switch (kernel) {
+    case DHashKernel::Scalar:
+    case DHashKernel::Sse2:
+        return true; // Part of the x86 baseline both platforms build for
+    case DHashKernel::Avx2:
+        return avx2;
+    }
+    return false;
+}
+
+DHashKernel BestDHashKernel()
+{
+    static const DHashKernel best = IsDHashKernelSupported(DHashKernel::Avx2) ? DHashKernel::Avx2 : DHashKernel::Sse2;
+    return best;
+}
+
+const char* DHashKernelName(DHashKernel kernel)
+{
+    switch (kernel) {
+    case DHashKernel::Scalar:   return "scalar";
+    case DHashKernel::Sse2:     return "sse2";
+    case DHashKernel::Avx2:     return "avx2";
+    }
+    return "unknown";
+}
+
+uint64_t ComputeDHash(const uint8_t* grid, DHashKernel kernel)
+{
+    switch (kernel) {
+    case DHashKernel::Avx2:     return DHashAvx2(grid);
+    case DHashKernel::Sse2:     return DHashSse2(grid);
+    default:                    return DHashScalar(grid);
+    }
+}
+
+uint64_t ComputeDHash(const uint8_t* grid)
+{
+    return ComputeDHash(grid, BestDHashKernel());
+}
+
+uint32_t HammingDistance(uint64_t a, uint64_t b)
+{
+    // Plain SWAR popcount: POPCNT isn't guaranteed on the CPUs the x86 build supports.
+    uint64_t bits = a ^ b;
+    bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+    bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<uint32_t>((bits * 0x0101010101010101ull) >> 56);
+}
@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Geometry of the grayscale grid a dHash is computed from (see ComputeDHash).
+ *
+ * The grid is 9 x 8 cells of 8 x 8 pixels. Rows are padded to a stride both SIMD kernels can load
+ * without bounds checks; the padding bytes are ignored.
+ */
+constexpr uint32_t DHASH_CELL_SIZE = 8;
+constexpr uint32_t DHASH_GRID_WIDTH = 9 * DHASH_CELL_SIZE;
+constexpr uint32_t DHASH_GRID_HEIGHT = 8 * DHASH_CELL_SIZE;
+constexpr uint32_t DHASH_GRID_STRIDE = 96;
+constexpr uint32_t DHASH_GRID_BYTES = DHASH_GRID_STRIDE * DHASH_GRID_HEIGHT;
+
+/**
+ * @brief The implementations of ComputeDHash. All of them return bit-identical hashes.
+ */
+enum class DHashKernel {
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+/**
+ * @brief Returns whether the CPU and OS can run the given kernel.
+ */
+bool IsDHashKernelSupported(DHashKernel kernel);
+
+/**
+ * @brief Returns the fastest kernel this machine supports. Detected once.
+ */
+DHashKernel BestDHashKernel();
+
+const char* DHashKernelName(DHashKernel kernel);
+
+/**
+ * @brief Computes a 64-bit difference hash of a grayscale grid.
+ *
+ * Every cell is reduced to the sum of its pixels, and bit y*8+x is set if cell (x, y) is brighter
+ * than its right neighbour. Re-encoding or rescaling an image barely moves the cell sums, so the
+ * same cover in a different size or format lands within a few bits of the original.
+ * @param grid DHASH_GRID_BYTES bytes: DHASH_GRID_HEIGHT rows of DHASH_GRID_WIDTH pixels at DHASH_GRID_STRIDE.
+ * @param kernel The implementation to use; it must be supported.
+ */
+uint64_t ComputeDHash(const uint8_t* grid, DHashKernel kernel);
+
+/**
+ * @brief ComputeDHash with BestDHashKernel().
+ */
+uint64_t ComputeDHash(const uint8_t* grid);
+
+/**
+ * @brief Number of bits in which two hashes differ.
+ */
+uint32_t HammingDistance(uint64_t a, uint64_t b);
@@ -0,0 +1,91 @@
+﻿/**
+ * @file PlaybackTimeline.cpp
+ * @brief Converts SMTC timeline properties into Discord activity timestamps.
+ */
+
+#include "pch.h"
+#include "PlaybackTimeline.h"
+
+#include <cstdlib>
+
+using namespace winrt;
+using namespace Windows::Media::Control;
+
+namespace
+{
+    int64_t ToMilliseconds(Windows::Foundation::TimeSpan span)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(span).count();
+    }
+}
+
+PlaybackTimeline ReadPlaybackTimeline(const GlobalSystemMediaTransportControlsSession& session)
+{
+    PlaybackTimeline timeline;
+    if (!session) {
+        return timeline;
+    }
+
+    auto properties = session.GetTimelineProperties();
+    auto playbackInfo = session.GetPlaybackInfo();
+    if (!properties || !playbackInfo) {
+        return timeline;
+    }
+
+    int64_t durationMs = ToMilliseconds(properties.EndTime() - properties.StartTime());
+    int64_t positionMs = ToMilliseconds(properties.Position() - properties.StartTime());
+    if (durationMs <= 0 && positionMs <= 0) {
+        return timeline;
+    }
+
+    timeline.known = true;
+    timeline.playing = playbackInfo.PlaybackStatus() == GlobalSystemMediaTransportControlsSessionPlaybackStatus::Playing;
+
+    // The position is a snapshot taken at LastUpdatedTime; carry it forward to now while playing.
+    auto now = clock::now();
+    auto lastUpdated = properties.LastUpdatedTime();
+    if (timeline.playing && lastUpdated.time_since_epoch().count() != 0 && lastUpdated <= now) {
+        positionMs += ToMilliseconds(now - lastUpdated);
+    }
+    if (durationMs > 0 && positionMs > durationMs) {
+        positionMs = durationMs;
+    }
+
+    int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        clock::to_sys(now).time_since_epoch()).count();
+    timeline.startMs = nowMs - positionMs;
+    timeline.endMs = durationMs > 0 ? timeline.startMs + durationMs : 0;
+    return timeline;
+}
+
+bool IsSameTimeline(const PlaybackTimeline& a, const PlaybackTimeline& b, std::chrono::milliseconds tolerance)
+{
+    if (a.known != b.known || a.playing != b.playing) {
+        return false;
+    }
+    if (!a.known || !a.playing) {
+        // Nothing is displayed for a paused track, so where it paused doesn't matter.
+        return true;
+    }
+    if ((a.endMs == 0) != (b.endMs == 0)) {
+        return false;
+    }
+    int64_t durationA = a.endMs - a.startMs;
+    int64_t durationB = b.endMs - b.startMs;
+    return std::llabs(a.startMs - b.startMs) <= tolerance.count()
+        && std::llabs(durationA - durationB) <= tolerance.count();
+}
+
+void ApplyTimeline(discordpp::Activity& activity, const PlaybackTimeline& timeline)
+{
+    if (!timeline.known || !timeline.playing) {
+        return;
+    }
+
+    discordpp::ActivityTimestamps timestamps;
+    timestamps.SetStart(static_cast<uint64_t>(timeline.startMs));
+    if (timeline.endMs > 0) {
+        timestamps.SetEnd(static_cast<uint64_t>(timeline.endMs));
+    }
+    activity.SetTimestamps(timestamps);
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include "discordpp.h"
+
+#include <winrt/Windows.Media.Control.h>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * @struct PlaybackTimeline
+ * @brief Where the current track is, expressed as the wall-clock times Discord wants.
+ *
+ * Storing start/end instead of a position means the snapshot never goes stale while the track
+ * plays normally: Discord extrapolates the progress bar itself, so nothing has to poll the position.
+ */
+struct PlaybackTimeline {
+    bool    known = false;   // Whether the session reported a usable timeline at all
+    bool    playing = false; // Paused or stopped tracks get no timestamps
+    int64_t startMs = 0;     // Unix time (ms) at which the track would have started at normal speed
+    int64_t endMs = 0;       // Unix time (ms) at which it will end, or 0 if the duration is unknown
+};
+
+/**
+ * @brief Reads the session's timeline and playback status, extrapolating the reported position to now.
+ * @param session The SMTC session to read.
+ * @return The timeline, with known == false if the session has none.
+ */
+PlaybackTimeline ReadPlaybackTimeline(const winrt::Windows::Media::Control::GlobalSystemMediaTransportControlsSession& session);
+
+/**
+ * @brief Returns whether two timelines would show the same progress bar.
+ *
+ * Positions reported a second apart drift by a few hundred milliseconds through rounding and event
+ * latency; differences below the tolerance are treated as the same timeline so that only real seeks,
+ * pauses and track changes cause a presence update.
+ */
+bool IsSameTimeline(const PlaybackTimeline& a, const PlaybackTimeline& b, std::chrono::milliseconds tolerance);
+
+/**
+ * @brief Adds the timeline's timestamps to an activity. Does nothing for paused or unknown timelines.
+ */
+void ApplyTimeline(discordpp::Activity& activity, const PlaybackTimeline& timeline);
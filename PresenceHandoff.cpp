@@ -0,0 +1,55 @@
+﻿/**
+ * @file PresenceHandoff.cpp
+ * @brief Lock-free handoff of presence updates from the pipeline worker to the main thread.
+ */
+
+#include "pch.h"
+#include "PresenceHandoff.h"
+#include "Log.h"
+#include "MainLoop.h"
+
+#include <thread>
+
+PresenceHandoff::PresenceHandoff(Handler handler)
+    : m_handler(std::move(handler))
+{
+}
+
+void PresenceHandoff::Register()
+{
+    AddMainLoopDrain([this] { Drain(); });
+}
+
+void PresenceHandoff::Show(const TrackSnapshot& track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation)
+{
+    Push({ track, timeline, eventTicks, generation });
+}
+
+void PresenceHandoff::Clear()
+{
+    Push({});
+}
+
+void PresenceHandoff::Push(Update&& update)
+{
+    // A track produces at most two updates, so the queue only fills while the main thread is stuck
+    // in a modal loop (e.g. the tray menu). Wait for it rather than reorder or drop an update.
+    bool warned = false;
+    while (!m_queue.TryPush(std::move(update))) {
+        if (!warned) {
+            LOG_WARNING("Presence handoff queue is full; waiting for the main thread.");
+            warned = true;
+        }
+        WakeMainLoop();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    WakeMainLoop();
+}
+
+void PresenceHandoff::Drain()
+{
+    Update update;
+    while (m_queue.TryPop(update)) {
+        m_handler(update);
+    }
+}
@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include "SpscQueue.h"
+#include "TrackPipeline.h"
+
+#include <cstdint>
+#include <functional>
+
+/**
+ * @class PresenceHandoff
+ * @brief IPresenceSink that carries the pipeline worker's updates to the main thread without a lock.
+ *
+ * The pipeline worker is the only producer and the main thread the only consumer, so the updates
+ * travel through an SpscQueue; each push wakes the main loop, whose drain hands them to the handler
+ * in order. Call Register once on the main thread before the pipeline can produce anything.
+ */
+class PresenceHandoff : public IPresenceSink {
+public:
+    /**
+     * @struct Update
+     * @brief One presence change: a track to show, or an empty snapshot to clear the presence.
+     */
+    struct Update {
+        TrackSnapshot       track;
+        PlaybackTimeline    timeline;           // As passed to IPresenceSink::Show
+        int64_t             eventTicks = 0;     // Likewise
+        uint64_t            generation = 0;     // Likewise; 0 for clears
+    };
+
+    using Handler = std::function<void(Update& update)>;
+
+    /**
+     * @param handler Applies an update; runs on the main thread.
+     */
+    explicit PresenceHandoff(Handler handler);
+
+    /**
+     * @brief Adds the drain to the main loop. Main thread only.
+     */
+    void Register();
+
+    void Show(const TrackSnapshot& track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation) override;
+    void Clear() override;
+
+private:
+    static constexpr size_t QUEUE_CAPACITY = 64;
+
+    void Push(Update&& update);
+    void Drain();
+
+    Handler                                 m_handler;
+    SpscQueue<Update, QUEUE_CAPACITY>       m_queue;
+};
@@ -0,0 +1,201 @@
+﻿/**
+ * @file PresencePublisher.cpp
+ * @brief Token bucket, diffing, latest-wins coalescing and reconnect handling for rich presence updates.
+ */
+
+#include "pch.h"
+#include "PresencePublisher.h"
+#include "Log.h"
+#include "MainLoop.h"
+#include "Stats.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr uint32_t MAX_RETRIES = 3; // Rejected sends of the same presence before giving up on it
+    constexpr std::chrono::seconds RECONNECT_BASE_DELAY{ 2 };   // First probe after Discord became unreachable
+    constexpr std::chrono::seconds RECONNECT_MAX_DELAY{ 60 };   // The probe interval doubles up to this
+}
+
+PresencePublisher::PresencePublisher(SendFunction send, uint32_t burst, Clock::duration refill)
+    : m_send(std::move(send))
+    , m_burst(static_cast<double>((std::max)(burst, 1u)))
+    , m_refill(refill)
+    , m_tokens(m_burst)
+    , m_lastRefill(Clock::now())
+{
+}
+
+void PresencePublisher::Publish(Presence presence, uint64_t fingerprint)
+{
+    Update update{ std::move(presence), fingerprint };
+
+    // Compare against the state Discord will end up in once the outstanding request lands.
+    const std::optional<Update>& target = m_inFlight ? m_inFlight : m_acknowledged;
+    if (target && SamePresence(*target, update)) {
+        ++m_stats.dropped;
+        if (m_pending) {
+            // The older pending update would only be undone by this one; forget both.
+            ++m_stats.coalesced;
+            m_pending.reset();
+        }
+        return;
+    }
+
+    if (m_pending) {
+        ++m_stats.coalesced;
+    }
+    m_pending = std::move(update);
+    m_retries = 0;
+    Flush();
+}
+
+void PresencePublisher::Flush()
+{
+    if (!m_pending || m_inFlight) {
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (!m_connected && now < m_probeAt) {
+        ScheduleFlush(m_probeAt);
+        return;
+    }
+    Refill(now);
+    if (m_tokens < 1.0) {
+        ScheduleFlush(now + std::chrono::duration_cast<Clock::duration>(m_refill * (1.0 - m_tokens)));
+        return;
+    }
+
+    m_tokens -= 1.0;
+    m_inFlight = std::move(m_pending);
+    m_pending.reset();
+    ++m_stats.sent;
+
+    m_send(m_inFlight->presence, [this](SendResult result) { OnSendCompleted(result); });
+}
+
+void PresencePublisher::Refill(Clock::time_point now)
+{
+    if (m_refill.count() <= 0) {
+        m_tokens = m_burst;
+    }
+    else {
+        double earned = std::chrono::duration<double>(now - m_lastRefill) / std::chrono::duration<double>(m_refill);
+        m_tokens = (std::min)(m_burst, m_tokens + earned);
+    }
+    m_lastRefill = now;
+}
+
+void PresencePublisher::ScheduleFlush(Clock::time_point when)
+{
+    if (m_flushScheduled) {
+        return;
+    }
+    m_flushScheduled = true;
+
+    PostToMainLoopAt(when, [this] {
+        m_flushScheduled = false;
+        Flush();
+        });
+}
+
+void PresencePublisher::OnSendCompleted(SendResult result)
+{
+    std::optional<Update> sent = std::move(m_inFlight);
+    m_inFlight.reset();
+
+    if (result == SendResult::Accepted) {
+        // A clear always "succeeds" without asking Discord, so only an activity proves it is back.
+        if (!m_connected && sent->presence) {
+            m_connected = true;
+            ++m_stats.reconnects;
+            RecordStage(Stage::DiscordRecovery, m_disconnectedTicks);
+            LOG_INFO("Discord is reachable again; the latest presence was replayed.");
+        }
+        m_acknowledged = std::move(sent);
+        m_retries = 0;
+
+        // Something newer may have become a no-op now that Discord shows the sent presence.
+        if (m_pending && SamePresence(*m_acknowledged, *m_pending)) {
+            ++m_stats.dropped;
+            m_pending.reset();
+        }
+    }
+    else if (result == SendResult::Unreachable) {
+        ++m_stats.failed;
+        if (!m_pending) {
+            // Replay only the newest presence; anything older than a pending update is simply dropped.
+            m_pending = std::move(sent);
+        }
+        MarkDisconnected(Clock::now());
+    }
+    else {
+        ++m_stats.failed;
+        if (!m_pending && ++m_retries <= MAX_RETRIES) {
+            // Nothing newer to show; try the rejected presence again once the budget allows.
+            m_pending = std::move(sent);
+        }
+        else if (!m_pending) {
+            LOG_WARNING("Giving up on a presence update after " << MAX_RETRIES << " retries.");
+            m_retries = 0;
+        }
+    }
+
+    Flush();
+}
+
+void PresencePublisher::OnConnectionLost()
+{
+    if (!m_connected) {
+        return;
+    }
+    if (!m_pending && !m_inFlight && m_acknowledged) {
+        m_pending = std::move(m_acknowledged);
+    }
+    MarkDisconnected(Clock::now());
+    Flush();
+}
+
+void PresencePublisher::OnConnectionRestored()
+{
+    if (m_connected) {
+        return;
+    }
+    m_probeAt = Clock::now();
+    m_backoff = Clock::duration::zero();
+    Flush();
+}
+
+/**
+ * @brief Enters reconnecting mode, or backs off further if already in it.
+ */
+void PresencePublisher::MarkDisconnected(Clock::time_point now)
+{
+    if (m_connected) {
+        m_connected = false;
+        m_disconnectedTicks = StatsNow();
+        m_backoff = RECONNECT_BASE_DELAY;
+        LOG_WARNING("Discord is unreachable. Retrying with the latest presence every " << RECONNECT_BASE_DELAY.count() << "-" << RECONNECT_MAX_DELAY.count() << " s.");
+    }
+    else {
+        m_backoff = (std::min)(Clock::duration(m_backoff * 2), Clock::duration(RECONNECT_MAX_DELAY));
+        m_backoff = (std::max)(m_backoff, Clock::duration(RECONNECT_BASE_DELAY));
+    }
+    // Whatever Discord showed is gone after a restart; never diff against it again.
+    m_acknowledged.reset();
+    m_retries = 0;
+    m_probeAt = now + m_backoff;
+}
+
+bool PresencePublisher::SamePresence(const Update& a, const Update& b)
+{
+    if (a.fingerprint != 0 && b.fingerprint != 0) {
+        return a.fingerprint == b.fingerprint;
+    }
+    if (a.presence.has_value() != b.presence.has_value()) {
+        return false;
+    }
+    return !a.presence.has_value() || a.presence->Equals(*b.presence);
+}
@@ -0,0 +1,121 @@
+﻿#pragma once
+
+#include "discordpp.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+/**
+ * @class PresencePublisher
+ * @brief Rate-limited, diffing front end for Discord rich presence updates.
+ *
+ * Discord accepts a handful of activity updates per 20 seconds and rejects the rest, so rapid
+ * skipping used to burn through the budget and leave the final track unpublished. The publisher
+ * spends updates from a token bucket matched to that limit, drops updates that match what Discord
+ * already shows, and while throttled keeps only the newest pending activity, flushing it as soon
+ * as a token frees up. Only one request is in flight at a time, so acknowledgements stay ordered.
+ *
+ * When Discord itself is unreachable (not running, restarting, IPC dropped), instead of retrying a
+ * few times and giving up, the publisher goes into reconnecting mode: it probes with only the newest
+ * presence at an exponentially growing but bounded interval, and replays that one snapshot as soon
+ * as Discord answers again. Whatever was published in between is coalesced into it.
+ *
+ * Not thread-safe: own it from the main loop and call it only from posted work.
+ */
+class PresencePublisher {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief An activity to show; std::nullopt clears the presence.
+     */
+    using Presence = std::optional<discordpp::Activity>;
+
+    /**
+     * @brief How a send ended.
+     */
+    enum class SendResult {
+        Accepted,       // Discord shows the presence
+        Rejected,       // Discord refused this update; retried a few times
+        Unreachable,    // Discord could not be reached at all; retried until it is back
+    };
+
+    /**
+     * @brief Sends a presence to Discord and reports the outcome through the completion callback.
+     */
+    using SendFunction = std::function<void(const Presence& presence, std::function<void(SendResult result)> done)>;
+
+    struct Stats {
+        uint64_t sent = 0;       // Requests handed to Discord
+        uint64_t failed = 0;     // Requests Discord rejected or never received
+        uint64_t dropped = 0;    // Updates identical to what Discord already shows
+        uint64_t coalesced = 0;  // Pending updates replaced by a newer one before they were sent
+        uint64_t reconnects = 0; // Times Discord came back after being unreachable
+    };
+
+    /**
+     * @param send Performs the actual Discord call.
+     * @param burst Number of updates that may be sent back to back.
+     * @param refill Time it takes to earn back one update.
+     */
+    PresencePublisher(SendFunction send, uint32_t burst, Clock::duration refill);
+
+    /**
+     * @brief Requests that the given presence be shown, sending it now or as soon as the budget allows.
+     * @param fingerprint A nonzero hash of everything the presence shows. When both sides of a diff
+     *        carry one, they are compared by fingerprint instead of field by field.
+     */
+    void Publish(Presence presence, uint64_t fingerprint = 0);
+
+    /**
+     * @brief Reports that the connection to Discord dropped, e.g. from the SDK's status callback.
+     *
+     * Discord forgets the presence when it restarts, so the last one is queued for replay.
+     */
+    void OnConnectionLost();
+
+    /**
+     * @brief Reports that Discord is reachable again; the newest presence is replayed right away.
+     */
+    void OnConnectionRestored();
+
+    bool IsConnected() const { return m_connected; }
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    void Flush();
+    void Refill(Clock::time_point now);
+    void ScheduleFlush(Clock::time_point when);
+    void OnSendCompleted(SendResult result);
+    void MarkDisconnected(Clock::time_point now);
+
+    struct Update {
+        Presence    presence;
+        uint64_t    fingerprint = 0;
+    };
+
+    static bool SamePresence(const Update& a, const Update& b);
+
+    SendFunction        m_send;
+    double              m_burst;
+    Clock::duration     m_refill;
+
+    double              m_tokens;
+    Clock::time_point   m_lastRefill;
+
+    std::optional<Update>   m_acknowledged;  // What Discord shows; empty until the first success
+    std::optional<Update>   m_inFlight;      // Sent, waiting for the callback
+    std::optional<Update>   m_pending;       // Newest update waiting for a token or for m_inFlight
+    uint32_t                m_retries = 0;   // Consecutive failures of the pending presence
+    bool                    m_flushScheduled = false;
+
+    bool                    m_connected = true;
+    Clock::time_point       m_probeAt;               // While disconnected: earliest next attempt
+    Clock::duration         m_backoff{ 0 };          // While disconnected: wait before the next attempt
+    int64_t                 m_disconnectedTicks = 0; // StatsNow() when the connection was lost
+
+    Stats               m_stats;
+};
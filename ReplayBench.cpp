@@ -0,0 +1,1000 @@
+﻿/**
+ * @file ReplayBench.cpp
+ * @brief Replays SMTC event traces through the real track pipeline against mock media, upload and Discord sinks.
+ *
+ * The benchmark links the same TrackPipeline, TrackScheduler, CoverCache and PresencePublisher as the
+ * app and runs them on the real main loop. Only the edges are mocked, each with a configurable
+ * latency: the SMTC reads, the CDN resolver and upload hosts, and the Discord client. Every run
+ * reports event-to-Discord latency, upload count and Discord call count, so regressions in
+ * debouncing, caching or rate limiting show up as numbers. The pipeline's ETW events (see Tracing.h)
+ * are written here too, so a bench run can be recorded with WPR like the app.
+ *
+ * Usage: tidal-rpc-bench [options]
+ *   --scenario <name>       skips, album, sessions, pauses or all (default)
+ *   --trace <file>          Replay a trace file instead of the built-in scenarios
+ *   --media-ms <ms>         TryGetMediaPropertiesAsync latency (default 15)
+ *   --resolve-ms <ms>       CDN resolver latency (default 0)
+ *   --resolver-hits         Let the resolver find every cover instead of missing
+ *   --upload-ms <ms>        Upload latency (default 900)
+ *   --upload-fail-every <n> Fail every n-th upload (default 0, never)
+ *   --discord-ms <ms>       UpdateRichPresence callback latency (default 120)
+ *   --jitter-ms <ms>        Adds seeded, uniformly distributed jitter to every latency (default 0)
+ *   --seed <n>              Seed for the jitter (default 1)
+ *   --debounce-ms <ms>      Pipeline debounce window (default 300)
+ *   --csv <directory>       Also write the stage histograms of every run as bench-<name>.csv
+ *   --verbose               Show the pipeline's debug log
+ *
+ * Soak mode replays a long synthetic stream of track changes, duplicate events, pauses and session
+ * switches, with covers from more albums than the cache holds, and fails (exit code 1) if the process
+ * grew between the end of the warm-up and the end of the run:
+ *   --soak <events>             Number of events to replay, e.g. 100000
+ *   --soak-interval-us <us>     Average gap between events (default 500)
+ *   --sample-every <n>          Log a resource sample every n events (default 10000)
+ *   --max-private-growth-kb <n> Private bytes threshold (default 16384)
+ *   --max-handle-growth <n>     Handle count threshold (default 64)
+ *   --max-thread-growth <n>     Thread count threshold (default 8)
+ *   --max-gui-growth <n>        GDI and USER object threshold (default 16)
+ * The debounce window defaults to 0 in soak mode, so every event reaches the pipeline.
+ *
+ * Kernel mode skips the pipeline and times every dHash kernel the CPU supports on random grids,
+ * failing (exit code 1) if any of them disagrees with the scalar kernel:
+ *   --kernels <iterations>      Number of grids to hash per kernel, e.g. 1000000
+ *
+ * Trace files hold one event per line as "<offset ms> <event> [arguments]"; '#' starts a comment:
+ *   0     track Title|Artist|Album   The TIDAL session switches to a track
+ *   120   refresh                    A spurious MediaPropertiesChanged for the current track
+ *   4000  pause / play               Playback pauses or resumes (a timeline-only presence update)
+ *   6000  session none / tidal       The TIDAL session goes away or comes back
+ *   9000  end                        Optional; stop replaying here
+ */
+
+#include "pch.h"
+
+#pragma comment(lib, "discord_partner_sdk.lib")
+#define DISCORDPP_IMPLEMENTATION
+#include "discordpp.h"
+
+#include "Hash.h"
+#include "Log.h"
+#include "MainLoop.h"
+#include "PerceptualHash.h"
+#include "PresenceHandoff.h"
+#include "PresencePublisher.h"
+#include "ResourceMonitor.h"
+#include "Stats.h"
+#include "StringUtils.h"
+#include "TrackPipeline.h"
+#include "TrackSnapshot.h"
+#include "Tracing.h"
+
+#include <winrt/Windows.Storage.Streams.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::Storage::Streams;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    using Milliseconds = std::chrono::milliseconds;
+
+    constexpr uint32_t      PRESENCE_BURST = 5;             // Same limits as the app
+    constexpr std::chrono::seconds PRESENCE_REFILL{ 4 };
+    constexpr Milliseconds  SETTLE_TIME{ 8000 };            // Keep running this long after the last event
+    constexpr uint32_t      THUMBNAIL_BYTES = 48 * 1024;    // Size of the synthetic cover of each album
+
+    struct BenchOptions {
+        std::wstring    scenario = L"all";
+        std::wstring    tracePath;
+        std::wstring    csvDirectory;
+        Milliseconds    mediaLatency{ 15 };
+        Milliseconds    resolveLatency{ 0 };
+        Milliseconds    uploadLatency{ 900 };
+        Milliseconds    discordLatency{ 120 };
+        Milliseconds    jitter{ 0 };
+        Milliseconds    debounce{ 300 };
+        bool            resolverHits = false;
+        uint32_t        uploadFailEvery = 0;
+        uint32_t        seed = 1;
+        bool            verbose = false;
+        bool            debounceSet = false;
+
+        uint64_t                    soakEvents = 0;     // 0 runs the trace scenarios instead
+        std::chrono::microseconds   soakInterval{ 500 };
+        uint64_t                    sampleEvery = 10000;
+        int64_t                     maxPrivateGrowthKb = 16384;
+        int64_t                     maxHandleGrowth = 64;
+        int64_t                     maxThreadGrowth = 8;
+        int64_t                     maxGuiGrowth = 16;
+
+        uint64_t                    kernelIterations = 0; // Non-zero runs the dHash kernel benchmark instead
+    };
+
+    enum class EventType { Track, Refresh, Pause, Play, SessionNone, SessionTidal, End };
+
+    struct TraceEvent {
+        Milliseconds    offset{ 0 };
+        EventType       type = EventType::Refresh;
+        TrackSnapshot   track;  // For EventType::Track
+    };
+
+    using Trace = std::vector<TraceEvent>;
+
+    TraceEvent MakeEvent(int64_t offsetMs, EventType type)
+    {
+        TraceEvent event;
+        event.offset = Milliseconds(offsetMs);
+        event.type = type;
+        return event;
+    }
+
+    TraceEvent MakeTrack(int64_t offsetMs, std::wstring_view title, std::wstring_view artist, std::wstring_view album)
+    {
+        TraceEvent event = MakeEvent(offsetMs, EventType::Track);
+        event.track = TrackSnapshot(title, artist, album);
+        return event;
+    }
+
+    /**
+     * @brief Four bursts of six quick skips across different albums, each settling on the last track.
+     */
+    Trace BurstySkipsTrace()
+    {
+        Trace trace;
+        int64_t time = 0;
+        for (int burst = 0; burst < 4; ++burst) {
+            for (int skip = 0; skip < 6; ++skip) {
+                std::wstring id = std::to_wstring(burst * 6 + skip);
+                trace.push_back(MakeTrack(time, L"Skip " + id, L"Artist " + id, L"Album " + id));
+                time += 150;
+            }
+            // TIDAL repeats MediaPropertiesChanged once the new track has loaded.
+            trace.push_back(MakeEvent(time - 50, EventType::Refresh));
+            time += 8000;
+        }
+        return trace;
+    }
+
+    /**
+     * @brief A twelve-track album played through, with the usual duplicate event after each change.
+     */
+    Trace AlbumTrace()
+    {
+        Trace trace;
+        for (int track = 0; track < 12; ++track) {
+            int64_t time = track * 2500;
+            trace.push_back(MakeTrack(time, L"Album Track " + std::to_wstring(track + 1), L"Album Artist", L"The Album"));
+            trace.push_back(MakeEvent(time + 60, EventType::Refresh));
+        }
+        return trace;
+    }
+
+    /**
+     * @brief The TIDAL session coming and going, as when the app is restarted or another player takes over.
+     */
+    Trace SessionSwitchTrace()
+    {
+        return {
+            MakeTrack(0, L"Session A", L"Artist A", L"Album A"),
+            MakeEvent(3000, EventType::SessionNone),
+            MakeEvent(3600, EventType::SessionTidal),
+            MakeTrack(7000, L"Session B", L"Artist B", L"Album B"),
+            MakeEvent(10000, EventType::SessionNone),
+            MakeEvent(14000, EventType::SessionTidal),
+            MakeTrack(14100, L"Session C", L"Artist A", L"Album A"),
+        };
+    }
+
+    /**
+     * @brief Pauses and resumes, including a rapid toggle that has to get past the rate limiter.
+     */
+    Trace PauseTrace()
+    {
+        return {
+            MakeTrack(0, L"Paused A", L"Artist", L"Album P"),
+            MakeEvent(4000, EventType::Pause),
+            MakeEvent(6000, EventType::Play),
+            MakeEvent(6050, EventType::Refresh),
+            MakeEvent(8000, EventType::Pause),
+            MakeEvent(8200, EventType::Play),
+            MakeEvent(8400, EventType::Pause),
+            MakeEvent(8600, EventType::Play),
+            MakeTrack(12000, L"Paused B", L"Artist", L"Album P"),
+            MakeEvent(15000, EventType::Pause),
+            MakeEvent(18000, EventType::Play),
+        };
+    }
+
+    /**
+     * @brief Loads a trace file. Returns an empty trace, after logging why, if it cannot be parsed.
+     */
+    Trace LoadTrace(const std::wstring& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            LOG_ERROR("Could not open trace " << ws2s(path));
+            return {};
+        }
+
+        Trace trace;
+        std::string line;
+        size_t lineNumber = 0;
+        while (std::getline(file, line)) {
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (lineNumber == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+                line.erase(0, 3);
+            }
+            size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+
+            char* end = nullptr;
+            long long offset = strtoll(line.c_str() + first, &end, 10);
+            std::string rest = end;
+            size_t nameStart = rest.find_first_not_of(" \t");
+            size_t nameEnd = rest.find_first_of(" \t", nameStart);
+            std::string name = nameStart == std::string::npos ? std::string() : rest.substr(nameStart, nameEnd - nameStart);
+            std::string argument;
+            if (nameEnd != std::string::npos) {
+                size_t argumentStart = rest.find_first_not_of(" \t", nameEnd);
+                if (argumentStart != std::string::npos) {
+                    argument = rest.substr(argumentStart);
+                }
+            }
+
+            if (name == "track") {
+                std::wstring fields = s2ws(argument);
+                size_t firstBar = fields.find(L'|');
+                size_t secondBar = firstBar == std::wstring::npos ? std::wstring::npos : fields.find(L'|', firstBar + 1);
+                if (secondBar == std::wstring::npos) {
+                    LOG_ERROR("Trace line " << lineNumber << ": expected Title|Artist|Album.");
+                    return {};
+                }
+                trace.push_back(MakeTrack(offset, fields.substr(0, firstBar), fields.substr(firstBar + 1, secondBar - firstBar - 1), fields.substr(secondBar + 1)));
+            }
+            else if (name == "refresh") { trace.push_back(MakeEvent(offset, EventType::Refresh)); }
+            else if (name == "pause") { trace.push_back(MakeEvent(offset, EventType::Pause)); }
+            else if (name == "play") { trace.push_back(MakeEvent(offset, EventType::Play)); }
+            else if (name == "session" && argument == "none") { trace.push_back(MakeEvent(offset, EventType::SessionNone)); }
+            else if (name == "session" && argument == "tidal") { trace.push_back(MakeEvent(offset, EventType::SessionTidal)); }
+            else if (name == "end") { trace.push_back(MakeEvent(offset, EventType::End)); }
+            else {
+                LOG_ERROR("Trace line " << lineNumber << ": unknown event '" << name << "'.");
+                return {};
+            }
+        }
+
+        std::stable_sort(trace.begin(), trace.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.offset < b.offset; });
+        return trace;
+    }
+
+    /**
+     * @class LatencyModel
+     * @brief The configured base latency plus seeded jitter, so runs with the same options are repeatable.
+     */
+    class LatencyModel {
+    public:
+        LatencyModel(uint32_t seed, Milliseconds jitter) : m_random(seed), m_jitter(jitter) {}
+
+        Milliseconds Next(Milliseconds base)
+        {
+            if (m_jitter.count() <= 0) {
+                return base;
+            }
+            std::lock_guard<std::mutex> lock(m_lock);
+            std::uniform_int_distribution<int64_t> distribution(0, m_jitter.count());
+            return base + Milliseconds(distribution(m_random));
+        }
+
+    private:
+        std::mutex      m_lock;
+        std::mt19937    m_random;
+        Milliseconds    m_jitter;
+    };
+
+    /**
+     * @brief Builds a thumbnail whose bytes depend only on the album, like TIDAL's real covers.
+     */
+    IAsyncOperation<IRandomAccessStreamReference> MakeThumbnailAsync(TrackSnapshot track)
+    {
+        std::vector<uint8_t> bytes(THUMBNAIL_BYTES);
+        std::string_view album = track.Album();
+        std::mt19937_64 random(HashBytes(album.data(), album.size()));
+        for (size_t i = 0; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+            uint64_t value = random();
+            std::memcpy(&bytes[i], &value, sizeof(value));
+        }
+
+        InMemoryRandomAccessStream stream;
+        DataWriter writer(stream);
+        writer.WriteBytes(bytes);
+        co_await writer.StoreAsync();
+        writer.DetachStream();
+        stream.Seek(0);
+        co_return RandomAccessStreamReference::CreateFromStream(stream);
+    }
+
+    /**
+     * @class ReplayMediaSource
+     * @brief Stands in for the pinned SMTC session; the trace player sets what it currently reports.
+     */
+    class ReplayMediaSource : public IMediaSource {
+    public:
+        ReplayMediaSource(LatencyModel& latency, Milliseconds baseLatency) : m_latency(latency), m_baseLatency(baseLatency) {}
+
+        void SetTrack(const TrackSnapshot& track)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_track = track;
+            m_hasSession = true;
+        }
+
+        void SetSession(bool present)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_hasSession = present;
+        }
+
+        std::string CurrentTitle() const
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return std::string(m_track.Title());
+        }
+
+        IAsyncOperation<bool> ReadAsync(MediaSnapshot& snapshot) override
+        {
+            co_await resume_after(m_latency.Next(m_baseLatency));
+
+            TrackSnapshot track;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (!m_hasSession || m_track.Empty()) {
+                    co_return false;
+                }
+                track = m_track;
+            }
+            snapshot.thumbnail = co_await MakeThumbnailAsync(track);
+            snapshot.track = std::move(track);
+            co_return true;
+        }
+
+    private:
+        LatencyModel&       m_latency;
+        const Milliseconds  m_baseLatency;
+        mutable std::mutex  m_lock;
+        TrackSnapshot       m_track;
+        bool                m_hasSession = false;
+    };
+
+    /**
+     * @class MockCoverService
+     * @brief A resolver and upload host that only wait; uploads abort promptly when cancelled, like the real hosts.
+     */
+    class MockCoverService : public ICoverService {
+    public:
+        MockCoverService(const BenchOptions& options, LatencyModel& latency) : m_options(options), m_latency(latency) {}
+
+        std::optional<std::wstring> Lookup(uint64_t albumKey) override
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            auto it = m_resolved.find(albumKey);
+            if (it == m_resolved.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+
+        IAsyncOperation<hstring> ResolveAsync(TrackSnapshot track) override
+        {
+            ++resolves;
+            co_await resume_after(m_latency.Next(m_options.resolveLatency));
+            if (!m_options.resolverHits) {
+                co_return hstring();
+            }
+
+            uint64_t albumKey = track.AlbumKey();
+            std::wstring url = L"https://resources.tidal.com/images/replay/" + std::to_wstring(albumKey) + L"/640x640.jpg";
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_resolved[albumKey] = url;
+            }
+            co_return hstring(url);
+        }
+
+        IAsyncOperation<hstring> UploadAsync(array_view<uint8_t const> bytes, std::chrono::system_clock::time_point, uint64_t) override
+        {
+            auto cancellation = co_await get_cancellation_token();
+            uint64_t number = ++uploads;
+            uploadedBytes += bytes.size();
+
+            auto cancelled = std::make_shared<handle>(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+            cancellation.callback([cancelled] { SetEvent(cancelled->get()); });
+            if (co_await resume_on_signal(cancelled->get(), m_latency.Next(m_options.uploadLatency))) {
+                ++cancelledUploads;
+                throw hresult_canceled();
+            }
+
+            if (m_options.uploadFailEvery != 0 && number % m_options.uploadFailEvery == 0) {
+                ++failedUploads;
+                co_return L"Error: simulated upload failure";
+            }
+            co_return hstring(L"https://0x0.st/replay" + std::to_wstring(number) + L".jpg");
+        }
+
+        std::atomic<uint64_t>   resolves{ 0 };
+        std::atomic<uint64_t>   uploads{ 0 };
+        std::atomic<uint64_t>   uploadedBytes{ 0 };
+        std::atomic<uint64_t>   cancelledUploads{ 0 };
+        std::atomic<uint64_t>   failedUploads{ 0 };
+
+    private:
+        const BenchOptions&                     m_options;
+        LatencyModel&                           m_latency;
+        std::mutex                              m_lock;
+        std::map<uint64_t, std::wstring>        m_resolved;
+    };
+
+    /**
+     * @class ReplayDiscord
+     * @brief The app's presence path up to the Discord client: the PresenceHandoff into a main-thread presented
+     *        track feeding the real PresencePublisher, whose requests complete on the main loop after the
+     *        configured latency.
+     */
+    class ReplayDiscord {
+    public:
+        struct Shown {
+            Clock::time_point   time;
+            std::string         details;
+            bool                hasCover = false;
+        };
+
+        ReplayDiscord(const BenchOptions& options, LatencyModel& latency)
+            : m_options(options)
+            , m_latency(latency)
+            , m_publisher([this](const PresencePublisher::Presence& presence, std::function<void(PresencePublisher::SendResult)> done) { Send(presence, std::move(done)); },
+                PRESENCE_BURST, PRESENCE_REFILL)
+            , m_handoff([this](PresenceHandoff::Update& update) { Apply(update); })
+        {
+            m_handoff.Register();
+        }
+
+        /**
+         * @brief The sink the pipeline feeds.
+         */
+        IPresenceSink& Sink() { return m_handoff; }
+
+        void SetPlaying(bool playing)
+        {
+            PostToMainLoop([this, playing] {
+                m_playing = playing;
+                Publish();
+                });
+        }
+
+        const PresencePublisher::Stats& PublisherStats() const { return m_publisher.GetStats(); }
+
+        uint64_t                updates = 0;    // UpdateRichPresence calls; main thread only
+        uint64_t                clears = 0;     // ClearRichPresence calls; main thread only
+        std::vector<Shown>      shown;          // Every activity Discord acknowledged; main thread only
+        bool                    recordShown = true;
+
+    private:
+        void Apply(PresenceHandoff::Update& update)
+        {
+            if (update.track.Empty()) {
+                m_track = {};
+                m_publisher.Publish(std::nullopt);
+                return;
+            }
+            m_track = std::move(update.track);
+            if (update.eventTicks != 0) {
+                m_eventTicks = update.eventTicks;
+            }
+            Publish();
+        }
+
+        void Publish()
+        {
+            if (m_track.Empty()) {
+                return;
+            }
+            discordpp::Activity activity;
+            activity.SetType(discordpp::ActivityTypes::Listening);
+            activity.SetName(std::string(m_track.Artist()));
+            activity.SetDetails(std::string(m_track.Title()));
+            activity.SetState(std::string(m_track.Artist()));
+            if (!m_track.CoverArtUrl().empty()) {
+                discordpp::ActivityAssets assets;
+                assets.SetLargeImage(std::string(m_track.CoverArtUrl()));
+                activity.SetAssets(assets);
+            }
+            if (m_playing) {
+                // Stands in for the progress bar; a pause removes it, a resume brings it back.
+                discordpp::ActivityTimestamps timestamps;
+                timestamps.SetStart(static_cast<uint64_t>(std::chrono::duration_cast<Milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count()));
+                activity.SetTimestamps(timestamps);
+            }
+            // Like the app's timeline, the bench's stand-in timestamps only change with the track or the playback state.
+            m_publisher.Publish(activity, HashBytes(&m_playing, sizeof(m_playing), m_track.Fingerprint()));
+        }
+
+        void Send(const PresencePublisher::Presence& presence, std::function<void(PresencePublisher::SendResult)> done)
+        {
+            if (!presence) {
+                ++clears;
+                done(PresencePublisher::SendResult::Accepted);
+                return;
+            }
+
+            ++updates;
+            int64_t eventTicks = std::exchange(m_eventTicks, 0);
+            // The SDK reports results from RunCallbacks on the main thread; delayed main-loop work models that.
+            PostToMainLoopAt(Clock::now() + m_latency.Next(m_options.discordLatency), [this, activity = *presence, done = std::move(done), eventTicks] {
+                if (eventTicks != 0) {
+                    RecordStage(Stage::EndToEnd, eventTicks);
+                }
+                auto assets = activity.Assets();
+                if (recordShown) {
+                    shown.push_back({ Clock::now(), activity.Details().value_or(std::string()), assets && assets->LargeImage().has_value() });
+                }
+                done(PresencePublisher::SendResult::Accepted);
+                });
+        }
+
+        const BenchOptions&         m_options;
+        LatencyModel&               m_latency;
+        PresencePublisher           m_publisher;
+        TrackSnapshot               m_track;
+        bool                        m_playing = true;
+        int64_t                     m_eventTicks = 0;
+        PresenceHandoff             m_handoff;
+    };
+
+    /**
+     * @class ReplayRun
+     * @brief One pipeline with its mocks, fed by one trace.
+     */
+    class ReplayRun {
+    public:
+        struct TrackChange {
+            Clock::time_point   time;
+            std::string         title;
+        };
+
+        explicit ReplayRun(const BenchOptions& options)
+            : latency(options.seed, options.jitter)
+            , media(latency, options.mediaLatency)
+            , covers(options, latency)
+            , discord(options, latency)
+            , pipeline(media, covers, discord.Sink(), TrackPipeline::Options{})
+        {
+            pipeline.SetDebounce(options.debounce);
+            // The synthetic covers are not images, so skip the WIC stage.
+            pipeline.SetRecompression(0, 85);
+        }
+
+        /**
+         * @brief Applies one trace event the way the SMTC callbacks in WinMain.cpp would. Player thread only.
+         */
+        void Apply(const TraceEvent& event)
+        {
+            switch (event.type) {
+            case EventType::Track:
+                media.SetTrack(event.track);
+                if (recordHistory) {
+                    changes.push_back({ Clock::now(), std::string(event.track.Title()) });
+                }
+                CountEvent(Counter::MediaEvents);
+                pipeline.Schedule();
+                break;
+            case EventType::Refresh:
+                CountEvent(Counter::MediaEvents);
+                pipeline.Schedule();
+                break;
+            case EventType::Pause:
+            case EventType::Play:
+                discord.SetPlaying(event.type == EventType::Play);
+                break;
+            case EventType::SessionNone:
+            case EventType::SessionTidal:
+                media.SetSession(event.type == EventType::SessionTidal);
+                if (recordHistory && event.type == EventType::SessionTidal) {
+                    // The returning session shows its track again; time that like a track change.
+                    changes.push_back({ Clock::now(), media.CurrentTitle() });
+                }
+                pipeline.ForgetLastTrack();
+                pipeline.Schedule();
+                break;
+            case EventType::End:
+                break;
+            }
+        }
+
+        LatencyModel                latency;
+        ReplayMediaSource           media;
+        MockCoverService            covers;
+        ReplayDiscord               discord;
+        TrackPipeline               pipeline;
+        std::vector<TrackChange>    changes;    // Player thread until the run ends
+        bool                        recordHistory = true;
+    };
+
+    /**
+     * @brief Returns the nearest-rank percentile of the samples, or 0 without samples.
+     */
+    double Percentile(std::vector<double> samples, double percentile)
+    {
+        if (samples.empty()) {
+            return 0.0;
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t rank = static_cast<size_t>(percentile / 100.0 * (samples.size() - 1) + 0.5);
+        return samples[(std::min)(rank, samples.size() - 1)];
+    }
+
+    void PrintLatency(const char* label, const std::vector<double>& samples)
+    {
+        printf("  %-24s n=%-4zu p50 %8.1f  p95 %8.1f  max %8.1f ms\n", label, samples.size(),
+            Percentile(samples, 50), Percentile(samples, 95), Percentile(samples, 100));
+    }
+
+    /**
+     * @brief Replays a trace on the main loop and prints what it cost. Returns false if the trace was empty.
+     * @param runs Keeps every run alive until the benchmark exits; work left over from a run may still
+     *        reference it while the next one starts.
+     */
+    bool RunTrace(const std::string& name, const Trace& trace, const BenchOptions& options, std::vector<std::unique_ptr<ReplayRun>>& runs)
+    {
+        if (trace.empty()) {
+            return false;
+        }
+
+        ResetStats();
+        runs.push_back(std::make_unique<ReplayRun>(options));
+        ReplayRun& run = *runs.back();
+
+        Clock::time_point start = Clock::now();
+        std::thread player([&] {
+            Milliseconds last{ 0 };
+            for (auto const& event : trace) {
+                std::this_thread::sleep_until(start + event.offset);
+                last = event.offset;
+                if (event.type == EventType::End) {
+                    break;
+                }
+                run.Apply(event);
+            }
+            std::this_thread::sleep_until(start + last + SETTLE_TIME);
+            PostToMainLoop([] { PostQuitMessage(0); });
+            });
+        RunMainLoop();
+        player.join();
+
+        // A track counts as shown once Discord acknowledged it while it was still the playing track.
+        std::vector<double> firstShown, coverShown;
+        size_t shownCount = 0, coverCount = 0;
+        for (size_t i = 0; i < run.changes.size(); ++i) {
+            const auto& change = run.changes[i];
+            Clock::time_point windowEnd = i + 1 < run.changes.size() ? run.changes[i + 1].time : Clock::time_point::max();
+            bool sawTrack = false, sawCover = false;
+            for (const auto& shown : run.discord.shown) {
+                if (shown.time < change.time || shown.time >= windowEnd || shown.details != change.title) {
+                    continue;
+                }
+                double elapsedMs = std::chrono::duration<double, std::milli>(shown.time - change.time).count();
+                if (!sawTrack) {
+                    firstShown.push_back(elapsedMs);
+                    sawTrack = true;
+                }
+                if (shown.hasCover && !sawCover) {
+                    coverShown.push_back(elapsedMs);
+                    sawCover = true;
+                }
+            }
+            shownCount += sawTrack;
+            coverCount += sawCover;
+        }
+
+        const PresencePublisher::Stats& publisher = run.discord.PublisherStats();
+        double durationSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        printf("== %s: %zu track changes, %.1f s\n", name.c_str(), run.changes.size(), durationSeconds);
+        printf("  %-24s %zu of %zu (%zu with cover)\n", "shown while current", shownCount, run.changes.size(), coverCount);
+        PrintLatency("event -> first shown", firstShown);
+        PrintLatency("event -> cover shown", coverShown);
+        printf("  %-24s %llu started, %llu cancelled, %llu failed, %llu KB\n", "uploads",
+            static_cast<unsigned long long>(run.covers.uploads.load()), static_cast<unsigned long long>(run.covers.cancelledUploads.load()),
+            static_cast<unsigned long long>(run.covers.failedUploads.load()), static_cast<unsigned long long>(run.covers.uploadedBytes.load() / 1024));
+        printf("  %-24s %llu\n", "resolver lookups", static_cast<unsigned long long>(run.covers.resolves.load()));
+        printf("  %-24s %llu updates, %llu clears (%llu dropped, %llu coalesced by the publisher)\n", "discord calls",
+            static_cast<unsigned long long>(run.discord.updates), static_cast<unsigned long long>(run.discord.clears),
+            static_cast<unsigned long long>(publisher.dropped), static_cast<unsigned long long>(publisher.coalesced));
+        printf("  %-24s %llu\n\n", "events coalesced", static_cast<unsigned long long>(run.pipeline.CoalescedCount()));
+
+        StatsExtras extras = {
+            { "coalesced_events", run.pipeline.CoalescedCount() },
+            { "uploads", run.covers.uploads.load() },
+            { "uploads_cancelled", run.covers.cancelledUploads.load() },
+            { "discord_updates", run.discord.updates },
+            { "discord_clears", run.discord.clears },
+        };
+        printf("%s\n", FormatStatsSummary(extras).c_str());
+        if (!options.csvDirectory.empty()) {
+            std::wstring path = options.csvDirectory + L"\\bench-" + s2ws(name) + L".csv";
+            if (!WriteStatsCsv(path, extras)) {
+                LOG_ERROR("Could not write " << ws2s(path));
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief The index-th soak event: mostly track changes across 640 albums, ten times what the cover
+     *        cache holds, with duplicate events, pauses and a session switch every thousand events.
+     */
+    TraceEvent SoakEvent(uint64_t index)
+    {
+        if (index % 1000 == 998) {
+            return MakeEvent(0, EventType::SessionNone);
+        }
+        if (index % 1000 == 999) {
+            return MakeEvent(0, EventType::SessionTidal);
+        }
+        if (index % 5 == 4) {
+            return MakeEvent(0, EventType::Refresh);
+        }
+        if (index % 50 == 23) {
+            return MakeEvent(0, index % 100 < 50 ? EventType::Pause : EventType::Play);
+        }
+        return MakeTrack(0, L"Soak " + std::to_wstring(index), L"Artist " + std::to_wstring(index % 97), L"Album " + std::to_wstring(index % 640));
+    }
+
+    /**
+     * @brief Runs the soak and compares the settled process after the warm-up with the settled process at the end.
+     * @return true if every resource stayed within its threshold.
+     */
+    bool RunSoak(const BenchOptions& options, std::vector<std::unique_ptr<ReplayRun>>& runs)
+    {
+        ResetStats();
+        runs.push_back(std::make_unique<ReplayRun>(options));
+        ReplayRun& run = *runs.back();
+        run.recordHistory = false;
+        run.discord.recordShown = false;
+
+        const uint64_t warmUp = (std::max)(options.soakEvents / 10, uint64_t(1));
+        ResourceSample baseline, finalSample;
+
+        printf("== soak: %llu events\n", static_cast<unsigned long long>(options.soakEvents));
+        Clock::time_point start = Clock::now();
+        std::thread player([&] {
+            Clock::time_point paceStart = Clock::now();
+            for (uint64_t i = 0; i < options.soakEvents; ++i) {
+                // Sleep only when ahead of schedule; the coarse sleep granularity then averages out.
+                Clock::time_point due = paceStart + options.soakInterval * static_cast<int64_t>(i);
+                if (Clock::now() < due) {
+                    std::this_thread::sleep_until(due);
+                }
+                run.Apply(SoakEvent(i));
+
+                if (i + 1 == warmUp) {
+                    std::this_thread::sleep_for(SETTLE_TIME);
+                    baseline = SampleProcessResources();
+                    printf("  %-10llu %s (baseline)\n", static_cast<unsigned long long>(i + 1), FormatResourceSample(baseline).c_str());
+                    paceStart = Clock::now() - options.soakInterval * static_cast<int64_t>(i + 1);
+                }
+                else if (options.sampleEvery != 0 && (i + 1) % options.sampleEvery == 0) {
+                    printf("  %-10llu %s\n", static_cast<unsigned long long>(i + 1), FormatResourceSample(SampleProcessResources()).c_str());
+                }
+            }
+            std::this_thread::sleep_for(SETTLE_TIME);
+            finalSample = SampleProcessResources();
+            PostToMainLoop([] { PostQuitMessage(0); });
+            });
+
+        RunMainLoop();
+        player.join();
+        printf("  %-10s %s\n", "final", FormatResourceSample(finalSample).c_str());
+
+        struct Check {
+            const char* name;
+            int64_t     growth;
+            int64_t     limit;
+        };
+        const Check checks[] = {
+            { "private KB", (static_cast<int64_t>(finalSample.privateBytes) - static_cast<int64_t>(baseline.privateBytes)) / 1024, options.maxPrivateGrowthKb },
+            { "handles", static_cast<int64_t>(finalSample.handleCount) - baseline.handleCount, options.maxHandleGrowth },
+            { "threads", static_cast<int64_t>(finalSample.threadCount) - baseline.threadCount, options.maxThreadGrowth },
+            { "GDI objects", static_cast<int64_t>(finalSample.gdiObjects) - baseline.gdiObjects, options.maxGuiGrowth },
+            { "USER objects", static_cast<int64_t>(finalSample.userObjects) - baseline.userObjects, options.maxGuiGrowth },
+        };
+        bool passed = true;
+        for (auto const& check : checks) {
+            bool ok = check.growth <= check.limit;
+            passed = passed && ok;
+            printf("  %-24s %+lld (limit %lld)%s\n", check.name, static_cast<long long>(check.growth), static_cast<long long>(check.limit), ok ? "" : "  FAILED");
+        }
+
+        printf("  %-24s %.1f s\n", "duration", std::chrono::duration<double>(Clock::now() - start).count());
+        printf("  %-24s %llu started, %llu cancelled\n", "uploads",
+            static_cast<unsigned long long>(run.covers.uploads.load()), static_cast<unsigned long long>(run.covers.cancelledUploads.load()));
+        printf("  %-24s %llu updates, %llu clears\n", "discord calls",
+            static_cast<unsigned long long>(run.discord.updates), static_cast<unsigned long long>(run.discord.clears));
+        printf("  %-24s %s\n\n", "result", passed ? "PASS" : "FAIL");
+        printf("%s\n", FormatStatsSummary({ { "coalesced_events", run.pipeline.CoalescedCount() } }).c_str());
+        return passed;
+    }
+
+    /**
+     * @brief Checks every supported dHash kernel against the scalar one and prints its throughput.
+     * @return true if all kernels agreed on every grid.
+     */
+    bool RunKernelBench(uint64_t iterations)
+    {
+        // A few distinct grids, so the loop isn't hashing the same cache lines with the same branches.
+        constexpr size_t GRID_COUNT = 64;
+        std::vector<uint8_t> grids(GRID_COUNT * DHASH_GRID_BYTES);
+        std::mt19937 random(1);
+        for (uint8_t& pixel : grids) {
+            pixel = static_cast<uint8_t>(random());
+        }
+
+        std::vector<uint64_t> expected(GRID_COUNT);
+        for (size_t i = 0; i < GRID_COUNT; ++i) {
+            expected[i] = ComputeDHash(grids.data() + i * DHASH_GRID_BYTES, DHashKernel::Scalar);
+        }
+
+        static volatile uint64_t kernelSink = 0;
+        bool agreed = true;
+        printf("%-8s %14s %12s\n", "kernel", "grids/s", "MB/s");
+        for (DHashKernel kernel : { DHashKernel::Scalar, DHashKernel::Sse2, DHashKernel::Avx2 }) {
+            if (!IsDHashKernelSupported(kernel)) {
+                printf("%-8s %14s\n", DHashKernelName(kernel), "unsupported");
+                continue;
+            }
+
+            uint64_t mismatches = 0;
+            uint64_t sink = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < iterations; ++i) {
+                size_t grid = static_cast<size_t>(i % GRID_COUNT);
+                uint64_t hash = ComputeDHash(grids.data() + grid * DHASH_GRID_BYTES, kernel);
+                mismatches += hash != expected[grid];
+                sink ^= hash;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            kernelSink = sink; // Keeps the loop from being optimized away
+
+            double gridsPerSecond = seconds > 0 ? static_cast<double>(iterations) / seconds : 0;
+            printf("%-8s %14.0f %12.1f\n", DHashKernelName(kernel), gridsPerSecond,
+                gridsPerSecond * DHASH_GRID_WIDTH * DHASH_GRID_HEIGHT / (1024.0 * 1024.0));
+            if (mismatches != 0) {
+                fprintf(stderr, "%s disagreed with the scalar kernel on %llu of %llu grids\n",
+                    DHashKernelName(kernel), static_cast<unsigned long long>(mismatches), static_cast<unsigned long long>(iterations));
+                agreed = false;
+            }
+        }
+        printf("best: %s\n", DHashKernelName(BestDHashKernel()));
+        return agreed;
+    }
+
+    /**
+     * @brief Parses the command line. Returns false, after printing why, on an unknown or incomplete option.
+     */
+    bool ParseOptions(int argc, wchar_t** argv, BenchOptions& options)
+    {
+        for (int i = 1; i < argc; ++i) {
+            std::wstring_view arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            auto milliseconds = [&](Milliseconds& target) {
+                target = Milliseconds(wcstoll(argv[++i], nullptr, 10));
+            };
+
+            if (arg == L"--resolver-hits") { options.resolverHits = true; }
+            else if (arg == L"--verbose") { options.verbose = true; }
+            else if (!hasValue) {
+                fprintf(stderr, "Missing value for %s\n", ws2s(arg).c_str());
+                return false;
+            }
+            else if (arg == L"--scenario") { options.scenario = argv[++i]; }
+            else if (arg == L"--trace") { options.tracePath = argv[++i]; }
+            else if (arg == L"--csv") { options.csvDirectory = argv[++i]; }
+            else if (arg == L"--media-ms") { milliseconds(options.mediaLatency); }
+            else if (arg == L"--resolve-ms") { milliseconds(options.resolveLatency); }
+            else if (arg == L"--upload-ms") { milliseconds(options.uploadLatency); }
+            else if (arg == L"--discord-ms") { milliseconds(options.discordLatency); }
+            else if (arg == L"--jitter-ms") { milliseconds(options.jitter); }
+            else if (arg == L"--debounce-ms") { milliseconds(options.debounce); options.debounceSet = true; }
+            else if (arg == L"--soak") { options.soakEvents = wcstoull(argv[++i], nullptr, 10); }
+            else if (arg == L"--soak-interval-us") { options.soakInterval = std::chrono::microseconds(wcstoll(argv[++i], nullptr, 10)); }
+            else if (arg == L"--sample-every") { options.sampleEvery = wcstoull(argv[++i], nullptr, 10); }
+            else if (arg == L"--max-private-growth-kb") { options.maxPrivateGrowthKb = wcstoll(argv[++i], nullptr, 10); }
+            else if (arg == L"--max-handle-growth") { options.maxHandleGrowth = wcstoll(argv[++i], nullptr, 10); }
+            else if (arg == L"--max-thread-growth") { options.maxThreadGrowth = wcstoll(argv[++i], nullptr, 10); }
+            else if (arg == L"--max-gui-growth") { options.maxGuiGrowth = wcstoll(argv[++i], nullptr, 10); }
+            else if (arg == L"--upload-fail-every") { options.uploadFailEvery = static_cast<uint32_t>(wcstoul(argv[++i], nullptr, 10)); }
+            else if (arg == L"--kernels") { options.kernelIterations = wcstoull(argv[++i], nullptr, 10); }
+            else if (arg == L"--seed") { options.seed = static_cast<uint32_t>(wcstoul(argv[++i], nullptr, 10)); }
+            else {
+                fprintf(stderr, "Unknown option %s\n", ws2s(arg).c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 2;
+    }
+    if (options.kernelIterations != 0) {
+        return RunKernelBench(options.kernelIterations) ? 0 : 1;
+    }
+    if (options.soakEvents != 0 && !options.debounceSet) {
+        options.debounce = Milliseconds(0);
+    }
+
+    init_apartment();
+    RegisterTracing();
+    g_logLevel.store(options.verbose ? LogLevel::Debug : LogLevel::Warning);
+    StartLogger(std::wstring(), true);
+    InitMainLoop();
+
+    printf("media %lld ms, resolve %lld ms (%s), upload %lld ms, discord %lld ms, jitter %lld ms, debounce %lld ms\n\n",
+        static_cast<long long>(options.mediaLatency.count()), static_cast<long long>(options.resolveLatency.count()),
+        options.resolverHits ? "hits" : "misses", static_cast<long long>(options.uploadLatency.count()),
+        static_cast<long long>(options.discordLatency.count()), static_cast<long long>(options.jitter.count()),
+        static_cast<long long>(options.debounce.count()));
+
+    std::vector<std::unique_ptr<ReplayRun>> runs;
+    int exitCode = 0;
+    if (options.soakEvents != 0) {
+        if (!RunSoak(options, runs)) {
+            exitCode = 1;
+        }
+    }
+    else if (!options.tracePath.empty()) {
+        if (!RunTrace("trace", LoadTrace(options.tracePath), options, runs)) {
+            exitCode = 1;
+        }
+    }
+    else {
+        const std::pair<const wchar_t*, Trace (*)()> scenarios[] = {
+            { L"skips", BurstySkipsTrace }, { L"album", AlbumTrace }, { L"sessions", SessionSwitchTrace }, { L"pauses", PauseTrace },
+        };
+        bool ranAny = false;
+        for (auto const& [name, makeTrace] : scenarios) {
+            if (options.scenario == L"all" || options.scenario == name) {
+                RunTrace(ws2s(name), makeTrace(), options, runs);
+                ranAny = true;
+            }
+        }
+        if (!ranAny) {
+            fprintf(stderr, "Unknown scenario %s\n", ws2s(options.scenario).c_str());
+            exitCode = 2;
+        }
+    }
+
+    StopLogger();
+    UnregisterTracing();
+    return exitCode;
+}
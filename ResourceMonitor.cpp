@@ -0,0 +1,70 @@
+﻿/**
+ * @file ResourceMonitor.cpp
+ * @brief Samples memory, handle, GDI/USER object and thread counts of the current process.
+ */
+
+#include "pch.h"
+#include "ResourceMonitor.h"
+
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <cstdio>
+
+#pragma comment(lib, "psapi.lib")
+
+namespace
+{
+    /**
+     * @brief Counts the threads of the current process. There is no direct API, so walk a ToolHelp snapshot.
+     */
+    uint32_t CountThreads()
+    {
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot == INVALID_HANDLE_VALUE) {
+            return 0;
+        }
+
+        DWORD processId = GetCurrentProcessId();
+        uint32_t count = 0;
+        THREADENTRY32 entry{};
+        entry.dwSize = sizeof(entry);
+        for (BOOL found = Thread32First(snapshot, &entry); found; found = Thread32Next(snapshot, &entry)) {
+            if (entry.th32OwnerProcessID == processId) {
+                ++count;
+            }
+        }
+        CloseHandle(snapshot);
+        return count;
+    }
+}
+
+ResourceSample SampleProcessResources()
+{
+    ResourceSample sample;
+    HANDLE process = GetCurrentProcess();
+
+    PROCESS_MEMORY_COUNTERS_EX memory{};
+    memory.cb = sizeof(memory);
+    if (GetProcessMemoryInfo(process, reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory), sizeof(memory))) {
+        sample.privateBytes = memory.PrivateUsage;
+        sample.workingSet = memory.WorkingSetSize;
+    }
+
+    DWORD handles = 0;
+    if (GetProcessHandleCount(process, &handles)) {
+        sample.handleCount = handles;
+    }
+    sample.gdiObjects = GetGuiResources(process, GR_GDIOBJECTS);
+    sample.userObjects = GetGuiResources(process, GR_USEROBJECTS);
+    sample.threadCount = CountThreads();
+    return sample;
+}
+
+std::string FormatResourceSample(const ResourceSample& sample)
+{
+    char line[160];
+    snprintf(line, sizeof(line), "private %llu KB, working set %llu KB, %u handles, %u GDI, %u USER, %u threads",
+        static_cast<unsigned long long>(sample.privateBytes / 1024), static_cast<unsigned long long>(sample.workingSet / 1024),
+        sample.handleCount, sample.gdiObjects, sample.userObjects, sample.threadCount);
+    return line;
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @struct ResourceSample
+ * @brief A snapshot of the resources the process holds, for spotting slow leaks in long sessions.
+ */
+struct ResourceSample {
+    uint64_t privateBytes = 0;  // Committed private memory
+    uint64_t workingSet = 0;
+    uint32_t handleCount = 0;   // Kernel handles
+    uint32_t gdiObjects = 0;
+    uint32_t userObjects = 0;
+    uint32_t threadCount = 0;
+};
+
+/**
+ * @brief Samples the current process. Takes roughly a millisecond, mostly for the thread count.
+ */
+ResourceSample SampleProcessResources();
+
+/**
+ * @brief Formats a sample as a single human-readable line.
+ */
+std::string FormatResourceSample(const ResourceSample& sample);
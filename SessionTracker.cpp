@@ -0,0 +1,198 @@
+﻿/**
+ * @file SessionTracker.cpp
+ * @brief Table of SMTC sessions by app id, with the TIDAL session pinned.
+ */
+
+#include "pch.h"
+#include "SessionTracker.h"
+#include "Log.h"
+#include "StringUtils.h"
+
+#include <vector>
+
+using namespace winrt;
+using namespace Windows::Media::Control;
+
+SessionTracker::SessionTracker(std::function<bool(std::wstring_view appId)> isPinnedApp, Callbacks callbacks)
+    : m_isPinnedApp(std::move(isPinnedApp))
+    , m_callbacks(std::move(callbacks))
+{
+}
+
+void SessionTracker::Attach(GlobalSystemMediaTransportControlsSessionManager const& manager)
+{
+    m_manager = manager;
+    m_manager.SessionsChanged([this](auto&&, auto&&) { Sync(); });
+    Sync();
+}
+
+SessionTracker::Session SessionTracker::PinnedSession() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_sessions.find(m_pinnedAppId);
+    return it != m_sessions.end() ? it->second.session : nullptr;
+}
+
+SessionTracker::PlaybackStatus SessionTracker::LastPlaybackStatus(std::wstring_view appId) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_sessions.find(std::wstring(appId));
+    return it != m_sessions.end() ? it->second.playbackStatus : PlaybackStatus::Closed;
+}
+
+void SessionTracker::Sync()
+{
+    std::unordered_map<std::wstring, std::vector<Session>> current;
+    for (auto const& session : m_manager.GetSessions()) {
+        current[std::wstring(session.SourceAppUserModelId())].push_back(session);
+    }
+
+    std::vector<Entry> removed;
+    bool pinnedChanged = false;
+    size_t tracked = 0;
+    std::wstring pinnedAppId;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        Session previousPinned = nullptr;
+        if (auto it = m_sessions.find(m_pinnedAppId); it != m_sessions.end()) {
+            previousPinned = it->second.session;
+        }
+
+        for (auto it = m_sessions.begin(); it != m_sessions.end();) {
+            auto found = current.find(it->first);
+            bool stillPresent = false;
+            if (found != current.end()) {
+                for (auto const& session : found->second) {
+                    stillPresent |= session == it->second.session;
+                }
+            }
+            if (stillPresent) {
+                current.erase(found);
+                ++it;
+            }
+            else {
+                removed.push_back(std::move(it->second));
+                it = m_sessions.erase(it);
+            }
+        }
+
+        for (auto& [appId, sessions] : current) {
+            // An app with several sessions (e.g. browser tabs) is tracked through its first one.
+            Entry& entry = m_sessions[appId];
+            entry.session = sessions.front();
+            AttachHandlers(appId, entry);
+        }
+
+        // Keep the previously pinned app while it still has a session; otherwise pick a match, preferring one that plays.
+        if (m_sessions.count(m_pinnedAppId) == 0) {
+            m_pinnedAppId.clear();
+            bool pinnedIsPlaying = false;
+            for (auto const& [appId, entry] : m_sessions) {
+                if (!m_isPinnedApp(appId)) {
+                    continue;
+                }
+                bool playing = entry.playbackStatus == PlaybackStatus::Playing;
+                if (m_pinnedAppId.empty() || (playing && !pinnedIsPlaying)) {
+                    m_pinnedAppId = appId;
+                    pinnedIsPlaying = playing;
+                }
+            }
+        }
+
+        Session pinned = nullptr;
+        if (auto it = m_sessions.find(m_pinnedAppId); it != m_sessions.end()) {
+            pinned = it->second.session;
+        }
+        pinnedChanged = pinned != previousPinned;
+        tracked = m_sessions.size();
+        pinnedAppId = m_pinnedAppId;
+    }
+
+    for (auto& entry : removed) {
+        DetachHandlers(entry);
+    }
+
+    LOG_DEBUG("Tracking " << tracked << " media session(s); pinned: "
+        << (pinnedAppId.empty() ? std::string("none") : ws2s(pinnedAppId)));
+    if (pinnedChanged && m_callbacks.pinnedSessionChanged) {
+        m_callbacks.pinnedSessionChanged();
+    }
+}
+
+void SessionTracker::AttachHandlers(std::wstring const& appId, Entry& entry)
+{
+    try {
+        entry.playbackStatus = entry.session.GetPlaybackInfo().PlaybackStatus();
+    }
+    catch (hresult_error const&) {
+        entry.playbackStatus = PlaybackStatus::Closed;
+    }
+
+    entry.mediaPropertiesChangedToken = entry.session.MediaPropertiesChanged([this, appId](auto&& sender, auto&&)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (!IsPinnedLocked(appId, sender)) {
+                    return;
+                }
+            }
+            if (m_callbacks.mediaPropertiesChanged) {
+                m_callbacks.mediaPropertiesChanged();
+            }
+        });
+    entry.timelinePropertiesChangedToken = entry.session.TimelinePropertiesChanged([this, appId](auto&& sender, auto&&)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (!IsPinnedLocked(appId, sender)) {
+                    return;
+                }
+            }
+            if (m_callbacks.timelineChanged) {
+                m_callbacks.timelineChanged(sender);
+            }
+        });
+    entry.playbackInfoChangedToken = entry.session.PlaybackInfoChanged([this, appId](auto&& sender, auto&&)
+        {
+            PlaybackStatus status = PlaybackStatus::Closed;
+            try {
+                status = sender.GetPlaybackInfo().PlaybackStatus();
+            }
+            catch (hresult_error const&) {
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                auto it = m_sessions.find(appId);
+                if (it != m_sessions.end() && it->second.session == sender) {
+                    it->second.playbackStatus = status;
+                }
+                if (!IsPinnedLocked(appId, sender)) {
+                    return;
+                }
+            }
+            if (m_callbacks.timelineChanged) {
+                m_callbacks.timelineChanged(sender);
+            }
+        });
+}
+
+void SessionTracker::DetachHandlers(Entry& entry)
+{
+    try {
+        entry.session.MediaPropertiesChanged(entry.mediaPropertiesChangedToken);
+        entry.session.TimelinePropertiesChanged(entry.timelinePropertiesChangedToken);
+        entry.session.PlaybackInfoChanged(entry.playbackInfoChangedToken);
+    }
+    catch (hresult_error const&) {
+        // The owning app may already be gone; its events went with it.
+    }
+}
+
+bool SessionTracker::IsPinnedLocked(std::wstring const& appId, Session const& sender) const
+{
+    if (appId != m_pinnedAppId) {
+        return false;
+    }
+    auto it = m_sessions.find(appId);
+    return it != m_sessions.end() && it->second.session == sender;
+}
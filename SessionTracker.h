@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <winrt/Windows.Media.Control.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @class SessionTracker
+ * @brief Follows every SMTC session and keeps the TIDAL session pinned regardless of which app is current.
+ *
+ * Following GetCurrentSession() meant that a browser tab or game briefly taking focus tore down the
+ * handlers, cleared the presence and forced every cover to be uploaded again when TIDAL came back.
+ * The tracker instead mirrors GetSessions() in a table keyed by SourceAppUserModelId, with handlers
+ * on each session, and only reports a change when the pinned session itself appears or goes away.
+ *
+ * Callbacks are invoked on the SMTC event threads, outside the tracker's lock.
+ */
+class SessionTracker {
+public:
+    using Session = winrt::Windows::Media::Control::GlobalSystemMediaTransportControlsSession;
+    using PlaybackStatus = winrt::Windows::Media::Control::GlobalSystemMediaTransportControlsSessionPlaybackStatus;
+
+    struct Callbacks {
+        std::function<void()>                 pinnedSessionChanged;     // The pinned session appeared, went away or was replaced
+        std::function<void()>                 mediaPropertiesChanged;   // The pinned session changed tracks
+        std::function<void(Session const&)>   timelineChanged;          // The pinned session's timeline or playback status changed
+    };
+
+    /**
+     * @param isPinnedApp Returns whether a session with the given app id should be pinned.
+     * @param callbacks Handlers for events of the pinned session.
+     */
+    SessionTracker(std::function<bool(std::wstring_view appId)> isPinnedApp, Callbacks callbacks);
+
+    /**
+     * @brief Starts tracking the manager's sessions. Call once.
+     */
+    void Attach(winrt::Windows::Media::Control::GlobalSystemMediaTransportControlsSessionManager const& manager);
+
+    /**
+     * @brief Returns the pinned session, or nullptr if no matching app has a session.
+     */
+    Session PinnedSession() const;
+
+    /**
+     * @brief Returns the last playback status reported by the session of the given app.
+     */
+    PlaybackStatus LastPlaybackStatus(std::wstring_view appId) const;
+
+private:
+    struct Entry {
+        Session             session = nullptr;
+        winrt::event_token  mediaPropertiesChangedToken;
+        winrt::event_token  timelinePropertiesChangedToken;
+        winrt::event_token  playbackInfoChangedToken;
+        PlaybackStatus      playbackStatus = PlaybackStatus::Closed;  // Cached from PlaybackInfoChanged
+    };
+
+    void Sync();
+    void AttachHandlers(std::wstring const& appId, Entry& entry);
+    static void DetachHandlers(Entry& entry);
+
+    /**
+     * @brief Returns whether an event from the given sender came from the pinned session. Caller holds m_lock.
+     */
+    bool IsPinnedLocked(std::wstring const& appId, Session const& sender) const;
+
+    std::function<bool(std::wstring_view)>    m_isPinnedApp;
+    Callbacks                                   m_callbacks;
+    winrt::Windows::Media::Control::GlobalSystemMediaTransportControlsSessionManager m_manager = nullptr;
+
+    mutable std::mutex                          m_lock;
+    std::unordered_map<std::wstring, Entry>     m_sessions;  // By SourceAppUserModelId
+    std::wstring                                m_pinnedAppId;
+};
@@ -0,0 +1,75 @@
+﻿/**
+ * @file Settings.cpp
+ * @brief Loads user-tunable options from an INI file in the per-user data directory.
+ */
+
+#include "pch.h"
+#include "Settings.h"
+
+#include <shlobj.h>
+#include <algorithm>
+
+#pragma comment(lib, "Shell32.lib")
+#pragma comment(lib, "Ole32.lib")
+
+Settings g_settings;
+
+namespace
+{
+    /**
+     * @brief Reads an unsigned integer from the INI file and clamps it to [minValue, maxValue].
+     */
+    uint32_t ReadUInt(const std::wstring& iniPath, const wchar_t* section, const wchar_t* key, uint32_t defaultValue, uint32_t minValue, uint32_t maxValue)
+    {
+        UINT value = GetPrivateProfileIntW(section, key, defaultValue, iniPath.c_str());
+        return (std::clamp)(static_cast<uint32_t>(value), minValue, maxValue);
+    }
+
+    /**
+     * @brief Reads a string from the INI file, trimmed of surrounding whitespace.
+     */
+    std::wstring ReadString(const std::wstring& iniPath, const wchar_t* section, const wchar_t* key, const std::wstring& defaultValue)
+    {
+        wchar_t value[512];
+        GetPrivateProfileStringW(section, key, defaultValue.c_str(), value, ARRAYSIZE(value), iniPath.c_str());
+
+        std::wstring text(value);
+        size_t first = text.find_first_not_of(L" \t");
+        size_t last = text.find_last_not_of(L" \t");
+        return first == std::wstring::npos ? std::wstring() : text.substr(first, last - first + 1);
+    }
+}
+
+std::wstring GetAppDataDirectory()
+{
+    PWSTR localAppData = nullptr;
+    if (FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_CREATE, nullptr, &localAppData))) {
+        return std::wstring();
+    }
+    std::wstring directory = std::wstring(localAppData) + L"\\tidal-rpc";
+    CoTaskMemFree(localAppData);
+
+    CreateDirectoryW(directory.c_str(), nullptr);
+    return directory;
+}
+
+void LoadSettings()
+{
+    std::wstring directory = GetAppDataDirectory();
+    if (directory.empty()) {
+        return;
+    }
+    std::wstring iniPath = directory + L"\\settings.ini";
+
+    Settings settings;
+    settings.coverMaxPixels = ReadUInt(iniPath, L"Cover", L"MaxPixels", settings.coverMaxPixels, 0, 4096);
+    settings.coverJpegQuality = ReadUInt(iniPath, L"Cover", L"JpegQuality", settings.coverJpegQuality, 1, 100);
+    settings.debounceMs = ReadUInt(iniPath, L"Pipeline", L"DebounceMs", settings.debounceMs, 0, 5000);
+    settings.idleTimeoutSec = ReadUInt(iniPath, L"Power", L"IdleTimeoutSec", settings.idleTimeoutSec, 0, 86400);
+    settings.tidalToken = ReadString(iniPath, L"Resolver", L"TidalToken", settings.tidalToken);
+    settings.tidalCountryCode = ReadString(iniPath, L"Resolver", L"CountryCode", settings.tidalCountryCode);
+    settings.logLevel = ParseLogLevel(ReadString(iniPath, L"Log", L"Level", L"info"), settings.logLevel);
+    settings.logToFile = ReadUInt(iniPath, L"Log", L"File", settings.logToFile ? 1 : 0, 0, 1) != 0;
+    settings.freeConsoleOnHide = ReadUInt(iniPath, L"Log", L"FreeConsoleOnHide", settings.freeConsoleOnHide ? 1 : 0, 0, 1) != 0;
+    g_settings = settings;
+}
@@ -0,0 +1,47 @@
+﻿#pragma once
+
+#include "Log.h"
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @struct Settings
+ * @brief User-tunable options, read from %LOCALAPPDATA%\tidal-rpc\settings.ini at startup.
+ *
+ * Every field has a sensible default, so the file is optional and only needs to list the keys a
+ * user wants to change.
+ */
+struct Settings {
+    // [Cover]
+    uint32_t coverMaxPixels = 512;   // Longest edge of the re-encoded cover; 0 uploads the original bytes
+    uint32_t coverJpegQuality = 85;  // JPEG quality of the re-encoded cover, 1-100
+
+    // [Pipeline]
+    uint32_t debounceMs = 300;       // How long SMTC events are coalesced before a track is parsed
+
+    // [Power]
+    uint32_t idleTimeoutSec = 300;   // How long playback stays paused or stopped before going idle; 0 never idles
+
+    // [Resolver]
+    std::wstring tidalToken;                // x-tidal-token for api.tidal.com lookups; empty disables the resolver
+    std::wstring tidalCountryCode = L"US";  // Catalog the lookups search in
+
+    // [Log]
+    LogLevel logLevel = LogLevel::Info;     // Initial level; can be changed from the tray menu
+    bool     logToFile = true;              // Also append to tidal-rpc.log in the data directory
+    bool     freeConsoleOnHide = false;     // Free the debug console when it is hidden instead of keeping it around
+};
+
+extern Settings g_settings;
+
+/**
+ * @brief Returns the per-user data directory (%LOCALAPPDATA%\tidal-rpc), creating it if needed.
+ * @return The directory path without a trailing backslash, or an empty string if it is unavailable.
+ */
+std::wstring GetAppDataDirectory();
+
+/**
+ * @brief Loads g_settings from settings.ini, clamping every value to its valid range.
+ */
+void LoadSettings();
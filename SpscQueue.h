@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#pragma warning(push)
+#pragma warning(disable: 4324) // Padding from alignas is the point
+
+/**
+ * @class SpscQueue
+ * @brief Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ *
+ * Each side owns one index and keeps a cached copy of the other's, so in the common case a push or
+ * pop touches only its own cache line and no atomic read-modify-write is ever needed.
+ * @tparam T The element type; it must be default-constructible and movable.
+ * @tparam Capacity The number of slots. Must be a power of two.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /**
+     * @brief Appends a value. Producer thread only.
+     * @return false if the queue is full; the value is left untouched.
+     */
+    bool TryPush(T&& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == Capacity) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == Capacity) {
+                return false;
+            }
+        }
+        m_slots[tail & (Capacity - 1)] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest value. Consumer thread only.
+     * @return false if the queue is empty.
+     */
+    bool TryPop(T& value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache) {
+                return false;
+            }
+        }
+        T& slot = m_slots[head & (Capacity - 1)];
+        value = std::move(slot);
+        slot = T{}; // Don't keep the moved-from value's resources alive until the slot is reused
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> m_head{ 0 };     // Written by the consumer
+    size_t                          m_tailCache = 0; // Consumer's copy of m_tail
+    alignas(64) std::atomic<size_t> m_tail{ 0 };     // Written by the producer
+    size_t                          m_headCache = 0; // Producer's copy of m_head
+    alignas(64) std::array<T, Capacity> m_slots{};
+};
+#pragma warning(pop)
@@ -0,0 +1,68 @@
+﻿/**
+ * @file StartupTiming.cpp
+ * @brief Milestone timestamps for cold-start measurements.
+ */
+
+#include "pch.h"
+#include "StartupTiming.h"
+
+#include <cstdio>
+#include <mutex>
+
+namespace
+{
+    std::mutex                                      g_marksLock;
+    std::vector<std::pair<std::string, double>>     g_marks;
+
+    uint64_t FileTimeTicks(const FILETIME& time)
+    {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    }
+
+    /**
+     * @brief Returns when the process was created, in 100 ns FILETIME ticks.
+     */
+    uint64_t ProcessCreationTicks()
+    {
+        static const uint64_t creation = [] {
+            FILETIME creationTime{}, exitTime{}, kernelTime{}, userTime{};
+            if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+                GetSystemTimeAsFileTime(&creationTime);
+            }
+            return FileTimeTicks(creationTime);
+        }();
+        return creation;
+    }
+}
+
+void MarkStartup(const char* milestone)
+{
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    double elapsedMs = static_cast<double>(FileTimeTicks(now) - ProcessCreationTicks()) / 10000.0;
+
+    std::lock_guard<std::mutex> lock(g_marksLock);
+    for (auto const& [name, time] : g_marks) {
+        if (name == milestone) {
+            return;
+        }
+    }
+    g_marks.emplace_back(milestone, elapsedMs);
+}
+
+std::vector<std::pair<std::string, double>> GetStartupMarks()
+{
+    std::lock_guard<std::mutex> lock(g_marksLock);
+    return g_marks;
+}
+
+std::string FormatStartupMarks()
+{
+    std::string text;
+    char entry[96];
+    for (auto const& [name, time] : GetStartupMarks()) {
+        snprintf(entry, sizeof(entry), "%s%s %.1f ms", text.empty() ? "" : ", ", name.c_str(), time);
+        text += entry;
+    }
+    return text;
+}
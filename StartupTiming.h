@@ -0,0 +1,25 @@
+﻿#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Records that startup reached a milestone, timed from the creation of the process.
+ *
+ * Timing from process creation rather than from wWinMain includes the loader's work on imports
+ * and static initializers, which is what a user waiting for the tray icon actually sees. Safe to
+ * call from any thread; only the first mark of each milestone counts.
+ * @param milestone A short, static description such as "tray icon shown".
+ */
+void MarkStartup(const char* milestone);
+
+/**
+ * @brief Returns every milestone reached so far with its time in milliseconds, in the order reached.
+ */
+std::vector<std::pair<std::string, double>> GetStartupMarks();
+
+/**
+ * @brief Formats the milestones as a single line, e.g. "wWinMain 21.4 ms, tray icon shown 38.0 ms".
+ */
+std::string FormatStartupMarks();
@@ -0,0 +1,233 @@
+﻿/**
+ * @file Stats.cpp
+ * @brief Fixed-bucket latency histograms and counters for the track-change pipeline.
+ *
+ * Each histogram has 4 sub-buckets per power of two of microseconds, so every bucket is at most
+ * 25% wide and recording a sample is a bit scan plus one relaxed atomic increment. Percentiles are
+ * read from the bucket counts, which is accurate enough to tell a 300 ms stage from a 400 ms one.
+ */
+
+#include "pch.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <intrin.h>
+
+namespace
+{
+    constexpr uint32_t SUB_BUCKET_BITS = 2;                      // 4 sub-buckets per power of two
+    constexpr uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    constexpr uint32_t MAX_EXPONENT = 40;                        // ~12 days in microseconds
+    constexpr uint32_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    constexpr const char* STAGE_NAMES[] = {
+        "debounce", "media_properties", "thumbnail_open", "thumbnail_read", "hash_lookup",
+        "perceptual_hash", "resolve", "recompress", "upload", "presence_callback", "end_to_end",
+        "discord_recovery",
+    };
+    constexpr const char* COUNTER_NAMES[] = {
+        "media_events", "duplicate_events", "superseded_parses", "cover_cache_hits",
+        "cover_cache_misses", "album_index_hits", "perceptual_hits", "resolver_hits",
+        "upload_failures", "cancelled_uploads", "cover_refreshes",
+    };
+    static_assert(ARRAYSIZE(STAGE_NAMES) == static_cast<size_t>(Stage::Count), "Name every stage");
+    static_assert(ARRAYSIZE(COUNTER_NAMES) == static_cast<size_t>(Counter::Count), "Name every counter");
+
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+        std::atomic<uint64_t>                           count{ 0 };
+        std::atomic<uint64_t>                           maxMicros{ 0 };
+    };
+
+    std::array<Histogram, static_cast<size_t>(Stage::Count)>                g_histograms;
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::Count)>  g_counters{};
+
+    int64_t PerformanceFrequency()
+    {
+        static const int64_t frequency = [] {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency(&value);
+            return value.QuadPart;
+        }();
+        return frequency;
+    }
+
+    uint32_t BucketIndex(uint64_t micros)
+    {
+        if (micros < SUB_BUCKETS) {
+            return static_cast<uint32_t>(micros);
+        }
+        unsigned long exponent = 0;
+        _BitScanReverse64(&exponent, micros);
+        exponent = (std::min)(exponent, static_cast<unsigned long>(MAX_EXPONENT));
+        uint32_t sub = static_cast<uint32_t>(micros >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (std::min)((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub, BUCKET_COUNT - 1);
+    }
+
+    /**
+     * @brief Returns the midpoint of a bucket, in microseconds.
+     */
+    double BucketMidpoint(uint32_t index)
+    {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        uint32_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint32_t sub = index % SUB_BUCKETS;
+        double width = static_cast<double>(1ull << (exponent - SUB_BUCKET_BITS));
+        double lower = (SUB_BUCKETS + sub) * width;
+        return lower + width / 2;
+    }
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+        uint64_t count = 0;
+        uint64_t maxMicros = 0;
+    };
+
+    Snapshot TakeSnapshot(const Histogram& histogram)
+    {
+        Snapshot snapshot;
+        for (uint32_t i = 0; i < BUCKET_COUNT; ++i) {
+            snapshot.buckets[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+            snapshot.count += snapshot.buckets[i];
+        }
+        snapshot.maxMicros = histogram.maxMicros.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    /**
+     * @brief Returns the given percentile in milliseconds, or 0 without samples.
+     */
+    double PercentileMs(const Snapshot& snapshot, double percentile)
+    {
+        if (snapshot.count == 0) {
+            return 0.0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * (snapshot.count - 1)) + 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += snapshot.buckets[i];
+            if (seen >= rank) {
+                return (std::min)(BucketMidpoint(i), static_cast<double>(snapshot.maxMicros)) / 1000.0;
+            }
+        }
+        return snapshot.maxMicros / 1000.0;
+    }
+}
+
+int64_t StatsNow()
+{
+    LARGE_INTEGER value;
+    QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+void RecordStage(Stage stage, int64_t startTicks, int64_t endTicks)
+{
+    if (endTicks == 0) {
+        endTicks = StatsNow();
+    }
+    int64_t elapsed = (std::max)(endTicks - startTicks, int64_t(0));
+    uint64_t micros = static_cast<uint64_t>(elapsed) * 1000000 / static_cast<uint64_t>(PerformanceFrequency());
+
+    Histogram& histogram = g_histograms[static_cast<size_t>(stage)];
+    histogram.buckets[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t previousMax = histogram.maxMicros.load(std::memory_order_relaxed);
+    while (micros > previousMax && !histogram.maxMicros.compare_exchange_weak(previousMax, micros, std::memory_order_relaxed)) {
+    }
+}
+
+void CountEvent(Counter counter, uint64_t amount)
+{
+    g_counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+const char* StageName(Stage stage)
+{
+    return stage < Stage::Count ? STAGE_NAMES[static_cast<size_t>(stage)] : "unknown";
+}
+
+const char* CounterName(Counter counter)
+{
+    return counter < Counter::Count ? COUNTER_NAMES[static_cast<size_t>(counter)] : "unknown";
+}
+
+void ResetStats()
+{
+    for (Histogram& histogram : g_histograms) {
+        for (auto& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.maxMicros.store(0, std::memory_order_relaxed);
+    }
+    for (auto& counter : g_counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::string FormatStatsSummary(const StatsExtras& extras)
+{
+    std::string text = "Stage latency (ms)          n      p50      p95      p99      max\n";
+    char line[160];
+    for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i) {
+        Snapshot snapshot = TakeSnapshot(g_histograms[i]);
+        snprintf(line, sizeof(line), "%-22s %8llu %8.1f %8.1f %8.1f %8.1f\n", STAGE_NAMES[i],
+            static_cast<unsigned long long>(snapshot.count), PercentileMs(snapshot, 50), PercentileMs(snapshot, 95),
+            PercentileMs(snapshot, 99), snapshot.maxMicros / 1000.0);
+        text += line;
+    }
+
+    text += "\nCounters\n";
+    for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i) {
+        snprintf(line, sizeof(line), "%-22s %8llu\n", COUNTER_NAMES[i], static_cast<unsigned long long>(g_counters[i].load()));
+        text += line;
+    }
+    for (auto const& [name, value] : extras) {
+        snprintf(line, sizeof(line), "%-22s %8llu\n", name.c_str(), static_cast<unsigned long long>(value));
+        text += line;
+    }
+    return text;
+}
+
+bool WriteStatsCsv(const std::wstring& path, const StatsExtras& extras)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    file << "kind,name,count,p50_ms,p95_ms,p99_ms,max_ms,buckets\r\n";
+    for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i) {
+        Snapshot snapshot = TakeSnapshot(g_histograms[i]);
+        char line[160];
+        snprintf(line, sizeof(line), "stage,%s,%llu,%.3f,%.3f,%.3f,%.3f,", STAGE_NAMES[i],
+            static_cast<unsigned long long>(snapshot.count), PercentileMs(snapshot, 50), PercentileMs(snapshot, 95),
+            PercentileMs(snapshot, 99), snapshot.maxMicros / 1000.0);
+        file << line;
+
+        // Non-empty buckets as "<midpoint us>:<count>" pairs, so histograms can be re-plotted or diffed.
+        bool first = true;
+        for (uint32_t b = 0; b < BUCKET_COUNT; ++b) {
+            if (snapshot.buckets[b] != 0) {
+                file << (first ? "" : " ") << static_cast<uint64_t>(BucketMidpoint(b)) << ':' << snapshot.buckets[b];
+                first = false;
+            }
+        }
+        file << "\r\n";
+    }
+    for (size_t i = 0; i < static_cast<size_t>(Counter::Count); ++i) {
+        file << "counter," << COUNTER_NAMES[i] << ',' << g_counters[i].load() << ",,,,,\r\n";
+    }
+    for (auto const& [name, value] : extras) {
+        file << "counter," << name << ',' << value << ",,,,,\r\n";
+    }
+    return file.good();
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Stages of the track-change pipeline that get a latency histogram.
+ */
+enum class Stage : uint8_t {
+    Debounce,           // SMTC event arrival -> parse start
+    MediaProperties,    // TryGetMediaPropertiesAsync
+    ThumbnailOpen,      // Thumbnail OpenReadAsync
+    ThumbnailRead,      // Reading the thumbnail stream into the pooled buffer
+    HashLookup,         // Hashing the thumbnail and looking it up in the cover cache
+    PerceptualHash,     // Decoding the thumbnail to a dHash grid and looking it up by similarity
+    Resolve,            // CDN resolver catalog lookup
+    Recompress,         // WIC downscale/re-encode
+    Upload,             // UploadCoverArtAsync
+    PresenceCallback,   // UpdateRichPresence -> its callback
+    EndToEnd,           // SMTC event arrival -> Discord acknowledging the new track
+    DiscordRecovery,    // First failed presence update -> Discord showing the presence again
+    Count
+};
+
+/**
+ * @brief Pipeline events that are only counted.
+ */
+enum class Counter : uint8_t {
+    MediaEvents,        // MediaPropertiesChanged events received
+    DuplicateEvents,    // Parses that found the track already processed
+    SupersededParses,   // Parses cancelled or overtaken by a newer track
+    CoverCacheHits,     // Thumbnail hash found in the cover cache
+    CoverCacheMisses,   // Thumbnail hash not in the cover cache
+    AlbumIndexHits,     // Cover found by album without reading the thumbnail
+    PerceptualHits,     // New thumbnail bytes matched to an uploaded cover that looks the same
+    ResolverHits,       // Cover resolved to TIDAL's CDN
+    UploadFailures,     // Uploads that ended in an error
+    CancelledUploads,   // Uploads aborted because a newer track took over
+    CoverRefreshes,     // Re-uploads of a displayed cover whose URL was about to expire
+    Count
+};
+
+/**
+ * @brief Returns the current QueryPerformanceCounter value, the unit every stage timestamp uses.
+ */
+int64_t StatsNow();
+
+/**
+ * @brief Adds one sample to a stage's histogram. Lock-free; safe from any thread.
+ * @param stage The stage that was timed.
+ * @param startTicks StatsNow() when the stage started.
+ * @param endTicks StatsNow() when it ended; 0 means now.
+ */
+void RecordStage(Stage stage, int64_t startTicks, int64_t endTicks = 0);
+
+/**
+ * @brief Increments a counter. Lock-free; safe from any thread.
+ */
+void CountEvent(Counter counter, uint64_t amount = 1);
+
+/**
+ * @brief Returns the name a stage is reported under, e.g. "hash_lookup".
+ */
+const char* StageName(Stage stage);
+
+/**
+ * @brief Returns the name a counter is reported under, e.g. "cover_cache_hits".
+ */
+const char* CounterName(Counter counter);
+
+/**
+ * @brief Clears every histogram and counter, e.g. between benchmark runs.
+ */
+void ResetStats();
+
+/**
+ * @brief Extra named values from other modules (publisher, scheduler, logger) to include in reports.
+ */
+using StatsExtras = std::vector<std::pair<std::string, uint64_t>>;
+
+/**
+ * @brief Formats count, p50, p95, p99 and max of every stage, then every counter, as human-readable text.
+ */
+std::string FormatStatsSummary(const StatsExtras& extras);
+
+/**
+ * @brief Writes the same data as CSV, including the raw bucket counts, for offline comparison.
+ * @return false if the file could not be written.
+ */
+bool WriteStatsCsv(const std::wstring& path, const StatsExtras& extras);
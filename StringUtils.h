@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Converts a std::wstring (UTF-16) to a std::string (UTF-8).
+ * @param wstr The wide string to convert.
+ * @return The UTF-8 encoded string, suitable for use with libraries like the Discord SDK.
+ */
+inline std::string ws2s(std::wstring_view wstr)
+{
+    if (wstr.empty()) return std::string();
+    int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.data(), (int)wstr.size(), NULL, 0, NULL, NULL);
+    std::string strTo(size_needed, 0);
+    WideCharToMultiByte(CP_UTF8, 0, wstr.data(), (int)wstr.size(), &strTo[0], size_needed, NULL, NULL);
+    return strTo;
+}
+
+/**
+ * @brief Converts a UTF-8 std::string to a std::wstring (UTF-16).
+ * @param str The UTF-8 string to convert.
+ * @return The UTF-16 encoded string, suitable for use with Win32 and WinRT APIs.
+ */
+inline std::wstring s2ws(std::string_view str)
+{
+    if (str.empty()) return std::wstring();
+    int size_needed = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), NULL, 0);
+    std::wstring wstrTo(size_needed, 0);
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &wstrTo[0], size_needed);
+    return wstrTo;
+}
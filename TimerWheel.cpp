@@ -0,0 +1,89 @@
+﻿/**
+ * @file TimerWheel.cpp
+ * @brief Hashed timer wheel for one-shot deadlines on a single thread.
+ */
+
+#include "pch.h"
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel(Clock::duration tick, size_t slotCount)
+    : m_tick(tick > Clock::duration::zero() ? tick : Clock::duration(1))
+    , m_origin(Clock::now())
+    , m_slots(slotCount > 0 ? slotCount : 1)
+{
+}
+
+uint64_t TimerWheel::TickOf(Clock::time_point when) const
+{
+    if (when <= m_origin) {
+        return 0;
+    }
+    // Round up, so a timer never fires before its deadline.
+    return static_cast<uint64_t>((when - m_origin + m_tick - Clock::duration(1)) / m_tick);
+}
+
+uint64_t TimerWheel::Add(Clock::time_point when, Callback callback)
+{
+    uint64_t dueTick = (std::max)(TickOf(when), m_currentTick + 1);
+    size_t slot = static_cast<size_t>(dueTick % m_slots.size());
+
+    uint64_t id = m_nextId++;
+    m_slots[slot].push_back(Timer{ id, dueTick, std::move(callback) });
+    m_slotOf.emplace(id, slot);
+    return id;
+}
+
+void TimerWheel::Cancel(uint64_t id)
+{
+    auto it = m_slotOf.find(id);
+    if (it == m_slotOf.end()) {
+        return;
+    }
+    auto& timers = m_slots[it->second];
+    timers.erase(std::remove_if(timers.begin(), timers.end(), [id](const Timer& timer) { return timer.id == id; }), timers.end());
+    m_slotOf.erase(it);
+}
+
+void TimerWheel::Advance(Clock::time_point now)
+{
+    uint64_t nowTick = TickOf(now);
+    // A pass over every slot covers any gap, so a long stall doesn't mean walking each missed tick.
+    if (nowTick - m_currentTick > m_slots.size()) {
+        m_currentTick = nowTick - m_slots.size();
+    }
+
+    std::vector<Timer> due;
+    while (m_currentTick < nowTick) {
+        ++m_currentTick;
+        auto& timers = m_slots[static_cast<size_t>(m_currentTick % m_slots.size())];
+        auto firstDue = std::stable_partition(timers.begin(), timers.end(),
+            [this](const Timer& timer) { return timer.dueTick > m_currentTick; });
+        for (auto it = firstDue; it != timers.end(); ++it) {
+            m_slotOf.erase(it->id);
+            due.push_back(std::move(*it));
+        }
+        timers.erase(firstDue, timers.end());
+    }
+
+    // Callbacks run after the pass, so the ones that add timers don't land in a slot being walked.
+    for (Timer& timer : due) {
+        timer.callback();
+    }
+}
+
+std::optional<TimerWheel::Clock::time_point> TimerWheel::NextDeadline() const
+{
+    if (m_slotOf.empty()) {
+        return std::nullopt;
+    }
+
+    uint64_t earliest = UINT64_MAX;
+    for (const auto& timers : m_slots) {
+        for (const Timer& timer : timers) {
+            earliest = (std::min)(earliest, timer.dueTick);
+        }
+    }
+    return m_origin + m_tick * static_cast<Clock::rep>(earliest);
+}
@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class TimerWheel
+ * @brief Hashed timer wheel for a handful of one-shot deadlines owned by a single thread.
+ *
+ * Time is cut into fixed ticks and each timer lands in the slot of the tick it is due in, so adding
+ * and cancelling cost O(1) no matter how many timers are pending. Deadlines further out than one
+ * revolution simply stay in their slot for more than one pass. The wheel owns no thread: the owner
+ * calls Advance whenever NextDeadline comes due, typically from a single one-shot timer.
+ *
+ * Not thread-safe; every method must be called on the owning thread.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+
+    /**
+     * @param tick The resolution; timers fire up to one tick late, never early.
+     * @param slotCount The number of slots in one revolution.
+     */
+    TimerWheel(Clock::duration tick, size_t slotCount);
+
+    /**
+     * @brief Adds a one-shot timer.
+     * @param when The earliest time the callback may run. Times in the past fire on the next Advance.
+     * @param callback Runs from inside Advance.
+     * @return An id for Cancel; never 0.
+     */
+    uint64_t Add(Clock::time_point when, Callback callback);
+
+    /**
+     * @brief Cancels a pending timer. Does nothing if it already fired or the id is 0.
+     */
+    void Cancel(uint64_t id);
+
+    /**
+     * @brief Runs every timer that is due by now, in deadline order by tick.
+     *
+     * Callbacks may add and cancel timers; timers they add fire on a later Advance at the earliest.
+     */
+    void Advance(Clock::time_point now);
+
+    /**
+     * @brief When Advance next has work to do, or std::nullopt if no timer is pending.
+     */
+    std::optional<Clock::time_point> NextDeadline() const;
+
+    bool Empty() const { return m_slotOf.empty(); }
+
+private:
+    struct Timer {
+        uint64_t    id;
+        uint64_t    dueTick;    // Absolute tick number, counted from m_origin
+        Callback    callback;
+    };
+
+    uint64_t TickOf(Clock::time_point when) const;
+
+    Clock::duration                     m_tick;
+    Clock::time_point                   m_origin;
+    uint64_t                            m_currentTick = 0;  // Every tick up to here has been processed
+    uint64_t                            m_nextId = 1;
+    std::vector<std::vector<Timer>>     m_slots;
+    std::unordered_map<uint64_t, size_t> m_slotOf;          // Pending timer id -> slot index
+};
@@ -0,0 +1,171 @@
+﻿/**
+ * @file Tracing.cpp
+ * @brief The TidalRpc TraceLogging provider and its pipeline events.
+ *
+ * Activity IDs are derived from the generation rather than allocated, so the Start and Stop of a
+ * stage find each other without any state being kept between them: the parse of generation g is
+ * {g, kind 0}, each of its stages {g, kind 1 + stage}, and upload request n {g, kind 0x100 + n}.
+ */
+
+#include "pch.h"
+#include "Tracing.h"
+
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+// Name-derived GUID (the EventSource hashing convention), so "*TidalRpc" enables the provider:
+// {6e19d2d2-0d5b-5cc6-c934-f463baa1cc8e}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_traceProvider,
+    "TidalRpc",
+    (0x6e19d2d2, 0x0d5b, 0x5cc6, 0xc9, 0x34, 0xf4, 0x63, 0xba, 0xa1, 0xcc, 0x8e));
+
+namespace
+{
+    constexpr uint16_t PARSE_KIND = 0;
+    constexpr uint16_t STAGE_KIND = 1;          // Plus the stage
+    constexpr uint16_t UPLOAD_KIND = 0x100;     // Plus the attempt number
+
+    GUID ActivityId(uint64_t generation, uint16_t kind)
+    {
+        // Data4 is constant, so these never collide with the random IDs other providers use.
+        return GUID{ static_cast<unsigned long>(generation), static_cast<unsigned short>(generation >> 32), kind,
+            { 'T', 'i', 'd', 'a', 'l', 'R', 'p', 'c' } };
+    }
+
+    bool Enabled()
+    {
+        return TraceLoggingProviderEnabled(g_traceProvider, 0, 0);
+    }
+}
+
+void RegisterTracing()
+{
+    TraceLoggingRegister(g_traceProvider);
+}
+
+void UnregisterTracing()
+{
+    TraceLoggingUnregister(g_traceProvider);
+}
+
+void TraceStageStart(Stage stage, uint64_t generation)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, STAGE_KIND + static_cast<uint16_t>(stage));
+    GUID parse = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "Stage", &activity, &parse,
+        TraceLoggingOpcode(WINEVENT_OPCODE_START),
+        TraceLoggingString(StageName(stage), "Stage"),
+        TraceLoggingUInt64(generation, "Generation"));
+}
+
+void TraceStageStop(Stage stage, uint64_t generation, bool completed)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, STAGE_KIND + static_cast<uint16_t>(stage));
+    TraceLoggingWriteActivity(g_traceProvider, "Stage", &activity, nullptr,
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+        TraceLoggingString(StageName(stage), "Stage"),
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingBool(completed, "Completed"));
+}
+
+void TraceParseStart(uint64_t generation, bool force)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "Parse", &activity, nullptr,
+        TraceLoggingOpcode(WINEVENT_OPCODE_START),
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingBool(force, "Force"));
+}
+
+void TraceParseStop(uint64_t generation, const char* outcome)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "Parse", &activity, nullptr,
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingString(outcome, "Outcome"));
+}
+
+void TraceUploadAttemptStart(uint64_t generation, uint32_t attempt, const wchar_t* host)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, static_cast<uint16_t>(UPLOAD_KIND + attempt));
+    GUID parse = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "UploadAttempt", &activity, &parse,
+        TraceLoggingOpcode(WINEVENT_OPCODE_START),
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingUInt32(attempt, "Attempt"),
+        TraceLoggingWideString(host, "Host"));
+}
+
+void TraceUploadAttemptStop(uint64_t generation, uint32_t attempt, const wchar_t* host, const char* outcome)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID activity = ActivityId(generation, static_cast<uint16_t>(UPLOAD_KIND + attempt));
+    TraceLoggingWriteActivity(g_traceProvider, "UploadAttempt", &activity, nullptr,
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingUInt32(attempt, "Attempt"),
+        TraceLoggingWideString(host, "Host"),
+        TraceLoggingString(outcome, "Outcome"));
+}
+
+void TraceCounter(Counter counter, uint64_t generation)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID parse = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "Counter", &parse, nullptr,
+        TraceLoggingString(CounterName(counter), "Counter"),
+        TraceLoggingUInt64(generation, "Generation"));
+}
+
+void TraceDiscordPublish(uint64_t generation, uint64_t fingerprint)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID parse = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "DiscordPublish", &parse, nullptr,
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingHexUInt64(fingerprint, "Fingerprint"));
+}
+
+void TraceDiscordCallback(uint64_t generation, bool accepted, int32_t result)
+{
+    if (!Enabled()) {
+        return;
+    }
+    GUID parse = ActivityId(generation, PARSE_KIND);
+    TraceLoggingWriteActivity(g_traceProvider, "DiscordCallback", &parse, nullptr,
+        TraceLoggingUInt64(generation, "Generation"),
+        TraceLoggingBool(accepted, "Accepted"),
+        TraceLoggingInt32(result, "Result"));
+}
+
+void TraceMainLoopWake(const char* reason)
+{
+    if (!Enabled()) {
+        return;
+    }
+    TraceLoggingWrite(g_traceProvider, "MainLoopWake",
+        TraceLoggingString(reason, "Reason"));
+}
@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include "Stats.h"
+
+#include <cstdint>
+
+/**
+ * @brief ETW TraceLogging events for looking at the pipeline in WPR/WPA next to system-wide activity.
+ *
+ * The provider is called "TidalRpc" and has the GUID derived from that name, so a session can
+ * enable it as "*TidalRpc" (e.g. `tracelog -start tidal -guid *TidalRpc -f tidal.etl`, or a WPR
+ * profile listing it as an EventProvider). Pipeline stages, parses and uploads are written as
+ * Start/Stop activity pairs; everything belonging to one track carries the scheduler generation
+ * that produced it as "Generation", and its stages are related to the parse's activity.
+ *
+ * Every function is callable from any thread and costs one enabled check while no session listens.
+ */
+
+/**
+ * @brief Registers the provider. Call once at startup, before anything is traced.
+ */
+void RegisterTracing();
+
+/**
+ * @brief Unregisters the provider. Call once at shutdown.
+ */
+void UnregisterTracing();
+
+/**
+ * @brief Writes the Start event of a pipeline stage.
+ * @param generation The scheduler generation the stage is running for.
+ */
+void TraceStageStart(Stage stage, uint64_t generation);
+
+/**
+ * @brief Writes the Stop event of a pipeline stage.
+ * @param completed false if the stage was abandoned, e.g. a debounce coalesced into a newer event.
+ */
+void TraceStageStop(Stage stage, uint64_t generation, bool completed = true);
+
+/**
+ * @brief Writes the Start or Stop event of a whole parse.
+ * @param outcome On Stop: "shown", "duplicate", "superseded", "cancelled", "cleared" or "failed".
+ */
+void TraceParseStart(uint64_t generation, bool force);
+void TraceParseStop(uint64_t generation, const char* outcome);
+
+/**
+ * @brief Writes the Start or Stop event of one upload request to one host.
+ * @param attempt Numbers the requests of one upload, including hedges and retries, from 0.
+ * @param outcome On Stop: "won", "failed", "cancelled" or "timed out".
+ */
+void TraceUploadAttemptStart(uint64_t generation, uint32_t attempt, const wchar_t* host);
+void TraceUploadAttemptStop(uint64_t generation, uint32_t attempt, const wchar_t* host, const char* outcome);
+
+/**
+ * @brief Writes a counted pipeline event, such as a cache hit, for the given generation.
+ */
+void TraceCounter(Counter counter, uint64_t generation);
+
+/**
+ * @brief Writes the hand-off of a presence to Discord and the arrival of its callback.
+ * @param generation The generation that produced the track; 0 for clears.
+ * @param result On the callback: the discordpp::ErrorType, 0 on success.
+ */
+void TraceDiscordPublish(uint64_t generation, uint64_t fingerprint);
+void TraceDiscordCallback(uint64_t generation, bool accepted, int32_t result);
+
+/**
+ * @brief Writes a main loop wakeup.
+ * @param reason "messages", "posted work" or "callback timer".
+ */
+void TraceMainLoopWake(const char* reason);
+
+/**
+ * @brief Starts timing a stage for both the stats histograms and the trace.
+ * @return The StatsNow() start stamp to hand to EndStage.
+ */
+inline int64_t BeginStage(Stage stage, uint64_t generation)
+{
+    TraceStageStart(stage, generation);
+    return StatsNow();
+}
+
+/**
+ * @brief Records a stage started with BeginStage in its histogram and writes its Stop event.
+ */
+inline void EndStage(Stage stage, int64_t startTicks, uint64_t generation)
+{
+    RecordStage(stage, startTicks);
+    TraceStageStop(stage, generation);
+}
+
+/**
+ * @brief CountEvent plus TraceCounter, for events that belong to a generation.
+ */
+inline void CountTracedEvent(Counter counter, uint64_t generation)
+{
+    CountEvent(counter);
+    TraceCounter(counter, generation);
+}
@@ -0,0 +1,454 @@
+﻿/**
+ * @file TrackPipeline.cpp
+ * @brief The track-change pipeline: reads the track, finds or uploads its cover, and shows it.
+ */
+
+#include "pch.h"
+#include "TrackPipeline.h"
+#include "CoverImage.h"
+#include "Hash.h"
+#include "Log.h"
+#include "Stats.h"
+#include "StringUtils.h"
+#include "Tracing.h"
+
+#include <DispatcherQueue.h>
+#include <algorithm>
+
+#pragma comment(lib, "CoreMessaging.lib")
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::System;
+
+namespace
+{
+    /**
+     * @struct ParseTrace
+     * @brief Writes a parse's Stop event with its outcome on every way out of the coroutine.
+     */
+    struct ParseTrace {
+        ParseTrace(uint64_t generation, bool force) : generation(generation) { TraceParseStart(generation, force); }
+        ~ParseTrace() { TraceParseStop(generation, outcome); }
+
+        uint64_t    generation;
+        const char* outcome = "failed";
+    };
+}
+
+TrackPipeline::TrackPipeline(IMediaSource& media, ICoverService& covers, IPresenceSink& presence, Options options)
+    : m_media(media)
+    , m_covers(covers)
+    , m_presence(presence)
+    , m_options(options)
+    , m_scheduler([this](uint64_t generation, bool force, int64_t eventTicks) { return Parse(generation, force, eventTicks); })
+    , m_coverCache(options.coverCacheCapacity, options.coverStore)
+{
+}
+
+TrackPipeline::~TrackPipeline()
+{
+    if (m_workerController) {
+        m_workerController.ShutdownQueueAsync();
+    }
+}
+
+/**
+ * @brief Returns the worker thread's queue, starting the thread on first use.
+ *
+ * Started lazily rather than in the constructor, which may run before the process has a COM apartment.
+ */
+DispatcherQueue TrackPipeline::Worker()
+{
+    std::call_once(m_workerStarted, [this] {
+        DispatcherQueueOptions options{ sizeof(DispatcherQueueOptions), DQTYPE_THREAD_DEDICATED, DQTAT_COM_STA };
+        check_hresult(CreateDispatcherQueueController(options,
+            reinterpret_cast<ABI::Windows::System::IDispatcherQueueController**>(put_abi(m_workerController))));
+        m_worker = m_workerController.DispatcherQueue();
+
+        m_refreshTimer = m_worker.CreateTimer();
+        m_refreshTimer.IsRepeating(false);
+        m_refreshTimer.Tick([this](auto&&, auto&&) {
+            m_refreshWheel.Advance(TimerWheel::Clock::now());
+            ArmRefreshTimer();
+            });
+        });
+    return m_worker;
+}
+
+/**
+ * @brief Picks the expiry to request for a new upload.
+ * @param remaining How much of the track is left to play; 0 if unknown.
+ */
+std::chrono::system_clock::duration TrackPipeline::CoverUrlLifetime(std::chrono::milliseconds remaining) const
+{
+    if (remaining <= std::chrono::milliseconds::zero()) {
+        return m_options.coverUrlLifetime;
+    }
+    // Outlive the track by enough that the next track from the same album can still reuse the URL.
+    // Whatever plays longer than that (a long mix, a pause) is covered by the refresh.
+    return std::clamp<std::chrono::system_clock::duration>(remaining + 2 * m_options.coverUrlMinRemaining,
+        m_options.coverUrlMinLifetime, m_options.coverUrlMaxLifetime);
+}
+
+/**
+ * @brief Shows a track and remembers it as the current presence. Worker thread only.
+ *
+ * Drops the pending cover refresh; the caller schedules a new one if the track's cover expires.
+ * Does nothing while suspended.
+ */
+void TrackPipeline::Show(const TrackSnapshot& track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation)
+{
+    if (m_suspended.load()) {
+        return;
+    }
+    m_shownFingerprint = track.Fingerprint();
+    m_shownMetadata = track.MetadataFingerprint();
+    m_refreshWheel.Cancel(std::exchange(m_refreshTimerId, 0));
+    ArmRefreshTimer();
+    m_presence.Show(track, timeline, eventTicks, generation);
+}
+
+/**
+ * @brief Clears the presence and drops the pending cover refresh. Worker thread only.
+ */
+void TrackPipeline::Clear()
+{
+    m_shownFingerprint = 0;
+    m_shownMetadata = 0;
+    m_refreshWheel.Cancel(std::exchange(m_refreshTimerId, 0));
+    ArmRefreshTimer();
+    m_presence.Clear();
+}
+
+/**
+ * @brief Re-uploads the shown track's cover shortly before its URL expires. Worker thread only.
+ *
+ * When the timer fires, the refresh only goes ahead if the presence still shows this very track
+ * and cover; it then forces a reparse, whose cache lookups no longer accept the dying URL.
+ * @param track The track that was just shown.
+ * @param expires The expiry that was requested for its cover URL.
+ */
+void TrackPipeline::ScheduleCoverRefresh(const TrackSnapshot& track, std::chrono::system_clock::time_point expires)
+{
+    if (m_suspended.load()) {
+        return;
+    }
+    auto delay = expires - std::chrono::system_clock::now() - m_options.coverUrlRefreshLead;
+    uint64_t fingerprint = track.Fingerprint();
+
+    m_refreshWheel.Cancel(m_refreshTimerId);
+    m_refreshTimerId = m_refreshWheel.Add(TimerWheel::Clock::now() + std::chrono::duration_cast<TimerWheel::Clock::duration>(delay),
+        [this, fingerprint, title = std::string(track.Title())] {
+            m_refreshTimerId = 0;
+            if (fingerprint != m_shownFingerprint) {
+                return;
+            }
+            CountEvent(Counter::CoverRefreshes);
+            LOG_INFO("Cover art URL for '" << title << "' is about to expire. Uploading it again...");
+            m_scheduler.ScheduleNow(true);
+        });
+    ArmRefreshTimer();
+}
+
+/**
+ * @brief Points m_refreshTimer at the wheel's next deadline, or stops it if nothing is pending.
+ */
+void TrackPipeline::ArmRefreshTimer()
+{
+    m_refreshTimer.Stop();
+    std::optional<TimerWheel::Clock::time_point> deadline = m_refreshWheel.NextDeadline();
+    if (!deadline) {
+        return;
+    }
+    auto delay = (std::max)(*deadline - TimerWheel::Clock::now(), TimerWheel::Clock::duration::zero());
+    m_refreshTimer.Interval(std::chrono::duration_cast<TimeSpan>(delay));
+    m_refreshTimer.Start();
+}
+
+void TrackPipeline::SetDebounce(std::chrono::milliseconds debounce)
+{
+    m_scheduler.SetDebounce(debounce);
+}
+
+void TrackPipeline::SetRecompression(uint32_t maxPixels, uint32_t jpegQuality)
+{
+    m_coverMaxPixels.store(maxPixels);
+    m_coverJpegQuality.store(jpegQuality);
+}
+
+void TrackPipeline::Schedule(bool force)
+{
+    if (m_suspended.load()) {
+        return;
+    }
+    m_scheduler.Schedule(force);
+}
+
+void TrackPipeline::ScheduleNow(bool force)
+{
+    m_scheduler.ScheduleNow(force);
+}
+
+void TrackPipeline::ForgetLastTrack()
+{
+    // Queued ahead of whatever parse the caller schedules next, so that parse sees it.
+    Worker().TryEnqueue([this] { m_lastTrackProcessed = 0; });
+}
+
+void TrackPipeline::Suspend()
+{
+    if (m_suspended.exchange(true)) {
+        return;
+    }
+    Worker().TryEnqueue([this] {
+        m_lastTrackProcessed = 0;
+        m_shownFingerprint = 0;
+        m_shownMetadata = 0;
+        m_refreshWheel.Cancel(std::exchange(m_refreshTimerId, 0));
+        ArmRefreshTimer();
+        m_thumbnailBuffers.Trim();
+        });
+}
+
+void TrackPipeline::Resume()
+{
+    if (m_suspended.exchange(false)) {
+        ScheduleNow(true);
+    }
+}
+
+/**
+ * @brief Reads the current track, resolves its cover art, and shows it.
+ *
+ * Runs are started by m_scheduler. Once a run knows its track it claims the presence for its
+ * generation; a newer track cancels it, which also cancels whatever it is awaiting at the time.
+ * Everything after the first hop runs on the worker thread.
+ * @param generation The scheduler generation this run belongs to.
+ * @param force Process the track even if it was already processed.
+ * @param eventTicks StatsNow() of the SMTC event that started this run.
+ */
+IAsyncAction TrackPipeline::Parse(uint64_t generation, bool force, int64_t eventTicks)
+{
+    auto cancellation = co_await get_cancellation_token();
+    cancellation.enable_propagation();
+
+    co_await resume_foreground(Worker());
+
+    ParseTrace trace(generation, force);
+    bool uploading = false; // Whether a cancellation interrupted an upload
+    try {
+        MediaSnapshot snapshot;
+        int64_t stageTicks = BeginStage(Stage::MediaProperties, generation);
+        bool hasSession = co_await m_media.ReadAsync(snapshot);
+        EndStage(Stage::MediaProperties, stageTicks, generation);
+
+        if (!hasSession)
+        {
+            if (m_scheduler.Claim(generation, 0, force))
+            {
+                LOG_INFO("No TIDAL media session found. Clearing presence.");
+                Clear();
+                m_lastTrackProcessed = 0;
+            }
+            trace.outcome = "cleared";
+            co_return;
+        }
+
+        TrackSnapshot track = std::move(snapshot.track);
+
+        // *** CACHE CHECK to prevent duplicate processing from spammy events ***
+        if (!force && track.MetadataFingerprint() == m_lastTrackProcessed)
+        {
+            CountTracedEvent(Counter::DuplicateEvents, generation);
+            LOG_DEBUG("Duplicate event for '" << track.Title() << "' ignored.");
+            trace.outcome = "duplicate";
+            co_return;
+        }
+        if (!m_scheduler.Claim(generation, track.MetadataFingerprint(), force))
+        {
+            CountTracedEvent(Counter::DuplicateEvents, generation);
+            LOG_DEBUG("'" << track.Title() << "' is already being processed, ignoring event.");
+            trace.outcome = "duplicate";
+            co_return;
+        }
+
+        bool publishedWithoutCover = false;
+        std::optional<std::chrono::system_clock::time_point> coverExpires; // Unset for covers that never expire
+
+        // *** ALBUM FAST PATH: a known album's cover needs no thumbnail I/O at all ***
+        uint64_t albumKey = track.AlbumKey();
+        if (auto resolvedUrl = m_covers.Lookup(albumKey))
+        {
+            track = track.WithCoverArt(*resolvedUrl);
+            CountTracedEvent(Counter::ResolverHits, generation);
+            LOG_INFO("Cover art for album '" << track.Album() << "' resolved from TIDAL's CDN: " << track.CoverArtUrl());
+        }
+        else if (auto albumHit = m_coverCache.LookupAlbum(albumKey, m_options.coverUrlMinRemaining))
+        {
+            track = track.WithCoverArt(albumHit->url);
+            coverExpires = albumHit->expires;
+            CountTracedEvent(Counter::AlbumIndexHits, generation);
+            LOG_INFO("Cover art for album '" << track.Album() << "' already uploaded: " << track.CoverArtUrl());
+        }
+        else
+        {
+            // *** PHASE 1: show the metadata right away; the cover follows once it is resolved ***
+            // A track that is already shown (a cover refresh, Force Update) keeps its old cover until then.
+            if (track.MetadataFingerprint() != m_shownMetadata) {
+                Show(track, snapshot.timeline, eventTicks, generation);
+                publishedWithoutCover = true;
+            }
+
+            // *** CDN RESOLVER: TIDAL's own cover URL needs no upload and never expires ***
+            stageTicks = BeginStage(Stage::Resolve, generation);
+            hstring resolvedUrl = co_await m_covers.ResolveAsync(track);
+            EndStage(Stage::Resolve, stageTicks, generation);
+            if (!resolvedUrl.empty())
+            {
+                track = track.WithCoverArt(resolvedUrl);
+                CountTracedEvent(Counter::ResolverHits, generation);
+                LOG_INFO("Resolved cover art for '" << track.Title() << "' from TIDAL's CDN: " << track.CoverArtUrl());
+            }
+            else if (snapshot.thumbnail)
+            {
+                stageTicks = BeginStage(Stage::ThumbnailOpen, generation);
+                auto stream = co_await snapshot.thumbnail.OpenReadAsync();
+                EndStage(Stage::ThumbnailOpen, stageTicks, generation);
+                uint64_t streamSize = stream ? stream.Size() : 0;
+                if (streamSize > 0 && streamSize <= m_options.maxThumbnailBytes)
+                {
+                    // Read the stream once, straight into a pooled buffer that is reused across tracks.
+                    auto coverBuffer = m_thumbnailBuffers.Acquire(static_cast<uint32_t>(streamSize));
+                    stageTicks = BeginStage(Stage::ThumbnailRead, generation);
+                    uint32_t numBytesLoaded = co_await ReadStreamIntoAsync(stream, coverBuffer.data(), static_cast<uint32_t>(streamSize));
+                    EndStage(Stage::ThumbnailRead, stageTicks, generation);
+
+                    if (numBytesLoaded > 0)
+                    {
+                        array_view<uint8_t const> coverBytes(coverBuffer.data(), coverBuffer.data() + numBytesLoaded);
+                        stageTicks = BeginStage(Stage::HashLookup, generation);
+                        uint64_t contentHash = HashBytes(coverBytes.data(), coverBytes.size());
+                        auto cachedHit = m_coverCache.Lookup(contentHash, m_options.coverUrlMinRemaining);
+                        EndStage(Stage::HashLookup, stageTicks, generation);
+                        CountTracedEvent(cachedHit ? Counter::CoverCacheHits : Counter::CoverCacheMisses, generation);
+                        if (cachedHit)
+                        {
+                            track = track.WithCoverArt(cachedHit->url);
+                            coverExpires = cachedHit->expires;
+                            m_coverCache.LinkAlbum(albumKey, contentHash);
+                            LOG_INFO("Cover art for '" << track.Title() << "' already uploaded: " << track.CoverArtUrl());
+                        }
+                        else
+                        {
+                            // New bytes are often the same art re-encoded; look for an upload that looks the same first.
+                            uint64_t perceptualHash = 0;
+                            stageTicks = BeginStage(Stage::PerceptualHash, generation);
+                            std::optional<CoverCache::Hit> similarHit;
+                            if (ComputeCoverPerceptualHash(coverBytes, perceptualHash)) {
+                                similarHit = m_coverCache.LookupSimilar(perceptualHash, m_options.coverSimilarBits, m_options.coverUrlMinRemaining);
+                            }
+                            EndStage(Stage::PerceptualHash, stageTicks, generation);
+                            if (similarHit)
+                            {
+                                CountTracedEvent(Counter::PerceptualHits, generation);
+                                track = track.WithCoverArt(similarHit->url);
+                                coverExpires = similarHit->expires;
+                                m_coverCache.Insert(contentHash, similarHit->url, similarHit->expires, perceptualHash);
+                                m_coverCache.LinkAlbum(albumKey, contentHash);
+                                LOG_INFO("Cover art for '" << track.Title() << "' looks like an uploaded one: " << track.CoverArtUrl());
+                            }
+                            else
+                            {
+                                // Shrink the image before it goes over the wire. The cache key stays the hash of the original bytes.
+                                array_view<uint8_t const> uploadBytes = coverBytes;
+                                BufferPool::Lease recompressedBuffer;
+                                uint32_t recompressedSize = 0;
+                                stageTicks = BeginStage(Stage::Recompress, generation);
+                                bool recompressed = RecompressCover(coverBytes, m_coverMaxPixels.load(), m_coverJpegQuality.load(), m_thumbnailBuffers, recompressedBuffer, recompressedSize);
+                                EndStage(Stage::Recompress, stageTicks, generation);
+                                if (recompressed)
+                                {
+                                    uploadBytes = array_view<uint8_t const>(recompressedBuffer.data(), recompressedBuffer.data() + recompressedSize);
+                                    LOG_INFO("Recompressed cover art from " << coverBytes.size() << " to " << recompressedSize << " bytes.");
+                                }
+
+                                LOG_INFO("Found cover art for '" << track.Title() << "'. Uploading...");
+                                auto expires = std::chrono::system_clock::now() + CoverUrlLifetime(snapshot.remaining);
+                                stageTicks = BeginStage(Stage::Upload, generation);
+                                uploading = true;
+                                hstring uploadedUrl = co_await m_covers.UploadAsync(uploadBytes, expires, generation);
+                                uploading = false;
+                                EndStage(Stage::Upload, stageTicks, generation);
+
+                                if (!uploadedUrl.empty()) {
+                                    std::wstring_view urlView(uploadedUrl.c_str(), uploadedUrl.size());
+                                    if (urlView.find(L"Error:") == std::wstring::npos && urlView.find(L"Exception:") == std::wstring::npos) {
+                                        track = track.WithCoverArt(urlView);
+                                        m_coverCache.Insert(contentHash, std::wstring(urlView), expires, perceptualHash);
+                                        m_coverCache.LinkAlbum(albumKey, contentHash);
+                                        coverExpires = expires;
+                                        LOG_INFO("Upload successful: " << track.CoverArtUrl());
+                                    }
+                                    else {
+                                        CountTracedEvent(Counter::UploadFailures, generation);
+                                        LOG_WARNING("Failed to upload cover art: " << ws2s(uploadedUrl.c_str()));
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    else { LOG_INFO("Cover art stream for '" << track.Title() << "' was empty (0 bytes loaded)."); }
+                }
+                else if (streamSize > m_options.maxThumbnailBytes)
+                {
+                    LOG_WARNING("Cover art for '" << track.Title() << "' is too large (" << streamSize << " bytes). Skipping upload.");
+                }
+            }
+            else
+            {
+                LOG_INFO("No cover art found for '" << track.Title() << "'.");
+            }
+        }
+
+        if (!m_scheduler.IsCurrent(generation))
+        {
+            CountTracedEvent(Counter::SupersededParses, generation);
+            LOG_DEBUG("'" << track.Title() << "' was superseded by a newer track.");
+            trace.outcome = "superseded";
+            co_return;
+        }
+
+        // *** PHASE 2: add the cover art, unless there is nothing new to show ***
+        if (!publishedWithoutCover || !track.CoverArtUrl().empty()) {
+            Show(track, snapshot.timeline, publishedWithoutCover ? 0 : eventTicks, generation);
+            if (coverExpires) {
+                ScheduleCoverRefresh(track, *coverExpires);
+            }
+        }
+
+        // *** UPDATE CACHE with the newly processed track ***
+        m_lastTrackProcessed = track.MetadataFingerprint();
+        trace.outcome = "shown";
+    }
+    catch (hresult_canceled const&)
+    {
+        trace.outcome = "cancelled";
+        // The thumbnail buffers went back to the pool while unwinding; the upload only reads its own copy.
+        CountTracedEvent(Counter::SupersededParses, generation);
+        if (uploading) {
+            CountTracedEvent(Counter::CancelledUploads, generation);
+            LOG_DEBUG("Track processing was cancelled by a newer track; its upload was aborted.");
+        }
+        else {
+            LOG_DEBUG("Track processing was cancelled by a newer track.");
+        }
+    }
+    catch (hresult_error const& ex)
+    {
+        LOG_ERROR("Failed to parse track info: " << ws2s(ex.message().c_str()));
+        if (m_scheduler.IsCurrent(generation)) {
+            m_lastTrackProcessed = 0;
+        }
+    }
+}
@@ -0,0 +1,225 @@
+﻿#pragma once
+
+#include "ByteBuffer.h"
+#include "CoverCache.h"
+#include "PlaybackTimeline.h"
+#include "TimerWheel.h"
+#include "TrackScheduler.h"
+#include "TrackSnapshot.h"
+
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <winrt/Windows.System.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+/**
+ * @struct MediaSnapshot
+ * @brief What one parse reads from the media session: the displayed metadata, the thumbnail, the timeline and how much is left to play.
+ */
+struct MediaSnapshot {
+    TrackSnapshot                                                   track;  // Without cover art
+    winrt::Windows::Storage::Streams::IRandomAccessStreamReference  thumbnail{ nullptr };
+    PlaybackTimeline                                                timeline;       // As read together with the track
+    std::chrono::milliseconds                                       remaining{ 0 }; // Until the track ends at normal speed; 0 if unknown
+};
+
+/**
+ * @class IMediaSource
+ * @brief Where the pipeline reads the current track from: the SMTC session, or a recorded trace.
+ */
+class IMediaSource {
+public:
+    virtual ~IMediaSource() = default;
+
+    /**
+     * @brief Reads the TIDAL session's current track.
+     * @param snapshot Receives the track; it must stay alive until the operation completes.
+     * @return false if there is no TIDAL session, in which case the presence is cleared.
+     */
+    virtual winrt::Windows::Foundation::IAsyncOperation<bool> ReadAsync(MediaSnapshot& snapshot) = 0;
+};
+
+/**
+ * @class ICoverService
+ * @brief The network side of cover art: the CDN resolver and the upload hosts.
+ */
+class ICoverService {
+public:
+    virtual ~ICoverService() = default;
+
+    /**
+     * @brief Returns an already resolved CDN URL for the album without any I/O.
+     */
+    virtual std::optional<std::wstring> Lookup(uint64_t albumKey) = 0;
+
+    /**
+     * @brief Looks the track up in TIDAL's catalog. Returns an empty string on a miss.
+     */
+    virtual winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> ResolveAsync(TrackSnapshot track) = 0;
+
+    /**
+     * @brief Uploads cover bytes. Same contract as UploadCoverArtAsync: a URL, or a message starting with "Error:".
+     *
+     * The bytes only have to outlive the call itself; an implementation that sends them later keeps its own copy.
+     * Cancelling the operation must abort the upload and throw hresult_canceled.
+     * @param generation The scheduler generation the upload is for, to correlate its trace events.
+     */
+    virtual winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> UploadAsync(winrt::array_view<uint8_t const> bytes, std::chrono::system_clock::time_point expires, uint64_t generation) = 0;
+};
+
+/**
+ * @class IPresenceSink
+ * @brief Receives what should be shown in Discord. Both methods are called on the pipeline's worker thread.
+ */
+class IPresenceSink {
+public:
+    virtual ~IPresenceSink() = default;
+
+    /**
+     * @brief Shows a track.
+     * @param timeline The session's timeline when the track was read, so a new track is published with its own progress bar.
+     * @param eventTicks StatsNow() of the SMTC event that produced the track, to time it end to end;
+     *        0 if this update only adds to a track that was already shown.
+     * @param generation The scheduler generation that produced the track, to correlate trace events.
+     */
+    virtual void Show(const TrackSnapshot& track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation) = 0;
+
+    /**
+     * @brief Clears the presence because no TIDAL session is playing.
+     */
+    virtual void Clear() = 0;
+};
+
+/**
+ * @class TrackPipeline
+ * @brief Turns SMTC change events into presence updates: debounce, read, resolve or upload the cover, show.
+ *
+ * Unless the cover is already known, a track is shown twice: once with just the metadata as soon as
+ * it is read, and again with the cover art once it has been resolved. The pipeline only talks to the
+ * outside world through IMediaSource, ICoverService and IPresenceSink, so the same logic runs against
+ * the live SMTC session and Discord client in the app and against recorded traces in the benchmark.
+ *
+ * All pipeline state is owned by one dedicated worker thread, a single-threaded apartment driven by
+ * a DispatcherQueue. Parse hops onto it before touching anything, and because every co_await inside
+ * a parse is on a WinRT async operation, C++/WinRT resumes it in that same apartment afterwards;
+ * nothing the pipeline keeps is ever touched from a threadpool thread. The public methods may be
+ * called from any thread.
+ *
+ * Uploaded cover URLs expire. Each upload asks for a lifetime that covers the rest of the track, and
+ * the worker keeps a timer wheel with the expiry of the URL currently on display: shortly before it
+ * runs out, and only if that cover is still what the presence shows, the track is reparsed, which
+ * finds the cached URL too close to expiry and uploads the cover again.
+ *
+ * A thumbnail whose bytes are new is hashed perceptually before it is uploaded, and if the cache
+ * holds a live upload of a cover that looks the same (the same art at another size or encoding, as
+ * TIDAL serves per release), that URL is reused under the new bytes' hash too.
+ */
+class TrackPipeline {
+public:
+    /**
+     * @struct Options
+     * @brief Sizing, cover URL lifetimes and persistence, fixed for the lifetime of the pipeline.
+     */
+    struct Options {
+        size_t                  coverCacheCapacity = 64;
+        std::chrono::minutes    coverUrlLifetime{ 7 };        // Expiry requested when the track's length is unknown
+        std::chrono::minutes    coverUrlMinRemaining{ 2 };    // Re-upload instead of reusing a URL that dies sooner
+        std::chrono::minutes    coverUrlMinLifetime{ 5 };     // Bounds for the expiry derived from the track's length
+        std::chrono::minutes    coverUrlMaxLifetime{ 60 };
+        std::chrono::minutes    coverUrlRefreshLead{ 1 };     // Re-upload the displayed cover this long before it expires; below coverUrlMinRemaining
+        uint64_t                maxThumbnailBytes = 32 * 1024 * 1024; // Sanity cap for a single cover read
+        CoverStore*             coverStore = nullptr;         // Persists the cover cache across restarts; optional
+        uint32_t                coverSimilarBits = 3;         // Reuse a cover that looks the same if its perceptual hash is this close
+    };
+
+    /**
+     * @param media, covers, presence The pipeline's collaborators; they must outlive it.
+     */
+    TrackPipeline(IMediaSource& media, ICoverService& covers, IPresenceSink& presence, Options options);
+
+    /**
+     * @brief Stops the worker thread. Parses still in flight are abandoned.
+     */
+    ~TrackPipeline();
+
+    /**
+     * @brief Sets the debounce window applied by Schedule.
+     */
+    void SetDebounce(std::chrono::milliseconds debounce);
+
+    /**
+     * @brief Sets how covers are re-encoded before upload. A maxPixels of 0 uploads the original bytes.
+     */
+    void SetRecompression(uint32_t maxPixels, uint32_t jpegQuality);
+
+    /**
+     * @brief Requests a parse after the debounce window (see TrackScheduler::Schedule). Ignored while suspended.
+     */
+    void Schedule(bool force = false);
+
+    /**
+     * @brief Requests a parse without waiting for the debounce window (see TrackScheduler::ScheduleNow).
+     */
+    void ScheduleNow(bool force = false);
+
+    /**
+     * @brief Forgets the last processed track, so the next parse shows it even if it did not change.
+     */
+    void ForgetLastTrack();
+
+    /**
+     * @brief Stops showing and refreshing anything and frees idle buffers, for the app's idle mode.
+     *
+     * SMTC events are ignored until Resume, and a parse still in flight no longer reaches the presence.
+     * The caller clears the presence itself.
+     */
+    void Suspend();
+
+    /**
+     * @brief Undoes Suspend and reparses the current track right away.
+     */
+    void Resume();
+
+    /**
+     * @brief Number of events that were coalesced into a later one without starting a parse.
+     */
+    uint64_t CoalescedCount() const { return m_scheduler.CoalescedCount(); }
+
+private:
+    winrt::Windows::Foundation::IAsyncAction Parse(uint64_t generation, bool force, int64_t eventTicks);
+    winrt::Windows::System::DispatcherQueue Worker();
+    std::chrono::system_clock::duration CoverUrlLifetime(std::chrono::milliseconds remaining) const;
+    void Show(const TrackSnapshot& track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation);
+    void Clear();
+    void ScheduleCoverRefresh(const TrackSnapshot& track, std::chrono::system_clock::time_point expires);
+    void ArmRefreshTimer();
+
+    IMediaSource&           m_media;
+    ICoverService&          m_covers;
+    IPresenceSink&          m_presence;
+    const Options           m_options;
+    std::atomic<uint32_t>   m_coverMaxPixels{ 512 };
+    std::atomic<uint32_t>   m_coverJpegQuality{ 85 };
+    std::atomic<bool>       m_suspended{ false };
+
+    TrackScheduler          m_scheduler;
+    CoverCache              m_coverCache;
+    BufferPool              m_thumbnailBuffers{ 2 };
+    uint64_t                m_lastTrackProcessed = 0;               // MetadataFingerprint; worker thread only
+
+    // Worker thread only: what m_presence currently shows, and the refresh of its cover URL.
+    uint64_t                m_shownFingerprint = 0;                 // Fingerprint of the shown track; 0 if cleared
+    uint64_t                m_shownMetadata = 0;                    // Its MetadataFingerprint
+    TimerWheel              m_refreshWheel{ std::chrono::seconds(1), 256 };
+    uint64_t                m_refreshTimerId = 0;
+
+    std::once_flag                                      m_workerStarted;    // The thread starts with the first parse
+    winrt::Windows::System::DispatcherQueueController   m_workerController{ nullptr };
+    winrt::Windows::System::DispatcherQueue             m_worker{ nullptr };
+    winrt::Windows::System::DispatcherQueueTimer        m_refreshTimer{ nullptr }; // Fires at m_refreshWheel's next deadline
+};
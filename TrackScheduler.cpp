@@ -0,0 +1,113 @@
+﻿/**
+ * @file TrackScheduler.cpp
+ * @brief Coalesces bursts of SMTC events and cancels parses that a newer track has superseded.
+ */
+
+#include "pch.h"
+#include "TrackScheduler.h"
+#include "Stats.h"
+#include "Tracing.h"
+
+#include <vector>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+
+TrackScheduler::TrackScheduler(ParseFunction parse)
+    : m_parse(std::move(parse))
+{
+}
+
+void TrackScheduler::SetDebounce(std::chrono::milliseconds debounce)
+{
+    m_debounceMs.store(debounce.count());
+}
+
+void TrackScheduler::Schedule(bool force)
+{
+    Run(std::chrono::milliseconds(m_debounceMs.load()), force);
+}
+
+void TrackScheduler::ScheduleNow(bool force)
+{
+    Run(std::chrono::milliseconds(0), force);
+}
+
+bool TrackScheduler::Claim(uint64_t generation, uint64_t trackKey, bool force)
+{
+    std::vector<IAsyncAction> superseded;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        if (generation < m_owner) {
+            return false;
+        }
+        if (generation == m_owner) {
+            m_ownerTrackKey = trackKey;
+            return true;
+        }
+        if (!force && trackKey == m_ownerTrackKey && m_running.count(m_owner) != 0) {
+            // A spurious event for the track that is already being processed; let that parse finish.
+            return false;
+        }
+
+        m_owner = generation;
+        m_ownerTrackKey = trackKey;
+        for (auto const& [runningGeneration, action] : m_running) {
+            if (runningGeneration < generation) {
+                superseded.push_back(action);
+            }
+        }
+    }
+
+    for (auto& action : superseded) {
+        action.Cancel();
+    }
+    return true;
+}
+
+bool TrackScheduler::IsCurrent(uint64_t generation) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return generation == m_owner;
+}
+
+fire_and_forget TrackScheduler::Run(std::chrono::milliseconds delay, bool force)
+{
+    uint64_t generation = ++m_latestEvent;
+    int64_t eventTicks = BeginStage(Stage::Debounce, generation);
+    if (force) {
+        m_forcePending = true;
+    }
+
+    if (delay.count() > 0) {
+        co_await resume_after(delay);
+    }
+    else {
+        co_await resume_background();
+    }
+
+    if (generation != m_latestEvent.load()) {
+        // A newer event arrived inside the debounce window; it will read the latest state.
+        ++m_coalesced;
+        TraceStageStop(Stage::Debounce, generation, false);
+        co_return;
+    }
+
+    EndStage(Stage::Debounce, eventTicks, generation);
+    IAsyncAction action = m_parse(generation, m_forcePending.exchange(false), eventTicks);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_running.emplace(generation, action);
+    }
+
+    try {
+        co_await action;
+    }
+    catch (hresult_error const&) {
+        // Cancelled by a newer track, or failed; the parse reports its own errors.
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_running.erase(generation);
+}
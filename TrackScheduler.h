@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/**
+ * @class TrackScheduler
+ * @brief Latest-wins debounce scheduler for SMTC change events.
+ *
+ * Every event bumps a generation counter and waits out the debounce window; only the event that
+ * is still the newest when the window closes starts a parse. A parse that finds a new track claims
+ * the presence for its generation, which cancels every older parse that is still running (and,
+ * through cancellation propagation, the operation it is awaiting, such as an upload).
+ */
+class TrackScheduler {
+public:
+    /**
+     * @brief Starts a parse for the given generation. The action must stop early once cancelled.
+     *
+     * eventTicks is the StatsNow() timestamp of the SMTC event that started the parse.
+     */
+    using ParseFunction = std::function<winrt::Windows::Foundation::IAsyncAction(uint64_t generation, bool force, int64_t eventTicks)>;
+
+    explicit TrackScheduler(ParseFunction parse);
+
+    /**
+     * @brief Sets the debounce window applied by Schedule.
+     */
+    void SetDebounce(std::chrono::milliseconds debounce);
+
+    /**
+     * @brief Requests a parse after the debounce window, coalescing it with any events that follow.
+     * @param force Skip duplicate detection for the parse that eventually runs.
+     */
+    void Schedule(bool force = false);
+
+    /**
+     * @brief Requests a parse without waiting for the debounce window (e.g. from the tray menu).
+     */
+    void ScheduleNow(bool force = false);
+
+    /**
+     * @brief Makes a running parse the owner of the presence, cancelling all older parses.
+     *
+     * Call once the parse knows which track it is working on.
+     * @param generation The generation passed to the parse.
+     * @param trackKey A key identifying the track's displayed metadata.
+     * @param force Claim even if an identical track is already being processed.
+     * @return false if the parse should stop: a newer parse already owns the presence, or an older
+     *         parse is still working on the very same track and is left to finish.
+     */
+    bool Claim(uint64_t generation, uint64_t trackKey, bool force);
+
+    /**
+     * @brief Returns whether the given generation still owns the presence.
+     */
+    bool IsCurrent(uint64_t generation) const;
+
+    /**
+     * @brief Number of events that were coalesced into a later one without starting a parse.
+     */
+    uint64_t CoalescedCount() const { return m_coalesced.load(); }
+
+private:
+    winrt::fire_and_forget Run(std::chrono::milliseconds delay, bool force);
+
+    ParseFunction                                                   m_parse;
+    std::atomic<int64_t>                                            m_debounceMs{ 300 };
+    std::atomic<uint64_t>                                           m_latestEvent{ 0 };
+    std::atomic<bool>                                               m_forcePending{ false };
+    std::atomic<uint64_t>                                           m_coalesced{ 0 };
+
+    mutable std::mutex                                              m_lock;
+    uint64_t                                                        m_owner = 0;         // Generation whose results may be published
+    uint64_t                                                        m_ownerTrackKey = 0; // Track the owner is working on
+    std::map<uint64_t, winrt::Windows::Foundation::IAsyncAction>    m_running;           // Parses in flight, by generation
+};
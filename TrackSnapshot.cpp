@@ -0,0 +1,176 @@
+﻿/**
+ * @file TrackSnapshot.cpp
+ * @brief Single-allocation UTF-8 track snapshots and their fingerprints.
+ */
+
+#include "pch.h"
+#include "TrackSnapshot.h"
+#include "CoverCache.h"
+#include "Hash.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <utility>
+
+/**
+ * @brief Header of a snapshot's allocation; the UTF-8 text of all fields follows it directly.
+ */
+struct TrackSnapshot::Block {
+    std::atomic<uint32_t>   references{ 1 };
+    uint32_t                offsets[FIELD_COUNT + 1]{}; // Start of each field in the text, then its end
+
+    char* Text() { return reinterpret_cast<char*>(this + 1); }
+    const char* Text() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+namespace
+{
+    /**
+     * @brief One field of a snapshot under construction, either still UTF-16 or already UTF-8.
+     */
+    struct FieldSource {
+        std::wstring_view   wide;
+        std::string_view    utf8;
+        bool                isWide = false;
+
+        size_t Utf8Size() const
+        {
+            if (!isWide) {
+                return utf8.size();
+            }
+            return wide.empty() ? 0 : WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), nullptr, 0, nullptr, nullptr);
+        }
+
+        void Write(char* destination, size_t size) const
+        {
+            if (!isWide) {
+                std::memcpy(destination, utf8.data(), size);
+            }
+            else if (size > 0) {
+                WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), destination, static_cast<int>(size), nullptr, nullptr);
+            }
+        }
+    };
+
+    FieldSource Wide(std::wstring_view text) { return { text, {}, true }; }
+    FieldSource Utf8(std::string_view text) { return { {}, text, false }; }
+
+    uint64_t NonZero(uint64_t fingerprint) { return fingerprint != 0 ? fingerprint : 1; }
+}
+
+TrackSnapshot::TrackSnapshot(std::wstring_view title, std::wstring_view artist, std::wstring_view album)
+{
+    const FieldSource sources[FIELD_COUNT] = { Wide(title), Wide(artist), Wide(album), Utf8({}) };
+
+    size_t sizes[FIELD_COUNT];
+    size_t total = 0;
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        sizes[i] = sources[i].Utf8Size();
+        total += sizes[i];
+    }
+
+    void* memory = ::operator new(sizeof(Block) + total);
+    m_block = new (memory) Block();
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < FIELD_COUNT; ++i) {
+        m_block->offsets[i] = offset;
+        sources[i].Write(m_block->Text() + offset, sizes[i]);
+        offset += static_cast<uint32_t>(sizes[i]);
+    }
+    m_block->offsets[FIELD_COUNT] = offset;
+
+    uint64_t fingerprint = 0;
+    for (FieldIndex field : { TITLE, ARTIST, ALBUM }) {
+        std::string_view text = Field(field);
+        fingerprint = HashBytes(text.data(), text.size(), fingerprint);
+    }
+    m_metadataFingerprint = NonZero(fingerprint);
+    m_fingerprint = m_metadataFingerprint; // No cover art yet
+    m_albumKey = MakeAlbumKey(artist, album);
+}
+
+TrackSnapshot TrackSnapshot::WithCoverArt(std::wstring_view coverArtUrl) const
+{
+    if (!m_block) {
+        return {};
+    }
+
+    const char* text = m_block->Text();
+    size_t metadataSize = m_block->offsets[COVER_ART_URL];
+    FieldSource url = Wide(coverArtUrl);
+    size_t urlSize = url.Utf8Size();
+
+    TrackSnapshot copy;
+    void* memory = ::operator new(sizeof(Block) + metadataSize + urlSize);
+    copy.m_block = new (memory) Block();
+    std::memcpy(copy.m_block->Text(), text, metadataSize);
+    url.Write(copy.m_block->Text() + metadataSize, urlSize);
+    std::memcpy(copy.m_block->offsets, m_block->offsets, sizeof(uint32_t) * (COVER_ART_URL + 1));
+    copy.m_block->offsets[FIELD_COUNT] = static_cast<uint32_t>(metadataSize + urlSize);
+
+    copy.m_metadataFingerprint = m_metadataFingerprint;
+    std::string_view urlText = copy.CoverArtUrl();
+    copy.m_fingerprint = urlText.empty() ? m_metadataFingerprint : NonZero(HashBytes(urlText.data(), urlText.size(), m_metadataFingerprint));
+    copy.m_albumKey = m_albumKey;
+    return copy;
+}
+
+TrackSnapshot::TrackSnapshot(const TrackSnapshot& other) noexcept
+    : m_block(other.m_block)
+    , m_metadataFingerprint(other.m_metadataFingerprint)
+    , m_fingerprint(other.m_fingerprint)
+    , m_albumKey(other.m_albumKey)
+{
+    if (m_block) {
+        m_block->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+TrackSnapshot::TrackSnapshot(TrackSnapshot&& other) noexcept
+    : m_block(other.m_block)
+    , m_metadataFingerprint(other.m_metadataFingerprint)
+    , m_fingerprint(other.m_fingerprint)
+    , m_albumKey(other.m_albumKey)
+{
+    other.m_block = nullptr;
+    other.m_metadataFingerprint = other.m_fingerprint = other.m_albumKey = 0;
+}
+
+TrackSnapshot& TrackSnapshot::operator=(const TrackSnapshot& other) noexcept
+{
+    TrackSnapshot copy(other);
+    Swap(copy);
+    return *this;
+}
+
+TrackSnapshot& TrackSnapshot::operator=(TrackSnapshot&& other) noexcept
+{
+    TrackSnapshot moved(std::move(other));
+    Swap(moved);
+    return *this;
+}
+
+TrackSnapshot::~TrackSnapshot()
+{
+    if (m_block && m_block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        m_block->~Block();
+        ::operator delete(m_block);
+    }
+}
+
+void TrackSnapshot::Swap(TrackSnapshot& other) noexcept
+{
+    std::swap(m_block, other.m_block);
+    std::swap(m_metadataFingerprint, other.m_metadataFingerprint);
+    std::swap(m_fingerprint, other.m_fingerprint);
+    std::swap(m_albumKey, other.m_albumKey);
+}
+
+std::string_view TrackSnapshot::Field(FieldIndex index) const
+{
+    if (!m_block) {
+        return {};
+    }
+    return std::string_view(m_block->Text() + m_block->offsets[index], m_block->offsets[index + 1] - m_block->offsets[index]);
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @class TrackSnapshot
+ * @brief Immutable, UTF-8 encoded metadata of one track as it is shown in Discord.
+ *
+ * The fields are converted from the UTF-16 strings SMTC reports exactly once, when the snapshot is
+ * captured, and stored back to back in a single reference-counted allocation, so copies are cheap
+ * and may be handed between threads. Fingerprints of the displayed fields are computed at the same
+ * time, which turns duplicate detection and presence diffing into integer compares.
+ */
+class TrackSnapshot {
+public:
+    /**
+     * @brief An empty snapshot: no track. All fields are empty and all fingerprints are 0.
+     */
+    TrackSnapshot() = default;
+
+    /**
+     * @brief Captures a track without cover art.
+     */
+    TrackSnapshot(std::wstring_view title, std::wstring_view artist, std::wstring_view album);
+
+    TrackSnapshot(const TrackSnapshot& other) noexcept;
+    TrackSnapshot(TrackSnapshot&& other) noexcept;
+    TrackSnapshot& operator=(const TrackSnapshot& other) noexcept;
+    TrackSnapshot& operator=(TrackSnapshot&& other) noexcept;
+    ~TrackSnapshot();
+
+    /**
+     * @brief Returns a copy of this snapshot that shows the given cover art URL.
+     */
+    TrackSnapshot WithCoverArt(std::wstring_view coverArtUrl) const;
+
+    bool Empty() const { return m_block == nullptr; }
+
+    std::string_view Title() const { return Field(TITLE); }
+    std::string_view Artist() const { return Field(ARTIST); }
+    std::string_view Album() const { return Field(ALBUM); }
+    std::string_view CoverArtUrl() const { return Field(COVER_ART_URL); }
+
+    /**
+     * @brief Identifies the track: title, artist and album. Never 0 unless the snapshot is empty.
+     */
+    uint64_t MetadataFingerprint() const { return m_metadataFingerprint; }
+
+    /**
+     * @brief Identifies everything the snapshot shows, cover art URL included. Never 0 unless empty.
+     */
+    uint64_t Fingerprint() const { return m_fingerprint; }
+
+    /**
+     * @brief MakeAlbumKey of the track's artist and album, computed at capture time.
+     */
+    uint64_t AlbumKey() const { return m_albumKey; }
+
+private:
+    enum FieldIndex : uint32_t { TITLE, ARTIST, ALBUM, COVER_ART_URL, FIELD_COUNT };
+
+    struct Block;
+
+    std::string_view Field(FieldIndex index) const;
+    void Swap(TrackSnapshot& other) noexcept;
+
+    Block*      m_block = nullptr;
+    uint64_t    m_metadataFingerprint = 0;
+    uint64_t    m_fingerprint = 0;
+    uint64_t    m_albumKey = 0;
+};
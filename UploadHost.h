@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @class IUploadHost
+ * @brief A temporary file host that cover art can be uploaded to.
+ *
+ * Backends are stateless apart from the shared HTTP client, so the uploader may run requests to
+ * several of them at once. Failures are reported as exceptions rather than error strings, which
+ * lets the uploader treat "the host answered with garbage" and "the host was unreachable" the same.
+ */
+class IUploadHost {
+public:
+    virtual ~IUploadHost() = default;
+
+    /**
+     * @brief Short, human-readable name used in logs and statistics.
+     */
+    virtual const wchar_t* Name() const = 0;
+
+    /**
+     * @brief URL whose connection the shared HTTP client should keep warm, or nullptr for out-of-process hosts.
+     */
+    virtual const wchar_t* WarmUpUrl() const = 0;
+
+    /**
+     * @brief Uploads an image and returns its public URL.
+     * @param binaryData The raw image data. The request holds a reference to it, so a request that is
+     *        cancelled and abandoned can go on sending it safely.
+     * @param expires When the file may be deleted again. Hosts that only offer fixed lifetimes round up.
+     * @return An awaitable operation that resolves to the public URL. It throws hresult_error on failure
+     *         and hresult_canceled when cancelled.
+     */
+    virtual winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> UploadAsync(
+        winrt::Windows::Storage::Streams::IBuffer binaryData, std::chrono::system_clock::time_point expires) = 0;
+};
+
+/**
+ * @brief 0x0.st over the shared in-process HTTP client.
+ */
+std::unique_ptr<IUploadHost> MakeZeroXZeroHost();
+
+/**
+ * @brief litterbox.catbox.moe over the shared in-process HTTP client.
+ */
+std::unique_ptr<IUploadHost> MakeLitterboxHost();
+
+/**
+ * @brief 0x0.st through a curl.exe child process, for machines where the in-process stack cannot connect.
+ */
+std::unique_ptr<IUploadHost> MakeCurlHost();
@@ -0,0 +1,318 @@
+﻿/**
+ * @file UploadHosts.cpp
+ * @brief The temporary file hosts cover art can be uploaded to.
+ *
+ * The in-process hosts share one keep-alive Windows.Web.Http client, so a track change costs one
+ * request on an already-open connection instead of a temp file, a child process and a fresh TCP
+ * handshake. The curl.exe shell-out is kept as a last resort for machines where the in-process
+ * stack cannot reach any host at all.
+ */
+
+#include "pch.h"
+#include "UploadHost.h"
+#include "ByteBuffer.h"
+#include "HttpSession.h"
+#include "StringUtils.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <winrt/Windows.Web.Http.h>
+#include <winrt/Windows.Web.Http.Headers.h>
+#include <winrt/Windows.Storage.Streams.h>
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::Web::Http;
+using namespace Windows::Web::Http::Headers;
+using namespace Windows::Storage::Streams;
+
+namespace
+{
+    constexpr wchar_t ZEROXZERO_URL[] = L"http://0x0.st";
+    constexpr wchar_t LITTERBOX_URL[] = L"https://litterbox.catbox.moe/resources/internals/api.php";
+
+    /**
+     * @brief Guesses the MIME type and file name of an image from its magic bytes.
+     */
+    void SniffImageType(array_view<uint8_t const> data, const wchar_t*& mimeType, const wchar_t*& fileName)
+    {
+        if (data.size() >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+            mimeType = L"image/jpeg";
+            fileName = L"cover.jpg";
+        }
+        else {
+            mimeType = L"image/png";
+            fileName = L"cover.png";
+        }
+    }
+
+    /**
+     * @brief Strips up to two trailing CR/LF characters from a host response.
+     */
+    std::wstring TrimResponse(std::wstring text)
+    {
+        if (!text.empty() && (text.back() == L'\n' || text.back() == L'\r')) {
+            text.pop_back();
+        }
+        if (!text.empty() && (text.back() == L'\n' || text.back() == L'\r')) {
+            text.pop_back();
+        }
+        return text;
+    }
+
+    /**
+     * @brief Returns the response as a URL, or throws if the host answered with something else.
+     */
+    hstring RequireUrl(std::wstring text)
+    {
+        if (text.rfind(L"http://", 0) != 0 && text.rfind(L"https://", 0) != 0) {
+            throw hresult_error(E_FAIL, hstring(L"Unexpected response: " + text.substr(0, 200)));
+        }
+        return hstring(text);
+    }
+
+    /**
+     * @brief Returns the file part of a multipart form over the upload's bytes.
+     */
+    HttpBufferContent MakeFileContent(IBuffer binaryData, const wchar_t*& fileName)
+    {
+        const wchar_t* mimeType = nullptr;
+        SniffImageType(array_view<uint8_t const>(binaryData.data(), binaryData.data() + binaryData.Length()), mimeType, fileName);
+
+        // The content holds a reference to the buffer, so WinINet can still be sending it after a cancel.
+        HttpBufferContent fileContent(binaryData);
+        fileContent.Headers().ContentType(HttpMediaTypeHeaderValue(mimeType));
+        return fileContent;
+    }
+
+    /**
+     * @brief POSTs a multipart form on the shared client and returns the URL in the response body.
+     */
+    IAsyncOperation<hstring> PostFormAsync(const wchar_t* url, HttpMultipartFormDataContent form)
+    {
+        auto cancellation = co_await get_cancellation_token();
+        cancellation.enable_propagation();
+
+        HttpResponseMessage response = co_await GetSharedHttpClient().PostAsync(Uri(url), form);
+        hstring body = co_await response.Content().ReadAsStringAsync();
+        std::wstring text = TrimResponse(std::wstring(body));
+
+        if (!response.IsSuccessStatusCode()) {
+            throw hresult_error(E_FAIL, hstring(L"HTTP " + std::to_wstring(static_cast<int>(response.StatusCode())) + L" " + text.substr(0, 200)));
+        }
+        co_return RequireUrl(std::move(text));
+    }
+
+    int64_t ToUnixMilliseconds(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    /**
+     * @class ZeroXZeroHost
+     * @brief 0x0.st, which accepts an absolute expiry time with every upload.
+     */
+    class ZeroXZeroHost : public IUploadHost {
+    public:
+        const wchar_t* Name() const override { return L"0x0.st"; }
+        const wchar_t* WarmUpUrl() const override { return ZEROXZERO_URL; }
+
+        IAsyncOperation<hstring> UploadAsync(IBuffer binaryData, std::chrono::system_clock::time_point expires) override
+        {
+            const wchar_t* fileName = nullptr;
+            HttpMultipartFormDataContent form;
+            form.Add(MakeFileContent(binaryData, fileName), L"file", fileName);
+            form.Add(HttpStringContent(std::to_wstring(ToUnixMilliseconds(expires))), L"expires");
+            return PostFormAsync(ZEROXZERO_URL, form);
+        }
+    };
+
+    /**
+     * @class LitterboxHost
+     * @brief litterbox.catbox.moe, which only offers a few fixed lifetimes.
+     */
+    class LitterboxHost : public IUploadHost {
+    public:
+        const wchar_t* Name() const override { return L"litterbox"; }
+        const wchar_t* WarmUpUrl() const override { return LITTERBOX_URL; }
+
+        IAsyncOperation<hstring> UploadAsync(IBuffer binaryData, std::chrono::system_clock::time_point expires) override
+        {
+            auto lifetime = std::chrono::duration_cast<std::chrono::hours>(expires - std::chrono::system_clock::now());
+            const wchar_t* time = lifetime.count() < 1 ? L"1h" : lifetime.count() < 12 ? L"12h" : lifetime.count() < 24 ? L"24h" : L"72h";
+
+            const wchar_t* fileName = nullptr;
+            HttpMultipartFormDataContent form;
+            form.Add(HttpStringContent(L"fileupload"), L"reqtype");
+            form.Add(HttpStringContent(time), L"time");
+            form.Add(MakeFileContent(binaryData, fileName), L"fileToUpload", fileName);
+            return PostFormAsync(LITTERBOX_URL, form);
+        }
+    };
+
+    /**
+     * @struct CurlProcess
+     * @brief The running curl.exe, shared with the cancellation callback that terminates it.
+     */
+    struct CurlProcess {
+        std::mutex  lock;
+        HANDLE      process = nullptr;  // Set while curl.exe runs
+        bool        cancelled = false;
+
+        /**
+         * @brief Kills curl.exe if it is running, and keeps it from being started otherwise.
+         */
+        void Cancel()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            cancelled = true;
+            if (process) {
+                TerminateProcess(process, ERROR_CANCELLED);
+            }
+        }
+    };
+
+    /**
+     * @class CurlHost
+     * @brief 0x0.st through curl.exe and a temporary file.
+     *
+     * Cancelling the upload terminates curl.exe, which closes its end of the output pipe and so ends
+     * the blocking read below; the temp file is deleted on every path out.
+     */
+    class CurlHost : public IUploadHost {
+    public:
+        const wchar_t* Name() const override { return L"curl"; }
+        const wchar_t* WarmUpUrl() const override { return nullptr; }
+
+        IAsyncOperation<hstring> UploadAsync(IBuffer binaryData, std::chrono::system_clock::time_point expires) override
+        {
+            auto cancellation = co_await get_cancellation_token();
+            auto curl = std::make_shared<CurlProcess>();
+            cancellation.callback([curl] { curl->Cancel(); });
+
+            int64_t expires_ms = ToUnixMilliseconds(expires);
+
+            wchar_t tempPath[MAX_PATH];
+            if (GetTempPathW(MAX_PATH, tempPath) == 0) {
+                throw hresult_error(E_FAIL, L"Could not get temp path");
+            }
+            std::wstring tempFilePath = std::wstring(tempPath) + L"\\TIDALRPC_" + std::to_wstring(std::chrono::system_clock::now().time_since_epoch().count()) + L".png";
+            {
+                std::ofstream tempFile(tempFilePath, std::ios::binary);
+                if (!tempFile.is_open()) {
+                    throw hresult_error(E_FAIL, L"Could not open temp file for writing");
+                }
+                tempFile.write(reinterpret_cast<const char*>(binaryData.data()), binaryData.Length());
+            }
+
+            // The child process is waited on synchronously, so never do that on the caller's thread.
+            try {
+                co_await resume_background();
+            }
+            catch (...) {
+                DeleteFileW(tempFilePath.c_str());
+                throw;
+            }
+
+            HANDLE hChildStd_OUT_Rd = NULL;
+            HANDLE hChildStd_OUT_Wr = NULL;
+            SECURITY_ATTRIBUTES sa;
+            sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+            sa.bInheritHandle = TRUE;
+            sa.lpSecurityDescriptor = NULL;
+
+            if (!CreatePipe(&hChildStd_OUT_Rd, &hChildStd_OUT_Wr, &sa, 0)) {
+                DeleteFileW(tempFilePath.c_str());
+                throw hresult_error(E_FAIL, L"Could not create stdout pipe");
+            }
+            if (!SetHandleInformation(hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0)) {
+                CloseHandle(hChildStd_OUT_Rd);
+                CloseHandle(hChildStd_OUT_Wr);
+                DeleteFileW(tempFilePath.c_str());
+                throw hresult_error(E_FAIL, L"Could not set handle information for pipe");
+            }
+
+            PROCESS_INFORMATION piProcInfo{};
+            STARTUPINFOW siStartInfo{};
+            siStartInfo.cb = sizeof(STARTUPINFOW);
+            siStartInfo.hStdError = hChildStd_OUT_Wr;
+            siStartInfo.hStdOutput = hChildStd_OUT_Wr;
+            siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
+
+            std::wstring command = L"curl.exe -s -F \"file=@" + tempFilePath + L"\" -F \"expires=" + std::to_wstring(expires_ms) + L"\" " + ZEROXZERO_URL;
+
+            BOOL bSuccess = FALSE;
+            DWORD createError = ERROR_CANCELLED;
+            {
+                // Under the lock, so a cancellation either prevents the launch or sees the process to kill.
+                std::lock_guard<std::mutex> guard(curl->lock);
+                if (!curl->cancelled) {
+                    bSuccess = CreateProcessW(NULL,
+                        &command[0],
+                        NULL,
+                        NULL,
+                        TRUE,
+                        CREATE_NO_WINDOW,
+                        NULL,
+                        NULL,
+                        &siStartInfo,
+                        &piProcInfo);
+                    createError = bSuccess ? ERROR_SUCCESS : GetLastError();
+                    curl->process = bSuccess ? piProcInfo.hProcess : nullptr;
+                }
+            }
+
+            CloseHandle(hChildStd_OUT_Wr);
+
+            std::string output;
+            if (bSuccess) {
+                CHAR chBuf[4096];
+                DWORD dwRead;
+                while (ReadFile(hChildStd_OUT_Rd, chBuf, 4096, &dwRead, NULL) && dwRead != 0) {
+                    output.append(chBuf, dwRead);
+                }
+
+                WaitForSingleObject(piProcInfo.hProcess, INFINITE);
+            }
+
+            bool cancelled;
+            {
+                std::lock_guard<std::mutex> guard(curl->lock);
+                curl->process = nullptr;
+                cancelled = curl->cancelled;
+            }
+            if (bSuccess) {
+                CloseHandle(piProcInfo.hProcess);
+                CloseHandle(piProcInfo.hThread);
+            }
+            CloseHandle(hChildStd_OUT_Rd);
+            DeleteFileW(tempFilePath.c_str());
+
+            if (cancelled) {
+                throw hresult_canceled();
+            }
+            if (!bSuccess) {
+                throw hresult_error(HRESULT_FROM_WIN32(createError), L"CreateProcess failed for curl.exe");
+            }
+            co_return RequireUrl(TrimResponse(s2ws(output)));
+        }
+    };
+}
+
+std::unique_ptr<IUploadHost> MakeZeroXZeroHost()
+{
+    return std::make_unique<ZeroXZeroHost>();
+}
+
+std::unique_ptr<IUploadHost> MakeLitterboxHost()
+{
+    return std::make_unique<LitterboxHost>();
+}
+
+std::unique_ptr<IUploadHost> MakeCurlHost()
+{
+    return std::make_unique<CurlHost>();
+}
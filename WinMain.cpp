@@ -22,94 +22,169 @@
 #define DISCORDPP_IMPLEMENTATION
 #include "discordpp.h"
 
+#include "CoverResolver.h"
+#include "CoverStore.h"
+#include "CoverUploader.h"
+#include "Hash.h"
+#include "HttpSession.h"
+#include "IdleMonitor.h"
+#include "Log.h"
+#include "MainLoop.h"
+#include "PlaybackTimeline.h"
+#include "PresenceHandoff.h"
+#include "PresencePublisher.h"
+#include "ResourceMonitor.h"
+#include "SessionTracker.h"
+#include "StartupTiming.h"
+#include "Settings.h"
+#include "Stats.h"
+#include "TrackPipeline.h"
+#include "Tracing.h"
+#include "TrackSnapshot.h"
+#include "StringUtils.h"
+
+#include <algorithm>
 #include <iostream>
 #include <io.h>
 #include <fcntl.h>
-#include <thread>
 #include <string>
 #include <functional>
+#include <future>
 #include <chrono>
+#include <optional>
+#include <thread>
+#include <utility>
 #include <vector>
-#include <fstream> 
 
 #include <winrt/Windows.Foundation.h>
-#include <winrt/Windows.Web.Http.h>
-#include <winrt/Windows.Security.Cryptography.h>
-#include <winrt/Windows.Web.Http.Headers.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.Media.Control.h>
-#include <winrt/Windows.Web.Http.Filters.h>
 
 using namespace winrt;
 using namespace Windows::Foundation;
-using namespace Windows::Web::Http;
-using namespace Windows::Security::Cryptography;
 using namespace Windows::Storage::Streams;
 using namespace Windows::Media::Control;
-using namespace Windows::Web::Http::Headers;
-using namespace Windows::Web::Http::Filters;
-
-/**
- * @struct trackInfo
- * @brief Holds metadata for the currently playing media track.
- */
-struct trackInfo {
-    std::wstring title;
-    std::wstring artist;
-    std::wstring album;
-    std::wstring coverArtUrl; // Holds the public URL of the cover art
-};
 
 // Application constants
 
 const std::string RELEASE_VER = "v0.2";
 constexpr uint64_t APPLICATION_ID = 1429350918310072372;
 
+constexpr std::chrono::minutes COVER_URL_LIFETIME{ 7 };      // Expiry requested from 0x0.st when the track's length is unknown
+constexpr std::chrono::minutes COVER_URL_MIN_REMAINING{ 2 }; // Re-upload instead of reusing a URL that dies sooner
+constexpr std::chrono::minutes COVER_URL_MIN_LIFETIME{ 5 };  // Bounds for the expiry derived from the track's length
+constexpr std::chrono::minutes COVER_URL_MAX_LIFETIME{ 60 };
+constexpr std::chrono::minutes COVER_URL_REFRESH_LEAD{ 1 };  // Re-upload the displayed cover this long before it expires
+constexpr size_t               COVER_CACHE_CAPACITY = 64;
+constexpr uint32_t             COVER_SIMILAR_BITS = 3;  // Reuse an upload whose perceptual hash differs in at most this many bits
+constexpr uint64_t             MAX_THUMBNAIL_BYTES = 32 * 1024 * 1024; // Sanity cap for a single cover read
+constexpr uint32_t             PRESENCE_BURST = 5;                      // Discord allows 5 activity updates...
+constexpr std::chrono::seconds PRESENCE_REFILL{ 4 };                    // ...per 20 seconds
+constexpr std::chrono::seconds TIMELINE_TOLERANCE{ 2 };                 // Smaller position jumps are not seeks
+constexpr int                  TRAY_LOG_LEVEL_BASE = 10;                // Tray command ids 10-13 select a log level
+
 NOTIFYICONDATAW g_notifyIconData{};
 HWND            g_hWnd = nullptr;
 HWND            g_hConsoleWnd = nullptr;
 
 std::shared_ptr<discordpp::Client> client;
-winrt::event_token                     g_mediaPropertiesChangedToken;
 GlobalSystemMediaTransportControlsSessionManager g_sessionManager = nullptr;
-GlobalSystemMediaTransportControlsSession        g_currentSession = nullptr;
-trackInfo                                        g_lastTrackProcessed;
-bool                                             g_isParsing = false;
-
-struct ParsingGuard {
-    ParsingGuard(bool& flag) : m_flag(flag) { m_flag = true; }
-    ~ParsingGuard() { m_flag = false; }
-private:
-    bool& m_flag;
-};
+CoverStore                                       g_coverStore;              // Cover URLs that survive restarts
+CoverResolver                                    g_coverResolver;
 
+void sendPresence(const PresencePublisher::Presence& presence, std::function<void(PresencePublisher::SendResult)> done);
+PresencePublisher                                g_presencePublisher{ sendPresence, PRESENCE_BURST, PRESENCE_REFILL };
+
+bool isTidalApp(std::wstring_view appId);
+void onPinnedSessionChanged();
+void onMediaPropertiesChanged();
+std::optional<PlaybackTimeline> readTimeline(const GlobalSystemMediaTransportControlsSession& session);
+void onPlaybackState(bool playing);
+fire_and_forget refreshTimeline(GlobalSystemMediaTransportControlsSession session);
+SessionTracker                                   g_sessionTracker{ isTidalApp, { onPinnedSessionChanged, onMediaPropertiesChanged, refreshTimeline } };
+
+void applyPresenceUpdate(PresenceHandoff::Update& update);
 
 /**
- * @brief Converts a std::wstring (UTF-16) to a std::string (UTF-8).
- * @param wstr The wide string to convert.
- * @return The UTF-8 encoded string, suitable for use with libraries like the Discord SDK.
+ * @class SmtcMediaSource
+ * @brief Feeds the pipeline from the pinned TIDAL SMTC session.
  */
-std::string ws2s(const std::wstring& wstr)
-{
-    if (wstr.empty()) return std::string();
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), NULL, 0, NULL, NULL);
-    std::string strTo(size_needed, 0);
-    WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &strTo[0], size_needed, NULL, NULL);
-    return strTo;
-}
+class SmtcMediaSource : public IMediaSource {
+public:
+    IAsyncOperation<bool> ReadAsync(MediaSnapshot& snapshot) override
+    {
+        // The pinned TIDAL session, whichever app currently has the system's media focus.
+        auto session = g_sessionTracker.PinnedSession();
+        if (!session) {
+            co_return false;
+        }
+        auto appId = session.SourceAppUserModelId();
+        if (!isTidalApp(std::wstring_view(appId.c_str(), appId.size()))) {
+            co_return false;
+        }
+
+        auto mediaProperties = co_await session.TryGetMediaPropertiesAsync();
+        // The timeline travels with the track, so its first presence already shows its own progress bar.
+        PlaybackTimeline timeline = readTimeline(session).value_or(PlaybackTimeline{});
+        bool playing = timeline.playing;
+        PostToMainLoop([playing] { onPlaybackState(playing); });
+
+        snapshot.track = TrackSnapshot(mediaProperties.Title(), mediaProperties.Artist(), mediaProperties.AlbumTitle());
+        snapshot.thumbnail = mediaProperties.Thumbnail();
+        snapshot.timeline = timeline;
+        if (timeline.known && timeline.endMs > 0) {
+            // Paused tracks count as if playing on; the pipeline's refresh covers the pause itself.
+            int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            snapshot.remaining = std::chrono::milliseconds(timeline.endMs - nowMs);
+        }
+        co_return true;
+    }
+};
 
 /**
- * @brief Copies data from a WinRT IBuffer into a std::vector<byte>.
- * @param buffer The IBuffer to read from.
- * @return A std::vector<byte> containing the copied data.
+ * @class LiveCoverService
+ * @brief Resolves covers through g_coverResolver and uploads them through the configured hosts.
  */
-std::vector<byte> BufferToVector(IBuffer const& buffer)
-{
-    auto dataReader = DataReader::FromBuffer(buffer);
-    std::vector<byte> bytes(buffer.Length());
-    dataReader.ReadBytes(bytes);
-    return bytes;
-}
+class LiveCoverService : public ICoverService {
+public:
+    std::optional<std::wstring> Lookup(uint64_t albumKey) override
+    {
+        return g_coverResolver.Lookup(albumKey);
+    }
+
+    IAsyncOperation<winrt::hstring> ResolveAsync(TrackSnapshot track) override
+    {
+        // The catalog lookup matches against UTF-16 JSON; it only runs for albums that aren't known yet.
+        return g_coverResolver.ResolveAsync(s2ws(track.Title()), s2ws(track.Artist()), s2ws(track.Album()));
+    }
+
+    IAsyncOperation<winrt::hstring> UploadAsync(array_view<uint8_t const> bytes, std::chrono::system_clock::time_point expires, uint64_t generation) override
+    {
+        return UploadCoverArtAsync(bytes, expires, generation);
+    }
+};
+
+SmtcMediaSource                                  g_mediaSource;
+LiveCoverService                                 g_coverService;
+PresenceHandoff                                  g_presenceHandoff{ applyPresenceUpdate };
+TrackPipeline                                    g_trackPipeline{ g_mediaSource, g_coverService, g_presenceHandoff,
+    { COVER_CACHE_CAPACITY, COVER_URL_LIFETIME, COVER_URL_MIN_REMAINING, COVER_URL_MIN_LIFETIME, COVER_URL_MAX_LIFETIME,
+      COVER_URL_REFRESH_LEAD, MAX_THUMBNAIL_BYTES, &g_coverStore, COVER_SIMILAR_BITS } };
+
+void enterIdle();
+void leaveIdle();
+IdleMonitor                                      g_idleMonitor{ { enterIdle, leaveIdle } };
+
+// Main-thread copy of what the presence shows, so timeline changes can republish without a reparse.
+TrackSnapshot                                    g_presentedTrack;          // Empty while nothing is shown
+PlaybackTimeline                                 g_presentedTimeline;
+int64_t                                          g_presentedEventTicks = 0; // Event behind a track Discord hasn't shown yet
+uint64_t                                         g_presentedGeneration = 0; // Scheduler generation of the presented track, for tracing
+
+ResourceSample                                   g_startupResources;        // Baseline for spotting growth in long sessions
+bool                                             g_firstPresenceShown = false;
+bool                                             g_firstCoverShown = false;
+bool                                             g_sdkInfoLogging = false;  // Whether the SDK's Info messages are requested
 
 
 /**
@@ -119,313 +194,402 @@ std::vector<byte> BufferToVector(IBuffer const& buffer)
  */
 void clientLogCallback(std::string message, discordpp::LoggingSeverity severity)
 {
-    std::cerr << "[Discord SDK][" << EnumToString(severity) << "] " << message << std::endl;
+    LogLevel level = severity == discordpp::LoggingSeverity::Error ? LogLevel::Error
+        : severity == discordpp::LoggingSeverity::Warning ? LogLevel::Warning
+        : severity == discordpp::LoggingSeverity::Info ? LogLevel::Info
+        : LogLevel::Debug;
+    LOG_AT(level, "[Discord SDK] " << message);
+}
+/**
+ * @brief Asks the Discord SDK for its Info messages too, the first time the log level is Debug.
+ *
+ * The SDK formats every message at or above a callback's severity and cannot remove a callback,
+ * so the Info one is only added once somebody debugs; after they switch back, the level check
+ * drops its messages again. Main thread only.
+ */
+void enableSdkInfoLogging()
+{
+    if (g_sdkInfoLogging || !client) {
+        return;
+    }
+    g_sdkInfoLogging = true;
+    client->AddLogCallback([](std::string message, discordpp::LoggingSeverity severity) {
+        // Warnings and errors already arrive through the callback registered at startup.
+        if (severity < discordpp::LoggingSeverity::Warning && g_logLevel.load() == LogLevel::Debug) {
+            clientLogCallback(std::move(message), severity);
+        }
+        }, discordpp::LoggingSeverity::Info);
 }
 /**
  * @brief Clears the user's Rich Presence status in Discord.
+ *
+ * Main thread only.
  */
 void clearPresence()
 {
-    client->ClearRichPresence();
+    g_presentedTrack = {};
+    g_presencePublisher.Publish(std::nullopt);
+    SetConnectionsActive(false);
 }
-
 /**
- * @brief Updates the Discord Rich Presence with the provided track information.
- * @param track The trackInfo struct containing the metadata to display.
+ * @brief Called by the Discord SDK from RunCallbacks whenever the client's connection status changes.
+ *
+ * Presence goes over the desktop client's local IPC, which has no status of its own; the publisher
+ * detects that link failing from the UpdateRichPresence results. The SDK status adds the drops and
+ * recoveries it does report, so a restored connection replays the presence without waiting for a probe.
  */
-void updatePresence(const trackInfo& track)
+void onDiscordStatusChanged(discordpp::Client::Status status, discordpp::Client::Error error, int32_t errorDetail)
 {
-    discordpp::Activity activity;
-    activity.SetType(discordpp::ActivityTypes::Listening);
-    activity.SetName(ws2s(track.artist));
-    activity.SetDetails(ws2s(track.title));
-    activity.SetState(ws2s(track.artist));
+    LOG_DEBUG("Discord client status: " << discordpp::EnumToString(status) << " (" << discordpp::EnumToString(error) << ", " << errorDetail << ").");
+    if (status == discordpp::Client::Status::Ready) {
+        g_presencePublisher.OnConnectionRestored();
+    }
+    else if (status == discordpp::Client::Status::Reconnecting
+        || (status == discordpp::Client::Status::Disconnected && error != discordpp::Client::Error::None)) {
+        g_presencePublisher.OnConnectionLost();
+    }
+}
 
-    discordpp::ActivityAssets assets;
+/**
+ * @brief Adds the time to the first presence, and to the first one with cover art, to the startup milestones.
+ *
+ * Both count from process creation to Discord accepting the activity, which is what a user
+ * launching the app next to a playing TIDAL waits for. Main thread only.
+ */
+void markFirstPresence(bool hasCover)
+{
+    if (!g_firstPresenceShown) {
+        g_firstPresenceShown = true;
+        MarkStartup("first presence");
+        LOG_INFO("Startup: " << FormatStartupMarks());
+    }
+    if (hasCover && !g_firstCoverShown) {
+        g_firstCoverShown = true;
+        MarkStartup("first cover art");
+        LOG_INFO("Startup: " << FormatStartupMarks());
+    }
+}
 
-    if (!track.coverArtUrl.empty()) {
-        assets.SetLargeImage(ws2s(track.coverArtUrl));
-		assets.SetLargeText("Playing on TIDAL");
+/**
+ * @brief Sends a presence to Discord on behalf of g_presencePublisher. Main thread only.
+ * @param presence The activity to show, or std::nullopt to clear the presence.
+ * @param done Receives whether Discord accepted the update, rejected it, or could not be reached.
+ */
+void sendPresence(const PresencePublisher::Presence& presence, std::function<void(PresencePublisher::SendResult)> done)
+{
+    using SendResult = PresencePublisher::SendResult;
+
+    if (!presence) {
+        // ClearRichPresence reports no result; treat it as accepted.
+        TraceDiscordPublish(0, 0);
+        client->ClearRichPresence();
+        done(SendResult::Accepted);
+        return;
     }
 
-    assets.SetSmallImage("tidal-icon");
-    assets.SetSmallText("tidal-rpc " + RELEASE_VER + " by @emiferpro");
-    assets.SetSmallUrl("https://github.com/Emiferpro/tidal-rpc");
-    activity.SetAssets(assets);
+    // The publisher always sends the newest presence, so a pending event timestamp belongs to this request.
+    int64_t sendTicks = StatsNow();
+    int64_t eventTicks = std::exchange(g_presentedEventTicks, 0);
+
+    std::optional<discordpp::ActivityAssets> assets = presence->Assets();
+    bool hasCover = assets && assets->LargeImage().has_value();
+    uint64_t generation = g_presentedGeneration;
+    TraceDiscordPublish(generation, g_presentedTrack.Fingerprint());
 
-    client->UpdateRichPresence(activity, [](const discordpp::ClientResult& result) {
+    BeginDiscordRequest();
+    client->UpdateRichPresence(*presence, [done = std::move(done), sendTicks, eventTicks, hasCover, generation](const discordpp::ClientResult& result) {
+        EndDiscordRequest();
+        RecordStage(Stage::PresenceCallback, sendTicks);
+        TraceDiscordCallback(generation, result.Successful(), static_cast<int32_t>(result.Type()));
         if (result.Successful()) {
-            std::cout << "Rich presence updated successfully." << std::endl;
+            if (eventTicks != 0) {
+                RecordStage(Stage::EndToEnd, eventTicks);
+            }
+            markFirstPresence(hasCover);
+            LOG_INFO("Rich presence updated successfully.");
         }
         else {
-            std::cerr << "Failed to update rich presence: " << result.Error() << std::endl;
+            LOG_WARNING("Failed to update rich presence: " << result.Error());
         }
+        // Without the desktop client (closed, restarting) the IPC call fails before Discord ever sees it.
+        bool unreachable = result.Type() == discordpp::ErrorType::NetworkError || result.Type() == discordpp::ErrorType::ClientNotReady;
+        done(result.Successful() ? SendResult::Accepted : unreachable ? SendResult::Unreachable : SendResult::Rejected);
+
+        const PresencePublisher::Stats& stats = g_presencePublisher.GetStats();
+        LOG_DEBUG("Presence updates: " << stats.sent << " sent, " << stats.failed << " failed, "
+            << stats.dropped << " dropped, " << stats.coalesced << " coalesced, " << stats.reconnects << " reconnects.");
         });
 }
 
-
-
 /**
- * @brief Uploads a raw binary image buffer by shelling out to curl.exe.
- * @param binaryData The std::vector<byte> containing the raw image data.
- * @return An awaitable operation that resolves to the public URL of the uploaded image, or an error string.
+ * @brief Builds the activity for the presented track and timeline and hands it to the publisher.
+ *
+ * Main thread only.
  */
-IAsyncOperation<winrt::hstring> UploadCoverArtAsync(std::vector<byte> const& binaryData)
+void publishPresence()
 {
-    wchar_t tempPath[MAX_PATH];
-    if (GetTempPathW(MAX_PATH, tempPath) == 0) {
-        co_return L"Error: Could not get temp path";
+    if (g_presentedTrack.Empty()) {
+        return;
     }
-    std::wstring tempFilePath = std::wstring(tempPath) + L"\\TIDALRPC_" + std::to_wstring(std::chrono::system_clock::now().time_since_epoch().count()) + L".png";
+    const TrackSnapshot& track = g_presentedTrack;
 
-    {
-        std::ofstream tempFile(tempFilePath, std::ios::binary);
-        if (!tempFile.is_open()) {
-            co_return L"Error: Could not open temp file for writing";
-        }
-        tempFile.write(reinterpret_cast<const char*>(binaryData.data()), binaryData.size());
-    }
-
-    HANDLE hChildStd_OUT_Rd = NULL;
-    HANDLE hChildStd_OUT_Wr = NULL;
-    SECURITY_ATTRIBUTES sa;
-    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-    sa.bInheritHandle = TRUE;
-    sa.lpSecurityDescriptor = NULL;
-
-    if (!CreatePipe(&hChildStd_OUT_Rd, &hChildStd_OUT_Wr, &sa, 0)) {
-        DeleteFileW(tempFilePath.c_str());
-        co_return L"Error: Could not create stdout pipe";
-    }
-    if (!SetHandleInformation(hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0)) {
-        CloseHandle(hChildStd_OUT_Rd);
-        CloseHandle(hChildStd_OUT_Wr);
-        DeleteFileW(tempFilePath.c_str());
-        co_return L"Error: Could not set handle information for pipe";
-    }
-
-    PROCESS_INFORMATION piProcInfo{};
-    STARTUPINFOW siStartInfo{};
-    siStartInfo.cb = sizeof(STARTUPINFOW);
-    siStartInfo.hStdError = hChildStd_OUT_Wr;
-    siStartInfo.hStdOutput = hChildStd_OUT_Wr;
-    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
-
-    auto expires_time = std::chrono::system_clock::now() + std::chrono::minutes(7);
-    auto expires_ms = std::chrono::duration_cast<std::chrono::milliseconds>(expires_time.time_since_epoch()).count();
-    std::wstring command = L"curl.exe -s -F \"file=@" + tempFilePath + L"\" -F \"expires=" + std::to_wstring(expires_ms) + L"\" http://0x0.st";
-
-    BOOL bSuccess = CreateProcessW(NULL,
-        &command[0],
-        NULL,
-        NULL,
-        TRUE,
-        CREATE_NO_WINDOW,
-        NULL,
-        NULL,
-        &siStartInfo,
-        &piProcInfo);
-
-    CloseHandle(hChildStd_OUT_Wr);
-
-    std::string output;
-    if (bSuccess) {
-        CHAR chBuf[4096];
-        DWORD dwRead;
-        while (ReadFile(hChildStd_OUT_Rd, chBuf, 4096, &dwRead, NULL) && dwRead != 0) {
-            output.append(chBuf, dwRead);
-        }
+    discordpp::Activity activity;
+    activity.SetType(discordpp::ActivityTypes::Listening);
+    activity.SetName(std::string(track.Artist()));
+    activity.SetDetails(std::string(track.Title()));
+    activity.SetState(std::string(track.Artist()));
 
-        WaitForSingleObject(piProcInfo.hProcess, INFINITE);
-        CloseHandle(piProcInfo.hProcess);
-        CloseHandle(piProcInfo.hThread);
-    }
-    else {
-        output = "Error: CreateProcess failed with code " + std::to_string(GetLastError());
+    discordpp::ActivityAssets assets;
+
+    if (!track.CoverArtUrl().empty()) {
+        assets.SetLargeImage(std::string(track.CoverArtUrl()));
+        assets.SetLargeText(track.Album().empty() ? std::string("Playing on TIDAL") : std::string(track.Album()));
     }
 
-    CloseHandle(hChildStd_OUT_Rd);
-    DeleteFileW(tempFilePath.c_str());
+    assets.SetSmallImage("tidal-icon");
+    assets.SetSmallText("tidal-rpc " + RELEASE_VER + " by @emiferpro");
+    assets.SetSmallUrl("https://github.com/Emiferpro/tidal-rpc");
+    activity.SetAssets(assets);
+    ApplyTimeline(activity, g_presentedTimeline);
 
-    int size_needed = MultiByteToWideChar(CP_UTF8, 0, &output[0], (int)output.size(), NULL, 0);
-    std::wstring wstr(size_needed, 0);
-    MultiByteToWideChar(CP_UTF8, 0, &output[0], (int)output.size(), &wstr[0], size_needed);
+    // Everything else in the activity is constant, so the track and the timestamps identify it.
+    uint64_t fingerprint = track.Fingerprint();
+    if (g_presentedTimeline.known && g_presentedTimeline.playing) {
+        const int64_t timestamps[] = { g_presentedTimeline.startMs, g_presentedTimeline.endMs };
+        fingerprint = HashBytes(timestamps, sizeof(timestamps), fingerprint);
+    }
+    g_presencePublisher.Publish(activity, fingerprint);
+}
 
-    if (!wstr.empty() && (wstr.back() == L'\n' || wstr.back() == L'\r')) {
-        wstr.pop_back();
+/**
+ * @brief Updates the Discord Rich Presence with the provided track information.
+ *
+ * Main thread only.
+ * @param track The track to display.
+ * @param timeline The timeline the track was read with. Only used for a new track: an update that
+ *        adds the cover to the presented track keeps the timeline that timeline events have kept current.
+ * @param eventTicks StatsNow() of the SMTC event that produced the track, to time it end to end;
+ *        0 if this update only adds to a track that was already published.
+ * @param generation The scheduler generation that produced the track.
+ */
+void updatePresence(TrackSnapshot track, const PlaybackTimeline& timeline, int64_t eventTicks, uint64_t generation)
+{
+    if (track.MetadataFingerprint() != g_presentedTrack.MetadataFingerprint()) {
+        g_presentedTimeline = timeline;
     }
-    if (!wstr.empty() && (wstr.back() == L'\n' || wstr.back() == L'\r')) {
-        wstr.pop_back();
+    g_presentedTrack = std::move(track);
+    g_presentedGeneration = generation;
+    if (eventTicks != 0) {
+        g_presentedEventTicks = eventTicks;
     }
+    publishPresence();
+}
 
-    co_return winrt::hstring(wstr);
+/**
+ * @brief Applies a presence update handed over by the pipeline worker. Main thread only.
+ */
+void applyPresenceUpdate(PresenceHandoff::Update& update)
+{
+    if (!update.track.Empty()) {
+        updatePresence(std::move(update.track), update.timeline, update.eventTicks, update.generation);
+    }
+    else {
+        clearPresence();
+        g_idleMonitor.OnPlaybackChanged(false); // TIDAL is gone; it won't report a pause anymore
+    }
 }
 
+/**
+ * @brief Reads the session's timeline, logging read errors. Safe to call from any thread.
+ * @return The timeline, or std::nullopt if it could not be read.
+ */
+std::optional<PlaybackTimeline> readTimeline(const GlobalSystemMediaTransportControlsSession& session)
+{
+    try {
+        return ReadPlaybackTimeline(session);
+    }
+    catch (winrt::hresult_error const& ex) {
+        LOG_WARNING("Failed to read the playback timeline: " << ws2s(ex.message().c_str()));
+        return std::nullopt;
+    }
+}
 
-IAsyncAction parseTrack(bool force = false);
+/**
+ * @brief Follows the session's playback status. Main thread only.
+ */
+void onPlaybackState(bool playing)
+{
+    // Keep the upload connections warm only while something is playing.
+    SetConnectionsActive(playing);
+    g_idleMonitor.OnPlaybackChanged(playing);
+}
 
 /**
- * @brief Fetches media properties from the current SMTC session, uploads cover art, and updates Discord presence.
+ * @brief Re-reads the session's timeline and republishes the presence if the progress bar changed.
  *
- * This is the central logic function. It checks if the active media session is TIDAL.
- * If it is, it extracts track metadata, gets the thumbnail, uploads it directly using
- * UploadCoverArtAsync, and then calls updatePresence. If the session is not TIDAL
- * or is invalid, it calls clearPresence.
- * @return An awaitable fire-and-forget async action.
+ * Called on SMTC timeline and playback events rather than on a timer; between events Discord
+ * extrapolates the progress bar from the start/end timestamps on its own. The timeline is only
+ * applied if it belongs to the presented track: on a track change SMTC reports the new timeline
+ * before the debounced parse has read the new track, and that parse publishes both together.
+ * Safe to call from any thread.
+ * @param session The session whose timeline changed.
  */
-IAsyncAction parseTrack(bool force)
+fire_and_forget refreshTimeline(GlobalSystemMediaTransportControlsSession session)
 {
-    // *** FIX: Prevent concurrent executions with a flag ***
-    if (!force && g_isParsing) {
-        std::cout << "Already processing a track, ignoring concurrent event." << std::endl;
+    std::optional<PlaybackTimeline> timeline = readTimeline(session);
+    if (!timeline) {
         co_return;
     }
-    ParsingGuard guard(g_isParsing);
 
-    if (g_currentSession)
-    {
-        try {
-            auto appId = g_currentSession.SourceAppUserModelId();
-            std::wstring_view appIdView(appId.c_str(), appId.size());
-            if (appIdView.find(L"TIDAL") != std::wstring::npos)
-            {
-                auto mediaProperties = co_await g_currentSession.TryGetMediaPropertiesAsync();
-
-                trackInfo track;
-                track.title = mediaProperties.Title().c_str();
-                track.artist = mediaProperties.Artist().c_str();
-                track.album = mediaProperties.AlbumTitle().c_str();
-                track.coverArtUrl = L"";
-
-                // *** CACHE CHECK to prevent duplicate processing from spammy events ***
-                if (!force && track.title == g_lastTrackProcessed.title && track.artist == g_lastTrackProcessed.artist)
-                {
-                    std::cout << "Duplicate event for '" << ws2s(track.title) << "' ignored." << std::endl;
-                    co_return;
-                }
-
-                auto thumbnail = mediaProperties.Thumbnail();
-                if (thumbnail)
-                {
-                    auto stream = co_await thumbnail.OpenReadAsync();
-                    if (stream && stream.Size() > 0)
-                    {
-                        InMemoryRandomAccessStream memoryStream;
-                        co_await RandomAccessStream::CopyAsync(stream, memoryStream);
-
-                        if (memoryStream.Size() > 0)
-                        {
-                            memoryStream.Seek(0);
-                            auto dataReader = DataReader{ memoryStream.GetInputStreamAt(0) };
-                            unsigned int numBytesLoaded = co_await dataReader.LoadAsync(static_cast<unsigned int>(memoryStream.Size()));
-
-                            if (numBytesLoaded > 0)
-                            {
-                                auto buffer = dataReader.ReadBuffer(numBytesLoaded);
-                                if (buffer.Length() > 0)
-                                {
-                                    std::vector<byte> stableData = BufferToVector(buffer);
-                                    if (stableData.size() > 0)
-                                    {
-                                        std::cout << "Found cover art for '" << ws2s(track.title) << "'. Uploading..." << std::endl;
-                                        winrt::hstring uploadedUrl = co_await UploadCoverArtAsync(stableData);
-
-                                        if (!uploadedUrl.empty()) {
-                                            std::wstring_view urlView(uploadedUrl.c_str(), uploadedUrl.size());
-                                            if (urlView.find(L"Error:") == std::wstring::npos && urlView.find(L"Exception:") == std::wstring::npos) {
-                                                track.coverArtUrl = uploadedUrl.c_str();
-                                                std::cout << "Upload successful: " << ws2s(track.coverArtUrl) << std::endl;
-                                            }
-                                            else {
-                                                std::cerr << "Failed to upload cover art: " << ws2s(uploadedUrl.c_str()) << std::endl;
-                                            }
-                                        }
-                                    }
-                                    else { std::cerr << "BufferToVector created a 0-size vector. Aborting upload." << std::endl; }
-                                }
-                                else { std::cerr << "ReadBuffer created a 0-length buffer. Aborting upload." << std::endl; }
-                            }
-                            else { std::cout << "Cover art stream for '" << ws2s(track.title) << "' was empty (0 bytes loaded)." << std::endl; }
-                        }
-                        else { std::cout << "Cover art stream for '" << ws2s(track.title) << "' was empty (memoryStream size 0)." << std::endl; }
-                    }
-                }
-                else
-                {
-                    std::cout << "No cover art found for '" << ws2s(track.title) << "'." << std::endl;
-                }
-
-                updatePresence(track);
-
-                // *** UPDATE CACHE with the newly processed track ***
-                g_lastTrackProcessed = track;
-            }
-            else
-            {
-                std::cout << "No active TIDAL session found. Clearing presence." << std::endl;
-                clearPresence();
-                g_lastTrackProcessed = {};
-            }
-        }
-        catch (winrt::hresult_error const& ex)
-        {
-            std::cerr << "Failed to parse track info: "
-                << ws2s(ex.message().c_str()) << std::endl;
-            g_lastTrackProcessed = {};
-        }
+    // The timeline does not say which track it is for; the media properties read after it do.
+    uint64_t trackFingerprint = 0;
+    try {
+        auto mediaProperties = co_await session.TryGetMediaPropertiesAsync();
+        trackFingerprint = TrackSnapshot(mediaProperties.Title(), mediaProperties.Artist(), mediaProperties.AlbumTitle()).MetadataFingerprint();
     }
-    else
-    {
-        std::cout << "No active media session found. Clearing presence." << std::endl;
-        clearPresence();
-        g_lastTrackProcessed = {};
+    catch (winrt::hresult_error const& ex) {
+        LOG_WARNING("Failed to read the media properties for a timeline change: " << ws2s(ex.message().c_str()));
     }
-    co_return;
+
+    PostToMainLoop([timeline = *timeline, trackFingerprint] {
+        onPlaybackState(timeline.playing);
+
+        if (trackFingerprint == 0 || trackFingerprint != g_presentedTrack.MetadataFingerprint()) {
+            return;
+        }
+        if (IsSameTimeline(g_presentedTimeline, timeline, TIMELINE_TOLERANCE)) {
+            return;
+        }
+        g_presentedTimeline = timeline;
+        publishPresence();
+        });
 }
 
+/**
+ * @brief Called by g_idleMonitor once nothing has played for the idle timeout. Main thread only.
+ *
+ * Drops everything that costs power while nobody is listening: the presence, the pipeline's buffers
+ * and cover refreshes, the warm upload connections and the Discord SDK heartbeat.
+ */
+void enterIdle()
+{
+    g_trackPipeline.Suspend();
+    clearPresence();
+    SetConnectionsActive(false);
+    SetMainLoopIdle(true);
+    SetEfficiencyMode(true);
+}
 
 /**
- * @brief Creates and attaches an event handler for media property changes on the current session.
+ * @brief Called by g_idleMonitor when playback starts again. Main thread only.
  */
-void RegisterMediaPropertiesChangedHandler()
+void leaveIdle()
 {
-    if (g_currentSession) {
-        std::cout << "Registering MediaPropertiesChanged event handler." << std::endl;
-        g_mediaPropertiesChangedToken = g_currentSession.MediaPropertiesChanged([](auto&&, auto&&) -> fire_and_forget
-            {
-                co_await std::chrono::milliseconds(300);
-
-                std::cout << "Media properties changed. Reparsing track..." << std::endl;
-                co_await parseTrack();
-            });
-    }
+    SetEfficiencyMode(false);
+    SetMainLoopIdle(false);
+    g_trackPipeline.Resume();
 }
 
+
+
+
 /**
- * @brief Creates a debug console window and redirects standard I/O streams to it.
+ * @brief Returns whether a media session belongs to the TIDAL desktop app.
  */
-void CreateDebugConsole()
+bool isTidalApp(std::wstring_view appId)
 {
-    if (AllocConsole())
-    {
-        FILE* pFile = nullptr;
-        freopen_s(&pFile, "CONOUT$", "w", stdout);
-        freopen_s(&pFile, "CONOUT$", "w", stderr);
-        freopen_s(&pFile, "CONIN$", "r", stdin);
+    return appId.find(L"TIDAL") != std::wstring_view::npos;
+}
+
+/**
+ * @brief Called by g_sessionTracker when the TIDAL session appears, goes away or is replaced.
+ *
+ * Other apps taking the system's media focus no longer end up here, so the presence and the
+ * cover cache survive a browser tab or game briefly becoming the current session.
+ */
+void onPinnedSessionChanged()
+{
+    LOG_INFO("TIDAL media session changed.");
+    g_trackPipeline.ForgetLastTrack();
+    g_trackPipeline.Schedule();
+}
+
+/**
+ * @brief Called by g_sessionTracker when the TIDAL session reports new media properties.
+ */
+void onMediaPropertiesChanged()
+{
+    CountEvent(Counter::MediaEvents);
+    LOG_DEBUG("Media properties changed. Scheduling reparse...");
+    g_trackPipeline.Schedule();
+}
+
+/**
+ * @brief Creates the debug console window, redirects standard I/O streams to it, and starts logging to it.
+ *
+ * Only called the first time the console is shown: without one the process has no conhost.exe and
+ * log lines only go to the file. The logger backfills the console with its recent history.
+ * @return false if the console could not be created.
+ */
+bool CreateDebugConsole()
+{
+    if (!AllocConsole()) {
+        LOG_WARNING("Could not create the debug console (error " << GetLastError() << ").");
+        return false;
+    }
+
+    FILE* pFile = nullptr;
+    freopen_s(&pFile, "CONOUT$", "w", stdout);
+    freopen_s(&pFile, "CONOUT$", "w", stderr);
+    freopen_s(&pFile, "CONIN$", "r", stdin);
+
+    std::cout.clear();
+    std::cerr.clear();
+    std::cin.clear();
 
-        std::cout.clear();
-        std::cerr.clear();
-        std::cin.clear();
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
 
-        SetConsoleOutputCP(CP_UTF8);
-        SetConsoleCP(CP_UTF8);
+    g_hConsoleWnd = GetConsoleWindow();
+    SetLogConsole(true);
+    LOG_INFO("Debug Console Initialized.");
+    return true;
+}
+
+/**
+ * @brief Stops logging to the debug console and frees it, taking its conhost.exe down with it.
+ */
+void FreeDebugConsole()
+{
+    SetLogConsole(false);
+    FreeConsole();
+    g_hConsoleWnd = nullptr;
+    LOG_INFO("Debug Console freed.");
+}
+
+/**
+ * @brief Shows the debug console, creating it on first use, or hides it again.
+ */
+void toggleDebugConsole()
+{
+    if (!g_hConsoleWnd) {
+        if (CreateDebugConsole() && g_hConsoleWnd) {
+            SetForegroundWindow(g_hConsoleWnd);
+        }
+        return;
+    }
 
-        g_hConsoleWnd = GetConsoleWindow();
-        if (g_hConsoleWnd) {
+    if (IsWindowVisible(g_hConsoleWnd)) {
+        if (g_settings.freeConsoleOnHide) {
+            FreeDebugConsole();
+        }
+        else {
             ShowWindow(g_hConsoleWnd, SW_HIDE);
         }
-        std::cout << "Debug Console Initialized." << std::endl;
+        return;
     }
+    ShowWindow(g_hConsoleWnd, SW_SHOW);
+    SetForegroundWindow(g_hConsoleWnd);
 }
 
 /**
@@ -445,6 +609,90 @@ void AddTrayIcon(HINSTANCE hInstance, HWND hwnd)
     Shell_NotifyIconW(NIM_ADD, &g_notifyIconData);
 }
 
+/**
+ * @brief Gathers the counters other modules keep for themselves, for the stats reports. Main thread only.
+ */
+StatsExtras collectStatsExtras()
+{
+    const PresencePublisher::Stats& presence = g_presencePublisher.GetStats();
+    StatsExtras extras = {
+        { "coalesced_events", g_trackPipeline.CoalescedCount() },
+        { "presence_sent", presence.sent },
+        { "presence_failed", presence.failed },
+        { "presence_dropped", presence.dropped },
+        { "presence_coalesced", presence.coalesced },
+        { "presence_reconnects", presence.reconnects },
+        { "log_lines_dropped", LogDroppedCount() },
+        { "cover_store_entries", g_coverStore.EntryCount() },
+        { "idle_entries", g_idleMonitor.IdleCount() },
+    };
+
+    for (auto const& [milestone, time] : GetStartupMarks()) {
+        std::string name = "startup_ms_" + milestone;
+        std::replace(name.begin(), name.end(), ' ', '_');
+        extras.emplace_back(name, static_cast<uint64_t>(time));
+    }
+
+    ResourceSample resources = SampleProcessResources();
+    extras.insert(extras.end(), {
+        { "private_kb", resources.privateBytes / 1024 },
+        { "private_kb_at_start", g_startupResources.privateBytes / 1024 },
+        { "working_set_kb", resources.workingSet / 1024 },
+        { "handles", resources.handleCount },
+        { "handles_at_start", g_startupResources.handleCount },
+        { "gdi_objects", resources.gdiObjects },
+        { "user_objects", resources.userObjects },
+        { "threads", resources.threadCount },
+        { "threads_at_start", g_startupResources.threadCount },
+        });
+    for (auto const& host : GetUploadHostStats()) {
+        std::string name = ws2s(host.name);
+        extras.emplace_back("upload_" + name + "_successes", host.successes);
+        extras.emplace_back("upload_" + name + "_failures", host.failures);
+    }
+    return extras;
+}
+
+/**
+ * @brief Shows the latency percentiles and counters in a message box.
+ *
+ * The box runs on its own thread so the main loop keeps servicing Discord while it is open.
+ */
+void showStats()
+{
+    std::string summary = FormatStatsSummary(collectStatsExtras());
+    LOG_INFO("Pipeline stats:\n" << summary); // The console keeps the columns aligned
+
+    std::wstring text = s2ws(summary);
+    std::thread([text = std::move(text)] {
+        MessageBoxW(nullptr, text.c_str(), L"TIDAL RPC Stats", MB_OK | MB_SETFOREGROUND);
+        }).detach();
+}
+
+/**
+ * @brief Writes the stats to a timestamped CSV file in the data directory.
+ */
+void exportStats()
+{
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    wchar_t fileName[64];
+    swprintf_s(fileName, L"\\stats-%04u%02u%02u-%02u%02u%02u.csv", now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+
+    std::wstring directory = GetAppDataDirectory();
+    if (directory.empty()) {
+        LOG_ERROR("Could not write stats: no data directory.");
+        return;
+    }
+    std::wstring path = directory + fileName;
+    if (WriteStatsCsv(path, collectStatsExtras())) {
+        LOG_INFO("Stats written to " << ws2s(path));
+    }
+    else {
+        LOG_ERROR("Could not write stats to " << ws2s(path));
+    }
+}
+
 /**
  * @brief Displays the right-click context menu for the tray icon.
  * @param hwnd The parent window handle.
@@ -454,9 +702,22 @@ void ShowTrayMenu(HWND hwnd)
     POINT pt;
     GetCursorPos(&pt);
 
+    HMENU hLogMenu = CreatePopupMenu();
+    const LogLevel currentLevel = g_logLevel.load();
+    const std::pair<LogLevel, const wchar_t*> logLevels[] = {
+        { LogLevel::Debug, L"Debug" }, { LogLevel::Info, L"Info" }, { LogLevel::Warning, L"Warning" }, { LogLevel::Error, L"Error" },
+    };
+    for (auto const& [level, name] : logLevels) {
+        UINT flags = MF_BYPOSITION | (level == currentLevel ? MF_CHECKED : MF_UNCHECKED);
+        InsertMenuW(hLogMenu, -1, flags, TRAY_LOG_LEVEL_BASE + static_cast<UINT>(level), name);
+    }
+
     HMENU hMenu = CreatePopupMenu();
     InsertMenuW(hMenu, -1, MF_BYPOSITION, 1, L"Force Update");
     InsertMenuW(hMenu, -1, MF_BYPOSITION, 3, L"Show/Hide Console");
+    InsertMenuW(hMenu, -1, MF_BYPOSITION | MF_POPUP, reinterpret_cast<UINT_PTR>(hLogMenu), L"Log Level");
+    InsertMenuW(hMenu, -1, MF_BYPOSITION, 4, L"Stats");
+    InsertMenuW(hMenu, -1, MF_BYPOSITION, 5, L"Export Stats CSV");
     InsertMenuW(hMenu, -1, MF_BYPOSITION, 2, L"Exit");
 
     SetForegroundWindow(hwnd);
@@ -465,25 +726,35 @@ void ShowTrayMenu(HWND hwnd)
         TPM_RIGHTBUTTON | TPM_RETURNCMD,
         pt.x, pt.y, 0, hwnd, nullptr);
 
-    DestroyMenu(hMenu);
+    DestroyMenu(hMenu); // Also destroys the attached submenu
+
+    if (cmd >= TRAY_LOG_LEVEL_BASE && cmd <= TRAY_LOG_LEVEL_BASE + static_cast<int>(LogLevel::Error)) {
+        LogLevel level = static_cast<LogLevel>(cmd - TRAY_LOG_LEVEL_BASE);
+        g_logLevel.store(level);
+        if (level == LogLevel::Debug) {
+            enableSdkInfoLogging();
+        }
+        LOG_AT(level, "Log level set to " << LogLevelName(level) << ".");
+        return;
+    }
 
     switch (cmd)
     {
     case 1:
-        parseTrack(true);
+        g_trackPipeline.ScheduleNow(true);
         break;
     case 2:
         Shell_NotifyIconW(NIM_DELETE, &g_notifyIconData);
         PostQuitMessage(0);
         break;
     case 3:
-        if (g_hConsoleWnd) {
-            bool isVisible = IsWindowVisible(g_hConsoleWnd);
-            ShowWindow(g_hConsoleWnd, isVisible ? SW_HIDE : SW_SHOW);
-            if (!isVisible) {
-                SetForegroundWindow(g_hConsoleWnd);
-            }
-        }
+        toggleDebugConsole();
+        break;
+    case 4:
+        showStats();
+        break;
+    case 5:
+        exportStats();
         break;
     }
 }
@@ -520,10 +791,64 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 
 
+/**
+ * @brief Requests the SMTC session manager and starts following the TIDAL session once it arrives.
+ *
+ * The request can take a noticeable part of a second on a cold start, so it runs while the tray
+ * icon, the Discord client and the main loop come up instead of blocking them.
+ */
+fire_and_forget startSessionTracking()
+{
+    try {
+        auto manager = co_await GlobalSystemMediaTransportControlsSessionManager::RequestAsync();
+        PostToMainLoop([manager] {
+            g_sessionManager = manager;
+            g_sessionTracker.Attach(g_sessionManager);
+            MarkStartup("SMTC ready");
+
+            if (g_sessionTracker.PinnedSession()) {
+                LOG_INFO("Performing initial track analysis...");
+                g_trackPipeline.ScheduleNow();
+            }
+            else {
+                LOG_INFO("No TIDAL media session on startup. Waiting for changes.");
+            }
+
+            g_startupResources = SampleProcessResources();
+            LOG_INFO("Startup: " << FormatStartupMarks());
+            LOG_INFO("Startup resources: " << FormatResourceSample(g_startupResources));
+            });
+    }
+    catch (const winrt::hresult_error& ex) {
+        std::wstring errorMessage = L"FATAL: WinRT initialization failed: " + std::wstring(ex.message());
+        PostToMainLoop([errorMessage] {
+            LOG_ERROR(ws2s(errorMessage));
+            MessageBoxW(nullptr, errorMessage.c_str(), L"TIDAL RPC Error", MB_OK | MB_ICONERROR);
+            Shell_NotifyIconW(NIM_DELETE, &g_notifyIconData);
+            PostQuitMessage(-1);
+            });
+    }
+}
+
 int __stdcall wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int)
 {
+    MarkStartup("wWinMain");
+    RegisterTracing();
+
+    // discord_partner_sdk.dll is delay-loaded; map it on another thread while startup carries on.
+    std::future<bool> discordSdkLoaded = std::async(std::launch::async, [] {
+        bool loaded = LoadLibraryW(L"discord_partner_sdk.dll") != nullptr;
+        MarkStartup("Discord SDK loaded");
+        return loaded;
+        });
+
     init_apartment();
-    CreateDebugConsole();
+    LoadSettings();
+    g_logLevel.store(g_settings.logLevel);
+    std::wstring dataDirectory = GetAppDataDirectory();
+    // No console until the tray menu asks for one; lines are kept in the logger's history meanwhile.
+    StartLogger(g_settings.logToFile && !dataDirectory.empty() ? dataDirectory + L"\\tidal-rpc.log" : std::wstring(), false);
+    MarkStartup("settings loaded");
 
     WNDCLASSW wc = {};
     wc.lpfnWndProc = WndProc;
@@ -532,76 +857,67 @@ int __stdcall wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int)
     RegisterClassW(&wc);
 
     g_hWnd = CreateWindowExW(0, wc.lpszClassName, L"TIDAL RPC Hidden Window", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, hInstance, nullptr);
-    if (!g_hWnd) return -1;
+    if (!g_hWnd) {
+        StopLogger();
+        return -1;
+    }
 
     AddTrayIcon(hInstance, g_hWnd);
+    MarkStartup("tray icon shown");
 
-    client = std::make_shared<discordpp::Client>();
-    client->SetApplicationId(APPLICATION_ID);
-    client->AddLogCallback(clientLogCallback, discordpp::LoggingSeverity::Info);
-
-    try {
-        g_sessionManager = GlobalSystemMediaTransportControlsSessionManager::RequestAsync().get();
-        g_sessionManager.CurrentSessionChanged([](auto&&, auto&&) -> fire_and_forget
-            {
-                std::cout << "Current media session changed." << std::endl;
-                if (g_currentSession) {
-                    g_currentSession.MediaPropertiesChanged(g_mediaPropertiesChangedToken);
-                }
-
-                g_lastTrackProcessed = {};
-                g_currentSession = g_sessionManager.GetCurrentSession();
-                RegisterMediaPropertiesChangedHandler();
+    // Before session tracking starts: the first parse may already look covers up in the store.
+    g_coverResolver.Configure(g_settings.tidalToken, g_settings.tidalCountryCode);
+    if (!dataDirectory.empty()) {
+        g_coverStore.Open(dataDirectory + L"\\covers.db");
+        g_coverResolver.Load(g_coverStore, dataDirectory + L"\\cover-urls.tsv");
+    }
 
-                co_await std::chrono::milliseconds(300);
+    InitMainLoop();
+    g_presenceHandoff.Register();
+    startSessionTracking();
 
-                co_await parseTrack();
-            });
+    g_trackPipeline.SetDebounce(std::chrono::milliseconds(g_settings.debounceMs));
+    g_trackPipeline.SetRecompression(g_settings.coverMaxPixels, g_settings.coverJpegQuality);
+    g_idleMonitor.SetTimeout(std::chrono::seconds(g_settings.idleTimeoutSec));
+    g_idleMonitor.Start();
 
-        g_currentSession = g_sessionManager.GetCurrentSession();
-        if (g_currentSession) {
-            RegisterMediaPropertiesChangedHandler();
-            std::cout << "Performing initial track analysis..." << std::endl;
-            parseTrack().get();
-        }
-        else {
-            std::cout << "No active media session on startup. Waiting for changes." << std::endl;
-        }
+    // No warm-up yet: the initial parse reads the timeline first thing and, if TIDAL is playing,
+    // connects to these hosts while it resolves the track. Nothing playing costs no connections.
+    std::vector<std::wstring> warmUpUrls = GetUploadHostUrls();
+    if (std::wstring resolverUrl = g_coverResolver.WarmUpUrl(); !resolverUrl.empty()) {
+        warmUpUrls.push_back(resolverUrl);
     }
-    catch (const winrt::hresult_error& ex) {
-        std::wstring errorMessage = L"FATAL: WinRT initialization failed: " + std::wstring(ex.message());
-        std::cerr << ws2s(errorMessage) << std::endl;
-        MessageBoxW(nullptr, errorMessage.c_str(), L"TIDAL RPC Error", MB_OK | MB_ICONERROR);
+    SetWarmUpUrls(std::move(warmUpUrls));
+
+    if (!discordSdkLoaded.get()) {
+        // Without this check the first SDK call would raise a delay-load exception instead.
+        LOG_ERROR("discord_partner_sdk.dll could not be loaded.");
+        MessageBoxW(nullptr, L"discord_partner_sdk.dll could not be loaded. Place it next to tidal-rpc.exe.", L"TIDAL RPC Error", MB_OK | MB_ICONERROR);
+        Shell_NotifyIconW(NIM_DELETE, &g_notifyIconData);
+        StopLogger();
         return -1;
     }
 
-
-    bool bIsRunning = true;
-    MSG msg;
-    while (bIsRunning)
-    {
-        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
-        {
-            if (msg.message == WM_QUIT)
-            {
-                bIsRunning = false;
-                break;
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
-        if (!bIsRunning) break;
-
-        // CRITICAL: Run Discord SDK callbacks on every loop iteration.
-        discordpp::RunCallbacks();
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    client = std::make_shared<discordpp::Client>();
+    client->SetApplicationId(APPLICATION_ID);
+    // The SDK formats every message at or above this severity, so Info is only asked for when debugging.
+    client->AddLogCallback(clientLogCallback, discordpp::LoggingSeverity::Warning);
+    if (g_settings.logLevel == LogLevel::Debug) {
+        enableSdkInfoLogging();
     }
+    client->SetStatusChangedCallback(onDiscordStatusChanged);
+    MarkStartup("Discord client ready");
 
-    clearPresence();
+    MarkStartup("main loop entered");
+    int exitCode = RunMainLoop();
+
+    client->ClearRichPresence();
+    CloseSharedHttpClient();
+    StopLogger();
+    UnregisterTracing();
     if (g_hConsoleWnd) {
         FreeConsole();
     }
 
-    return (int)msg.wParam;
+    return exitCode;
 }
\ No newline at end of file
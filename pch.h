@@ -1,14 +1,9 @@
 ﻿#pragma once
 
 #include <windows.h>
+#include <unknwn.h> // Must precede C++/WinRT so it can implement classic COM interfaces
 #ifdef GetCurrentTime
 #undef GetCurrentTime
 #endif
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Foundation.Collections.h>
-#include <winrt/Windows.System.h>
-#include <winrt/Windows.UI.Xaml.h>
-#include <winrt/Windows.UI.Xaml.Controls.h>
-#include <winrt/Windows.UI.Xaml.Hosting.h>
-#include <winrt/Windows.UI.Xaml.Media.h>
-#include <Windows.UI.Xaml.Hosting.DesktopWindowXamlSource.h>